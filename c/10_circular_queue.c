@@ -1,4 +1,4 @@
-// Circular Queue with Mutex and Atomic Operations
+// Circular Queue: lock-free MPMC ring (mpmc_queue.h) between the acceptor and the workers
 
 /*
 clear && wrk -t16 -c512 -d60s http://127.0.0.1:8080
@@ -19,97 +19,110 @@ Transfer/sec:     15.27MB
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <stdatomic.h>
+#include "elastic_pool.h"
+#include "mpmc_queue.h"
+#include "response_cache.h"
 
 #define PORT 8080
+#define MIN_THREAD_POOL_SIZE 2
 #define INITIAL_THREAD_POOL_SIZE 8
 #define MAX_THREAD_POOL_SIZE 16
 #define MAX_CONNECTION_SIZE 512
-#define MAX_WAITING_QUEUE_SIZE 1024
+#define MAX_WAITING_QUEUE_SIZE 1024 // power of two (mpmc_queue.h)
 #define BACKLOG 512
 #define BUFFER_SIZE 140
 #define RESPONSE_BODY "{\"message\": \"Hello, world!\"}"
-#define RESPONSE_BODY_LENGTH (sizeof(RESPONSE_BODY) - 1)
+
+#ifndef TARGET_WAIT_P99_US // grow while the p99 accept-to-worker wait is above this
+#define TARGET_WAIT_P99_US 1000
+#endif
+#ifndef IDLE_TIMEOUT_MS // a worker idle this long exits, down to MIN_THREAD_POOL_SIZE
+#define IDLE_TIMEOUT_MS 5000
+#endif
 
 int server_fd;
-pthread_t *thread_ids;
-pthread_mutex_t lock;
-int client_queue[MAX_WAITING_QUEUE_SIZE];
-int queue_front = 0, queue_rear = 0;
-atomic_int queue_size = 0;  // Use atomic int for queue size
-atomic_int has_clients = 0; // Flag to indicate if there are clients
-atomic_int current_thread_pool_size = INITIAL_THREAD_POOL_SIZE;
+mpmc_queue_t client_queue;
+elastic_pool_t pool; // wait-time histogram and growth policy
+atomic_int current_thread_pool_size = 0;
 
-// Function to enqueue a client connection
-void enqueue_client(int client_fd)
+// Responses of this server, rendered once per worker (see response_cache.h)
+static void register_routes(response_cache_t *cache)
 {
-    pthread_mutex_lock(&lock);
-    if (atomic_load(&queue_size) < MAX_WAITING_QUEUE_SIZE)
+    response_cache_init(cache);
+    if (response_cache_add(cache, "/", "200 OK", "application/json", RESPONSE_BODY, "close") < 0 ||
+        response_cache_add(cache, NULL, "404 Not Found", "text/plain", "Not Found", "close") < 0)
     {
-        client_queue[queue_rear] = client_fd;
-        queue_rear = (queue_rear + 1) % MAX_WAITING_QUEUE_SIZE;
-        atomic_fetch_add(&queue_size, 1);
-        atomic_store(&has_clients, 1); // Set flag indicating clients are present
+        fprintf(stderr, "register_routes: cannot render the responses\n");
+        exit(EXIT_FAILURE);
     }
-    else
+}
+
+// Function to enqueue a client connection
+void enqueue_client(int client_fd)
+{
+    // Stamp first: a worker may take the client before push returns
+    elastic_pool_queued(&pool, client_fd);
+    if (mpmc_queue_push(&client_queue, client_fd) < 0)
     {
         close(client_fd); // Reject connection if queue is full
     }
-    pthread_mutex_unlock(&lock);
 }
 
-// Function to dequeue a client connection
+// Function to dequeue a client connection (spins briefly, then sleeps until one arrives)
+// Returns -1 once the worker has idled for IDLE_TIMEOUT_MS
 int dequeue_client()
 {
     int client_fd;
+    if (mpmc_queue_pop_timeout(&client_queue, IDLE_TIMEOUT_MS, &client_fd) < 0)
+        return -1;
+    elastic_pool_started(&pool, client_fd);
+    return client_fd;
+}
 
-    while (1)
+// Leaves the pool unless it is at its minimum; returns 1 if the worker must exit
+int retire_worker()
+{
+    int pool_size = atomic_load(&current_thread_pool_size);
+    while (pool_size > MIN_THREAD_POOL_SIZE)
     {
-        pthread_mutex_lock(&lock);
-        if (atomic_load(&queue_size) > 0)
-        {
-            client_fd = client_queue[queue_front];
-            queue_front = (queue_front + 1) % MAX_WAITING_QUEUE_SIZE;
-            atomic_fetch_sub(&queue_size, 1);
-            if (atomic_load(&queue_size) == 0)
-            {
-                atomic_store(&has_clients, 0); // Clear flag if no clients
-            }
-            pthread_mutex_unlock(&lock);
-            break;
-        }
-        pthread_mutex_unlock(&lock);
-        usleep(100); // Reduce busy-waiting
+        if (atomic_compare_exchange_weak(&current_thread_pool_size, &pool_size, pool_size - 1))
+            return 1;
     }
-    return client_fd;
+    return 0;
 }
 
 // Worker thread function
 void *worker_thread(void *arg)
 {
+    response_cache_t responses;
+    register_routes(&responses);
+
     while (1)
     {
         int client_fd = dequeue_client();
-        char buffer[BUFFER_SIZE] = {0};
+        if (client_fd < 0)
+        {
+            if (retire_worker())
+            {
+                response_cache_destroy(&responses);
+                return NULL;
+            }
+            continue;
+        }
+        char buffer[BUFFER_SIZE];
 
         // Read request
-        if (read(client_fd, buffer, sizeof(buffer) - 1) < 0)
+        ssize_t bytes_read = read(client_fd, buffer, sizeof(buffer));
+        if (bytes_read < 0)
         {
             perror("read failed");
             close(client_fd);
             continue;
         }
 
-        // Write and send response
-        char response[BUFFER_SIZE];
-        int response_length = snprintf(response, sizeof(response),
-                                       "HTTP/1.1 200 OK\r\n"
-                                       "Content-Type: application/json\r\n"
-                                       "Content-Length: %zu\r\n"
-                                       "Connection: close\r\n\r\n"
-                                       "%s",
-                                       RESPONSE_BODY_LENGTH, RESPONSE_BODY);
-
-        if (write(client_fd, response, response_length) < 0)
+        // Send the pre-rendered response
+        const cached_response_t *response = response_cache_find(&responses, buffer, bytes_read);
+        if (write(client_fd, response->data, response->len) < 0)
         {
             perror("write failed");
         }
@@ -118,29 +131,30 @@ void *worker_thread(void *arg)
     return NULL;
 }
 
-void adjust_thread_pool_size()
+// Starts a detached worker; it exits by itself once idle
+int start_worker()
 {
-    int queue_len = atomic_load(&queue_size);
-    int pool_size = atomic_load(&current_thread_pool_size);
-
-    if (queue_len > (MAX_WAITING_QUEUE_SIZE / 2) && pool_size < MAX_THREAD_POOL_SIZE)
-    {
-        // printf("Increasing thread pool size\n");
-        int new_size = pool_size + 2;
-        new_size = new_size > MAX_THREAD_POOL_SIZE ? MAX_THREAD_POOL_SIZE : new_size;
-        for (int i = pool_size; i < new_size; i++)
-        {
-            pthread_create(&thread_ids[i], NULL, worker_thread, NULL);
-        }
-        atomic_store(&current_thread_pool_size, new_size);
-    }
-    else if (queue_len < (MAX_WAITING_QUEUE_SIZE / 4) && pool_size > INITIAL_THREAD_POOL_SIZE)
+    pthread_t tid;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    atomic_fetch_add(&current_thread_pool_size, 1);
+    int err = pthread_create(&tid, &attr, worker_thread, NULL);
+    pthread_attr_destroy(&attr);
+    if (err != 0)
     {
-        // printf("Decreasing thread pool size\n");
-        int new_size = pool_size - 2;
-        new_size = new_size < INITIAL_THREAD_POOL_SIZE ? INITIAL_THREAD_POOL_SIZE : new_size;
-        atomic_store(&current_thread_pool_size, new_size);
+        atomic_fetch_sub(&current_thread_pool_size, 1);
+        return -1;
     }
+    return 0;
+}
+
+// Grows the pool while clients wait too long for a worker; idle workers leave on their own
+void adjust_thread_pool_size()
+{
+    int grow = elastic_pool_check(&pool, atomic_load(&current_thread_pool_size), mpmc_queue_size(&client_queue));
+    while (grow-- > 0 && start_worker() == 0)
+        ;
 }
 
 void *monitor_thread(void *arg)
@@ -148,7 +162,7 @@ void *monitor_thread(void *arg)
     while (1)
     {
         adjust_thread_pool_size();
-        sleep(1);
+        usleep(ELASTIC_CHECK_MS * 1000);
     }
     return NULL;
 }
@@ -157,7 +171,6 @@ int main()
 {
     struct sockaddr_in address;
     int addrlen = sizeof(address);
-    thread_ids = malloc(MAX_THREAD_POOL_SIZE * sizeof(pthread_t));
     pthread_t monitor_tid;
     atomic_int stop_flag = 0; // Flag to signal threads to stop
 
@@ -170,7 +183,8 @@ int main()
 
     // Set socket options
     int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
     {
         perror("setsockopt failed");
         close(server_fd);
@@ -197,13 +211,25 @@ int main()
         exit(EXIT_FAILURE);
     }
 
-    // Initialize mutex
-    pthread_mutex_init(&lock, NULL);
+    // Initialize the client queue
+    if (mpmc_queue_init(&client_queue, MAX_WAITING_QUEUE_SIZE) < 0)
+    {
+        perror("mpmc_queue_init failed");
+        close(server_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    elastic_pool_init(&pool, MIN_THREAD_POOL_SIZE, MAX_THREAD_POOL_SIZE, TARGET_WAIT_P99_US, IDLE_TIMEOUT_MS);
+    response_date_start();
 
     // Create worker threads
     for (int i = 0; i < INITIAL_THREAD_POOL_SIZE; i++)
     {
-        pthread_create(&thread_ids[i], NULL, worker_thread, &stop_flag);
+        if (start_worker() < 0)
+        {
+            perror("pthread_create failed");
+            exit(EXIT_FAILURE);
+        }
     }
     pthread_create(&monitor_tid, NULL, monitor_thread, &stop_flag);
 
@@ -221,24 +247,16 @@ int main()
         enqueue_client(client_fd);
     }
 
-    // Signal threads to stop
+    // Signal threads to stop (workers are detached and exit when idle)
     atomic_store(&stop_flag, 1);
 
-    // Cancel and detach worker threads
-    for (int i = 0; i < atomic_load(&current_thread_pool_size); i++)
-    {
-        pthread_cancel(thread_ids[i]);
-        pthread_detach(thread_ids[i]); // Free the resources of the thread
-    }
-
     // Cancel and detach monitor thread
     pthread_cancel(monitor_tid);
     pthread_detach(monitor_tid); // Free the resources of the thread
 
     // Cleanup
-    pthread_mutex_destroy(&lock);
+    mpmc_queue_destroy(&client_queue);
     close(server_fd);
-    free(thread_ids);
 
     return 0;
 }
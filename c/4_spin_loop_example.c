@@ -11,70 +11,197 @@ Running 30s test @ http://127.0.0.1:8080
   3937570 requests in 30.10s, 443.11MB read
 Requests/sec: 130817.20
 Transfer/sec:     14.72MB
+
+Each worker owns an arena (arena.h) that holds everything a request needs:
+the request bytes (read in BUFFER_SIZE and grown in the arena up to
+MAX_REQUEST_SIZE, body included), the parsed views into them and the
+response a handler builds. It is reset once the response is written, so the
+request path does no malloc/free. GET / is answered from the response cache;
+other paths go through a router: GET /user/:id, and POST /echo, which sends
+the body back (the arena grows for large ones).
+
+curl -d @some_file http://127.0.0.1:8080/echo
 */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <poll.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include "arena.h"
+#include "http_parser.h"
+#include "router.h"
+#include "flat_router.h"
+#include "response_cache.h"
+#include "work_stealing.h"
 
 #define PORT 8080
-#define BUFFER_SIZE 140
+#define BUFFER_SIZE 1024                  // first read of a request
+#define MAX_REQUEST_SIZE (8 * 1024 * 1024) // head + body
+#define ARENA_SIZE (64 * 1024)            // per worker, kept across requests
+#define RESPONSE_SIZE 1024                // a handler's response starts this big
+#define LINGER_MS 100                     // draining a rejected request before close
 #define RESPONSE_BODY "{\"message\": \"Hello, world!\"}"
-#define RESPONSE_BODY_LENGTH (sizeof(RESPONSE_BODY) - 1)
 #define THREAD_POOL_SIZE 16
-#define QUEUE_SIZE 512
+
+static ws_executor_t executor; // per-worker deques of accepted client fds
+static flat_router_t router;   // built before the workers start, then read only
+
+static const char bad_request[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char too_large[] = "HTTP/1.1 413 Content Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
 
 typedef struct
 {
-    int client_fd;
-} client_data_t;
+    response_cache_t responses;
+    arena_t arena; // request lifetime memory, reset after every response
+} worker_t;
+
+// Responses of this server, rendered once per worker (see response_cache.h)
+static void register_routes(response_cache_t *cache)
+{
+    response_cache_init(cache);
+    if (response_cache_add(cache, "/", "200 OK", "application/json", RESPONSE_BODY, "close") < 0)
+    {
+        fprintf(stderr, "register_routes: cannot render the responses\n");
+        exit(EXIT_FAILURE);
+    }
+}
 
-client_data_t *queue[QUEUE_SIZE];
-int queue_start = 0;
-int queue_end = 0;
-sem_t queue_semaphore;
-pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void user_handler(void *data, request_view_t *req, response_writer_t *res)
+{
+    (void)data;
+    http_slice_t id = request_param(req, "id");
+    char body[128];
+    int len = snprintf(body, sizeof(body), "user %.*s", (int)id.len, id.ptr);
+    response_send(res, "200 OK", "text/plain", body, len < (int)sizeof(body) ? len : (int)sizeof(body) - 1);
+}
 
-void *handle_client(void *arg)
+static void echo_handler(void *data, request_view_t *req, response_writer_t *res)
 {
-    while (1)
+    (void)data;
+    response_send(res, "200 OK", "application/octet-stream", req->http->body.ptr, req->http->body.len);
+}
+
+// Per-worker state: the worker's responses and arena
+void *init_worker(int index)
+{
+    (void)index;
+    worker_t *worker = malloc(sizeof(worker_t));
+    if (!worker || arena_init(&worker->arena, ARENA_SIZE) < 0)
+    {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    register_routes(&worker->responses);
+    return worker;
+}
+
+static void write_all(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n <= 0)
+            return;
+        data += n;
+        len -= n;
+    }
+}
+
+/*
+ * Closes a client whose request was rejected (400, 413) before it was read in
+ * full. With its bytes unread, close() would send an RST that can discard the
+ * response before the client reads it: send FIN instead, then discard what
+ * still arrives for up to LINGER_MS.
+ */
+static void close_lingering(int fd)
+{
+    shutdown(fd, SHUT_WR);
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char discard[4096];
+    for (;;)
     {
-        sem_wait(&queue_semaphore);
-        pthread_mutex_lock(&queue_mutex);
-        client_data_t *client_data = queue[queue_start];
-        queue_start = (queue_start + 1) % QUEUE_SIZE;
-        pthread_mutex_unlock(&queue_mutex);
-
-        char buffer[BUFFER_SIZE];
-        ssize_t bytes_read = read(client_data->client_fd, buffer, sizeof(buffer) - 1);
-        if (bytes_read < 0)
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long left = LINGER_MS - ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (left <= 0 || poll(&pfd, 1, (int)left) <= 0 || read(fd, discard, sizeof(discard)) <= 0)
+            break;
+    }
+    close(fd);
+}
+
+/*
+ * Reads one request into the arena, growing its buffer as it fills.
+ * Returns the parse result (bytes of the request, or HTTP_PARSE_*), or 0 if
+ * the client closed or the request outgrew MAX_REQUEST_SIZE (*too_big set).
+ */
+static int read_request(arena_t *arena, int client_fd, char **buf, size_t *len, http_request_t *request,
+                        int *too_big)
+{
+    size_t cap = BUFFER_SIZE;
+    http_parser_t parser;
+    http_parser_reset(&parser);
+    *len = 0;
+    *too_big = 0;
+    if (!(*buf = arena_alloc(arena, cap)))
+        return 0;
+    for (;;)
+    {
+        if (*len == cap)
         {
-            perror("read failed");
-            close(client_data->client_fd);
-            free(client_data);
-            continue;
+            if (cap >= MAX_REQUEST_SIZE || !(*buf = arena_grow(arena, *buf, *len, cap * 2)))
+            {
+                *too_big = 1;
+                return 0;
+            }
+            cap *= 2;
         }
-        buffer[bytes_read] = '\0'; // Null-terminate the buffer
-
-        // printf("Received request:\n%s\n", buffer);
-
-        char response[BUFFER_SIZE];
-        int response_length = snprintf(response, sizeof(response),
-                                       "HTTP/1.1 200 OK\r\n"
-                                       "Content-Type: application/json\r\n"
-                                       "Content-Length: %zu\r\n"
-                                       "Connection: close\r\n\r\n"
-                                       "%s",
-                                       RESPONSE_BODY_LENGTH, RESPONSE_BODY);
-
-        write(client_data->client_fd, response, response_length);
-        close(client_data->client_fd);
-        free(client_data);
+        ssize_t n = read(client_fd, *buf + *len, cap - *len);
+        if (n < 0)
+            perror("read failed");
+        if (n <= 0)
+            return 0;
+        *len += n;
+        int parsed = http_parse_request(&parser, *buf, *len, request);
+        if (parsed != HTTP_PARSE_INCOMPLETE)
+            return parsed;
+    }
+}
+
+// Runs on a worker for every accepted client
+void handle_client(void *state, int client_fd)
+{
+    worker_t *worker = state;
+    char *buf;
+    size_t len;
+    http_request_t request;
+    int too_big;
+    int parsed = read_request(&worker->arena, client_fd, &buf, &len, &request, &too_big);
+
+    const cached_response_t *cached;
+    response_writer_t res;
+    if (too_big)
+        write_all(client_fd, too_large, sizeof(too_large) - 1);
+    else if (parsed == HTTP_PARSE_ERROR)
+        write_all(client_fd, bad_request, sizeof(bad_request) - 1);
+    else if (parsed > 0 && (cached = response_cache_find(&worker->responses, buf, len)))
+        write_all(client_fd, cached->data, cached->len); // the pre-rendered response
+    else if (parsed > 0 && response_writer_init_arena(&res, &worker->arena, RESPONSE_SIZE) == 0)
+    {
+        request_view_t req;
+        request_view_init(&req, &request);
+        res.close = 1;
+        flat_router_dispatch(&router, &req, &res);
+        write_all(client_fd, res.buf, res.len);
     }
-    return NULL;
+    if (too_big || parsed == HTTP_PARSE_ERROR)
+        close_lingering(client_fd);
+    else
+        close(client_fd);
+    arena_reset(&worker->arena);
 }
 
 int main()
@@ -83,7 +210,21 @@ int main()
     struct sockaddr_in server_addr, client_addr;
     socklen_t client_addr_len = sizeof(client_addr);
 
-    sem_init(&queue_semaphore, 0, 0);
+    router_t routes;
+    router_init(&routes);
+    if (router_add(&routes, "GET", "/user/:id", user_handler, NULL) < 0 ||
+        router_add(&routes, "POST", "/echo", echo_handler, NULL) < 0 || flat_router_build(&router, &routes) < 0)
+    {
+        fputs("building the router failed\n", stderr);
+        exit(EXIT_FAILURE);
+    }
+    router_free(&routes);
+
+    if (ws_executor_init(&executor, handle_client, init_worker, NULL) < 0)
+    {
+        perror("ws_executor_init failed");
+        exit(EXIT_FAILURE);
+    }
 
     // Create server socket
     if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
@@ -94,7 +235,8 @@ int main()
 
     // Set socket options
     int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
     {
         perror("setsockopt failed");
         close(server_fd);
@@ -120,10 +262,15 @@ int main()
         exit(EXIT_FAILURE);
     }
 
-    pthread_t thread_pool[THREAD_POOL_SIZE];
+    response_date_start();
+
     for (int i = 0; i < THREAD_POOL_SIZE; i++)
     {
-        pthread_create(&thread_pool[i], NULL, handle_client, NULL);
+        if (ws_executor_add_worker(&executor) < 0)
+        {
+            perror("ws_executor_add_worker failed");
+            exit(EXIT_FAILURE);
+        }
     }
 
     while (1)
@@ -136,14 +283,10 @@ int main()
             continue;
         }
 
-        client_data_t *client_data = malloc(sizeof(client_data_t));
-        client_data->client_fd = client_fd;
-
-        pthread_mutex_lock(&queue_mutex);
-        queue[queue_end] = client_data;
-        queue_end = (queue_end + 1) % QUEUE_SIZE;
-        pthread_mutex_unlock(&queue_mutex);
-        sem_post(&queue_semaphore);
+        if (ws_executor_submit(&executor, client_fd) < 0)
+        {
+            close(client_fd); // the least-loaded worker's queue is full
+        }
     }
 
     close(server_fd);
@@ -20,38 +20,45 @@ Transfer/sec:       0.00B
 #include <arpa/inet.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include "elastic_pool.h"
+#include "response_cache.h"
+#include "work_stealing.h"
 
-#define RESPONSE "HTTP/1.1 200 OK\r\nDate: Wed, 23 Oct 2024 12:00:00 GMT\r\nContent-Type: application/json\r\nContent-Length: 27\r\nConnection: keep-alive\r\n\r\n{\r\n  \"message\": \"Hello, world!\"\r\n}"
-#define RESPONSE_LEN (sizeof(RESPONSE) - 1)
+#define RESPONSE_BODY "{\r\n  \"message\": \"Hello, world!\"\r\n}"
 
+#define MIN_THREAD_POOL_SIZE 4
 #define INITIAL_THREAD_POOL_SIZE 16
 #define MAX_THREAD_POOL_SIZE 32
-#define MAX_QUEUE_SIZE 512
-#define HIGH_LOAD_THRESHOLD 400
-#define LOW_LOAD_THRESHOLD 100
 
-typedef struct
-{
-    int client_fd;
-} Task;
-
-pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
-pthread_mutex_t load_mutex = PTHREAD_MUTEX_INITIALIZER;
+#ifndef TARGET_WAIT_P99_US // grow while the p99 accept-to-worker wait is above this
+#define TARGET_WAIT_P99_US 1000
+#endif
+#ifndef IDLE_TIMEOUT_MS // a worker idle this long exits, down to MIN_THREAD_POOL_SIZE
+#define IDLE_TIMEOUT_MS 5000
+#endif
 
-Task task_queue[MAX_QUEUE_SIZE];
-int queue_front = 0, queue_back = 0;
-atomic_int current_load = 0;
+ws_executor_t executor; // client fds, from the acceptor to the workers' deques
+elastic_pool_t pool;    // wait-time histogram and growth policy
 atomic_bool server_running = true;
 
-pthread_t thread_pool[MAX_THREAD_POOL_SIZE];
-int thread_pool_size = INITIAL_THREAD_POOL_SIZE;
-
-void *worker_thread(void *arg);
+void *init_worker(int index);
+void fini_worker(void *state);
+void handle_task(void *state, int client_fd);
 void enqueue_task(int client_fd);
-Task dequeue_task();
 void adjust_thread_pool();
 
+// Responses of this server, rendered once per worker (see response_cache.h)
+static void register_routes(response_cache_t *cache)
+{
+    response_cache_init(cache);
+    if (response_cache_add(cache, "/", "200 OK", "application/json", RESPONSE_BODY, "close") < 0 ||
+        response_cache_add(cache, NULL, "404 Not Found", "text/plain", "Not Found", "close") < 0)
+    {
+        fprintf(stderr, "register_routes: cannot render the responses\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
 int main()
 {
     struct sockaddr_in server_addr;
@@ -65,6 +72,9 @@ int main()
         exit(EXIT_FAILURE);
     }
 
+    int opt = 1;
+    setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
     // Bind server socket
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
@@ -86,10 +96,25 @@ int main()
         exit(EXIT_FAILURE);
     }
 
+    if (ws_executor_init(&executor, handle_task, init_worker, fini_worker) < 0)
+    {
+        perror("ws_executor_init");
+        close(server_fd);
+        exit(EXIT_FAILURE);
+    }
+    ws_executor_set_idle_timeout(&executor, MIN_THREAD_POOL_SIZE, IDLE_TIMEOUT_MS);
+    elastic_pool_init(&pool, MIN_THREAD_POOL_SIZE, MAX_THREAD_POOL_SIZE, TARGET_WAIT_P99_US, IDLE_TIMEOUT_MS);
+
+    response_date_start();
+
     // Create worker threads
-    for (int i = 0; i < thread_pool_size; i++)
+    for (int i = 0; i < INITIAL_THREAD_POOL_SIZE; i++)
     {
-        pthread_create(&thread_pool[i], NULL, worker_thread, NULL);
+        if (ws_executor_add_worker(&executor) < 0)
+        {
+            perror("ws_executor_add_worker");
+            exit(EXIT_FAILURE);
+        }
     }
 
     while (server_running)
@@ -110,87 +135,67 @@ int main()
     // Clean up
     close(server_fd);
     server_running = false;
-    pthread_cond_broadcast(&queue_cond); // Wake up all threads to exit
-    for (int i = 0; i < thread_pool_size; i++)
-    {
-        pthread_join(thread_pool[i], NULL);
-    }
 
     return 0;
 }
 
 void enqueue_task(int client_fd)
 {
-    pthread_mutex_lock(&queue_mutex);
-    // Simple queue management for demonstration, could use ring buffer logic
-    if ((queue_back + 1) % MAX_QUEUE_SIZE == queue_front)
+    // Stamp first: a worker may take the task before submit returns
+    elastic_pool_queued(&pool, client_fd);
+    if (ws_executor_submit(&executor, client_fd) < 0)
     {
         // fprintf(stderr, "Task queue is full!\n");
         close(client_fd);
     }
-    else
-    {
-        task_queue[queue_back].client_fd = client_fd;
-        queue_back = (queue_back + 1) % MAX_QUEUE_SIZE;
-        atomic_fetch_add(&current_load, 1);
-        pthread_cond_signal(&queue_cond);
-    }
-    pthread_mutex_unlock(&queue_mutex);
 }
 
-Task dequeue_task()
+// Per-worker state: the worker's responses
+void *init_worker(int index)
 {
-    pthread_mutex_lock(&queue_mutex);
-    while (queue_front == queue_back && server_running)
+    (void)index;
+    response_cache_t *responses = malloc(sizeof(response_cache_t));
+    if (!responses)
     {
-        pthread_cond_wait(&queue_cond, &queue_mutex);
-    }
-
-    Task task = {.client_fd = -1};
-    if (queue_front != queue_back)
-    {
-        task = task_queue[queue_front];
-        queue_front = (queue_front + 1) % MAX_QUEUE_SIZE;
-        atomic_fetch_sub(&current_load, 1);
+        perror("malloc");
+        exit(EXIT_FAILURE);
     }
-    pthread_mutex_unlock(&queue_mutex);
-    return task;
+    register_routes(responses);
+    return responses;
 }
 
-void *worker_thread(void *arg)
+// Runs on a worker that idled out
+void fini_worker(void *state)
 {
-    while (server_running)
-    {
-        Task task = dequeue_task();
-        if (task.client_fd == -1)
-            continue;
+    response_cache_destroy(state);
+    free(state);
+}
 
-        // Handle connection
-        char buffer[1024];
-        read(task.client_fd, buffer, sizeof(buffer));
+// Runs on a worker (its own, or the one that stole it) for every accepted client
+void handle_task(void *state, int client_fd)
+{
+    response_cache_t *responses = state;
+    elastic_pool_started(&pool, client_fd);
 
-        // Send HTTP response
-        write(task.client_fd, RESPONSE, RESPONSE_LEN);
+    // Handle connection
+    char buffer[1024];
+    ssize_t bytes_read = read(client_fd, buffer, sizeof(buffer));
 
-        // Close connection
-        close(task.client_fd);
+    // Send HTTP response
+    if (bytes_read > 0)
+    {
+        const cached_response_t *response = response_cache_find(responses, buffer, bytes_read);
+        write(client_fd, response->data, response->len);
     }
-    return NULL;
+
+    // Close connection
+    close(client_fd);
 }
 
+// Grows the pool while accepted clients wait too long for a worker; idle workers leave on their own
 void adjust_thread_pool()
 {
-    pthread_mutex_lock(&load_mutex);
-    if (current_load >= HIGH_LOAD_THRESHOLD && thread_pool_size < MAX_THREAD_POOL_SIZE)
-    {
-        // Increase thread pool size
-        thread_pool_size++;
-        pthread_create(&thread_pool[thread_pool_size - 1], NULL, worker_thread, NULL);
-    }
-    else if (current_load < LOW_LOAD_THRESHOLD && thread_pool_size > INITIAL_THREAD_POOL_SIZE)
-    {
-        // Decrease thread pool size
-        thread_pool_size--;
-    }
-    pthread_mutex_unlock(&load_mutex);
+    int grow = elastic_pool_check(&pool, ws_executor_size(&executor), ws_executor_pending(&executor));
+    while (grow-- > 0 && ws_executor_add_worker(&executor) >= 0)
+        ;
 }
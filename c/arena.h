@@ -0,0 +1,158 @@
+// arena.h — Per-worker bump allocator for memory that lives as long as a request
+// Header-only, shared by the servers in this directory: #include "arena.h"
+//
+// A worker owns one arena and resets it after each response is sent:
+// everything a request needs (its bytes, the response being built, a
+// handler's scratch) is carved from it by moving a pointer, and all of it is
+// dropped at once by moving the pointer back. Nothing is freed piece by piece
+// and no other thread touches the arena, so the request path neither calls
+// malloc/free nor contends on the allocator's locks.
+//
+// The first chunk is allocated by arena_init() and kept for the worker's
+// life; size it for ordinary requests. A request that outgrows it (a large
+// body) gets more chunks from malloc, each at least twice the last, and
+// arena_reset() returns them, so one large request does not pin memory.
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_HEADER ((sizeof(arena_chunk_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+typedef struct arena_chunk
+{
+    struct arena_chunk *next;
+    size_t size; // usable bytes after the header
+} arena_chunk_t;
+
+typedef struct
+{
+    char *ptr; // next free byte in the current chunk
+    char *end;
+    char *last;             // the latest allocation, which can grow in place
+    arena_chunk_t *first;   // kept across resets
+    arena_chunk_t *grown;   // chunks added since the last reset, newest first
+    size_t grown_count;     // chunks ever added (for tuning the first chunk)
+} arena_t;
+
+static inline char *arena_chunk_data(arena_chunk_t *c)
+{
+    return (char *)c + ARENA_HEADER;
+}
+
+static inline arena_chunk_t *arena_chunk_new(size_t size)
+{
+    arena_chunk_t *c = malloc(ARENA_HEADER + size);
+    if (c)
+    {
+        c->next = NULL;
+        c->size = size;
+    }
+    return c;
+}
+
+/**
+ * Allocates an arena's first chunk.
+ * @param a The arena.
+ * @param size Bytes of the chunk kept across resets.
+ * @return 0, or -1 if out of memory.
+ */
+static inline int arena_init(arena_t *a, size_t size)
+{
+    memset(a, 0, sizeof(*a));
+    if (!(a->first = arena_chunk_new(size)))
+        return -1;
+    a->ptr = arena_chunk_data(a->first);
+    a->end = a->ptr + size;
+    return 0;
+}
+
+/* Moves to a new chunk with room for size bytes. */
+static inline int arena_add_chunk(arena_t *a, size_t size)
+{
+    size_t last = a->grown ? a->grown->size : a->first->size;
+    size_t chunk = last * 2 > size ? last * 2 : size;
+    arena_chunk_t *c = arena_chunk_new(chunk);
+    if (!c)
+        return -1;
+    c->next = a->grown;
+    a->grown = c;
+    a->grown_count++;
+    a->ptr = arena_chunk_data(c);
+    a->end = a->ptr + chunk;
+    return 0;
+}
+
+/**
+ * Allocates from the arena; valid until the next arena_reset().
+ * @param a The arena.
+ * @param size Bytes wanted.
+ * @return ARENA_ALIGN-aligned memory, or NULL if out of memory.
+ */
+static inline void *arena_alloc(arena_t *a, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size > (size_t)(a->end - a->ptr) && arena_add_chunk(a, size) < 0)
+        return NULL;
+    a->last = a->ptr;
+    a->ptr += size;
+    return a->last;
+}
+
+/**
+ * Grows an allocation, in place when it is the latest one and its chunk has
+ * room, else by copying it to a new allocation.
+ * @param a The arena.
+ * @param p The allocation (NULL allocates).
+ * @param old_size Its size.
+ * @param new_size The size wanted.
+ * @return The allocation, possibly moved, or NULL if out of memory (p stays valid).
+ */
+static inline void *arena_grow(arena_t *a, void *p, size_t old_size, size_t new_size)
+{
+    if (p && p == a->last)
+    {
+        size_t size = (new_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+        if (size <= (size_t)(a->end - a->last))
+        {
+            a->ptr = a->last + size;
+            return p;
+        }
+    }
+    void *q = arena_alloc(a, new_size);
+    if (q && p)
+        memcpy(q, p, old_size);
+    return q;
+}
+
+/**
+ * Drops every allocation: back to the start of the first chunk, with the
+ * chunks added for large requests freed.
+ * @param a The arena.
+ */
+static inline void arena_reset(arena_t *a)
+{
+    while (a->grown)
+    {
+        arena_chunk_t *next = a->grown->next;
+        free(a->grown);
+        a->grown = next;
+    }
+    a->ptr = arena_chunk_data(a->first);
+    a->end = a->ptr + a->first->size;
+    a->last = NULL;
+}
+
+static inline void arena_free(arena_t *a)
+{
+    arena_reset(a);
+    free(a->first);
+    memset(a, 0, sizeof(*a));
+}
+
+#endif
@@ -0,0 +1,284 @@
+// conn_churn.c — Connection churn against a running server, checking every response
+// gcc -O3 -pthread -o conn_churn conn_churn.c
+// Run with: ./conn_churn [host] [port] [threads] [seconds]
+//
+// Each thread opens connections as fast as it can and ends each one in a
+// different way, picked at random:
+//   pipelined  1 to 16 keep-alive GETs sent at once; exactly that many
+//              responses must come back (framed by Content-Length), then
+//              nothing more once the client half-closes
+//   reset      one GET, then RST (SO_LINGER 0) before reading anything
+//   partial    half a request, then RST
+//   connect    RST right after connect
+//   mid-body   GET /large, RST after the first read of the body
+// The resets leave reads, writes and sends in flight on connections that are
+// gone while new connections take their fds (and, in io_uring.c, their slab
+// slots): a completion landing on the wrong connection shows up as a missing,
+// extra or foreign response on the pipelined ones. Servers without /large
+// answer it with a 404, which is still a response cut mid-read.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PIPELINE 16
+
+enum
+{
+    MODE_PIPELINED,
+    MODE_RESET,
+    MODE_PARTIAL,
+    MODE_CONNECT,
+    MODE_MID_BODY,
+    MODE_COUNT
+};
+
+static const char *const mode_names[MODE_COUNT] = {"pipelined", "reset", "partial", "connect", "mid-body"};
+
+enum
+{
+    ERR_CONNECT, // socket/connect/send failed
+    ERR_SHORT,   // fewer responses than requests before EOF or timeout
+    ERR_EXTRA,   // bytes after the last response
+    ERR_BAD,     // a response that does not parse
+    ERR_COUNT
+};
+
+static const char *const error_names[ERR_COUNT] = {"connect", "short", "extra", "bad response"};
+
+static struct sockaddr_in server_addr;
+static atomic_int stop;
+
+typedef struct
+{
+    pthread_t tid;
+    unsigned seed;
+    long connections[MODE_COUNT];
+    long responses;
+    long errors[ERR_COUNT];
+} client_t;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int open_connection(void)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval timeout = {5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Closes with RST: whatever the server has in flight on it fails. */
+static void reset_connection(int fd)
+{
+    struct linger linger = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    close(fd);
+}
+
+static int send_all(int fd, const char *p, size_t len)
+{
+    while (len)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Length of the response at the start of buf[0..len): 0 if incomplete, -1 if malformed. */
+static long response_length(const char *buf, size_t len)
+{
+    if (len < 12)
+        return 0;
+    if (memcmp(buf, "HTTP/1.", 7) != 0)
+        return -1;
+    const char *end = memmem(buf, len, "\r\n\r\n", 4);
+    if (!end)
+        return len > 8192 ? -1 : 0;
+    long body = -1;
+    for (const char *line = memchr(buf, '\n', end - buf); line && line < end; line = memchr(line + 1, '\n', end - line))
+        if (strncasecmp(line + 1, "Content-Length:", 15) == 0)
+            body = atol(line + 16);
+    if (body < 0)
+        return -1;
+    long head = end + 4 - buf;
+    return (size_t)(head + body) <= len ? head + body : 0;
+}
+
+static void pipelined(client_t *c, int fd, int k)
+{
+    static const char request[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    char out[sizeof(request) * MAX_PIPELINE];
+    for (int i = 0; i < k; i++)
+        memcpy(out + (sizeof(request) - 1) * i, request, sizeof(request) - 1);
+    if (send_all(fd, out, (sizeof(request) - 1) * k) < 0)
+    {
+        c->errors[ERR_CONNECT]++;
+        close(fd);
+        return;
+    }
+
+    char buf[64 * 1024];
+    size_t len = 0;
+    int got = 0;
+    while (got < k)
+    {
+        long n = response_length(buf, len);
+        if (n < 0)
+        {
+            c->errors[ERR_BAD]++;
+            close(fd);
+            return;
+        }
+        if (n > 0)
+        {
+            memmove(buf, buf + n, len - n);
+            len -= n;
+            got++;
+            continue;
+        }
+        ssize_t r = len < sizeof(buf) ? recv(fd, buf + len, sizeof(buf) - len, 0) : -1;
+        if (r <= 0)
+        {
+            c->errors[ERR_SHORT]++;
+            close(fd);
+            return;
+        }
+        len += r;
+    }
+    c->responses += got;
+
+    // All k are in; anything else the server sends before closing is not ours
+    shutdown(fd, SHUT_WR);
+    ssize_t r;
+    while ((r = recv(fd, buf + len, sizeof(buf) - len, 0)) > 0 && len + r < sizeof(buf))
+        len += r;
+    if (len || r > 0)
+        c->errors[ERR_EXTRA]++;
+    close(fd);
+}
+
+static void *client_main(void *arg)
+{
+    client_t *c = arg;
+    while (!atomic_load_explicit(&stop, memory_order_relaxed))
+    {
+        int mode = rand_r(&c->seed) % MODE_COUNT;
+        int fd = open_connection();
+        if (fd < 0)
+        {
+            c->errors[ERR_CONNECT]++;
+            continue;
+        }
+        c->connections[mode]++;
+        switch (mode)
+        {
+        case MODE_PIPELINED:
+            pipelined(c, fd, 1 + rand_r(&c->seed) % MAX_PIPELINE);
+            break;
+        case MODE_RESET:
+            send_all(fd, "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n", 35);
+            reset_connection(fd);
+            break;
+        case MODE_PARTIAL:
+            send_all(fd, "GET / HTTP/1.1\r\nHost: loc", 25);
+            reset_connection(fd);
+            break;
+        case MODE_CONNECT:
+            reset_connection(fd);
+            break;
+        default:
+        {
+            char buf[16 * 1024];
+            send_all(fd, "GET /large HTTP/1.1\r\nHost: localhost\r\n\r\n", 40);
+            (void)!recv(fd, buf, sizeof(buf), 0);
+            reset_connection(fd);
+            break;
+        }
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 8080;
+    int threads = argc > 3 ? atoi(argv[3]) : 16;
+    int seconds = argc > 4 ? atoi(argv[4]) : 10;
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &server_addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "bad IPv4 address: %s\n", host);
+        return 1;
+    }
+
+    client_t *clients = calloc(threads, sizeof(client_t));
+    double start = now_sec();
+    for (int i = 0; i < threads; i++)
+    {
+        clients[i].seed = 42 + i;
+        pthread_create(&clients[i].tid, NULL, client_main, &clients[i]);
+    }
+    sleep(seconds);
+    atomic_store(&stop, 1);
+
+    long connections[MODE_COUNT] = {0}, errors[ERR_COUNT] = {0}, total = 0, responses = 0, failed = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(clients[i].tid, NULL);
+        for (int m = 0; m < MODE_COUNT; m++)
+            connections[m] += clients[i].connections[m];
+        for (int e = 0; e < ERR_COUNT; e++)
+            errors[e] += clients[i].errors[e];
+        responses += clients[i].responses;
+    }
+    double elapsed = now_sec() - start;
+
+    printf("%s:%d, %d threads, %.1f s\n", host, port, threads, elapsed);
+    for (int m = 0; m < MODE_COUNT; m++)
+    {
+        printf("%-14s %10ld connections\n", mode_names[m], connections[m]);
+        total += connections[m];
+    }
+    printf("connections/s  %10.0f\n", total / elapsed);
+    printf("responses      %10ld (pipelined, all checked)\n", responses);
+    for (int e = 0; e < ERR_COUNT; e++)
+    {
+        printf("%-14s %10ld errors\n", error_names[e], errors[e]);
+        failed += errors[e];
+    }
+    free(clients);
+    return failed ? 1 : 0;
+}
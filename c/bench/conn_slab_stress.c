@@ -0,0 +1,200 @@
+// conn_slab_stress.c — conn_slab.h under connection churn with completions in flight
+// gcc -O3 -o conn_slab_stress conn_slab_stress.c
+// Run with: ./conn_slab_stress [operations]
+//
+// Plays a worker's ring without the kernel: connections open and close at
+// random while every connection keeps up to four completions in flight, each
+// carrying the 48-bit handle its SQE was tagged with. A completion comes back
+// after a random delay, often after its connection was closed and its slot
+// given to a new one. Each completion also remembers which connection (a
+// serial number) it was meant for: conn_slab_get() must return that
+// connection's slot while it is open and NULL once it is closed, every time.
+// The same completions are counted as a raw conn_t* in user_data would see
+// them: the ones that land on another connection are the bug handles fix.
+// Also times alloc/free and get against a plain free list of pointers.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../conn_slab.h"
+
+#define SLOTS 4096
+#define IN_FLIGHT (SLOTS * 4)
+
+typedef struct
+{
+    conn_slot_t slot;
+    uint64_t serial; // which connection holds the slot; 0 when free
+    int fd;
+    uint32_t pending;
+} conn_t;
+
+typedef struct
+{
+    uint64_t user_data;
+    uint64_t serial;
+    conn_t *ptr; // what PACK(op, c) would have carried
+} completion_t;
+
+static uint64_t rng = 88172645463325252ull;
+
+static uint64_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void stress(long operations)
+{
+    conn_slab_t slab;
+    if (conn_slab_init(&slab, SLOTS, sizeof(conn_t), 0) < 0)
+        abort();
+    conn_t **open = malloc(sizeof(conn_t *) * SLOTS);
+    completion_t *flight = malloc(sizeof(completion_t) * IN_FLIGHT);
+    uint32_t open_count = 0, flight_count = 0;
+    uint64_t serial = 0;
+    long delivered = 0, stale = 0, misdelivered = 0, opened = 0;
+
+    for (long op = 0; op < operations; op++)
+    {
+        uint64_t r = next_random();
+        switch (r % 4)
+        {
+        case 0: // accept
+        {
+            conn_t *c = conn_slab_alloc(&slab);
+            if (!c)
+                break;
+            c->serial = ++serial;
+            c->fd = (int)(serial & 0xffff);
+            c->pending = 0;
+            open[open_count++] = c;
+            opened++;
+            break;
+        }
+        case 1: // close (RST, timeout...) with completions still in flight
+            if (open_count)
+            {
+                uint32_t i = (uint32_t)(r >> 8) % open_count;
+                conn_t *c = open[i];
+                open[i] = open[--open_count];
+                c->serial = 0;
+                conn_slab_free(&slab, c);
+            }
+            break;
+        case 2: // submit
+            if (open_count && flight_count < IN_FLIGHT)
+            {
+                conn_t *c = open[(r >> 8) % open_count];
+                if (c->pending < 4)
+                {
+                    c->pending++;
+                    flight[flight_count++] = (completion_t){(uint64_t)3 << 48 | conn_slab_handle(&c->slot), c->serial, c};
+                }
+            }
+            break;
+        default: // complete, in any order
+            if (flight_count)
+            {
+                uint32_t i = (uint32_t)(r >> 8) % flight_count;
+                completion_t done = flight[i];
+                flight[i] = flight[--flight_count];
+                conn_t *c = conn_slab_get(&slab, done.user_data);
+                if (c)
+                {
+                    if (c->serial != done.serial)
+                    {
+                        fprintf(stderr, "handle %llx resolved to connection %llu, sent for %llu\n",
+                                (unsigned long long)done.user_data, (unsigned long long)c->serial,
+                                (unsigned long long)done.serial);
+                        exit(1);
+                    }
+                    c->pending--;
+                    delivered++;
+                }
+                else
+                {
+                    if (done.ptr->serial == done.serial)
+                    {
+                        fprintf(stderr, "handle for open connection %llu went stale\n",
+                                (unsigned long long)done.serial);
+                        exit(1);
+                    }
+                    stale++;
+                    if (done.ptr->serial)
+                        misdelivered++;
+                }
+            }
+            break;
+        }
+    }
+    printf("%ld operations, %ld connections, %ld completions delivered, %ld stale\n", operations, opened,
+           delivered, stale);
+    printf("stale completions a raw pointer would hand to a newer connection: %ld\n", misdelivered);
+    free(flight);
+    free(open);
+    conn_slab_destroy(&slab);
+}
+
+static void timing(long operations)
+{
+    conn_slab_t slab;
+    if (conn_slab_init(&slab, SLOTS, sizeof(conn_t), 0) < 0)
+        abort();
+    conn_t *pool = calloc(SLOTS, sizeof(conn_t));
+    conn_t **free_list = malloc(sizeof(conn_t *) * SLOTS);
+    uint64_t *handles = malloc(sizeof(uint64_t) * SLOTS);
+    volatile long sink = 0;
+
+    double start = now_sec();
+    for (long op = 0; op < operations; op += SLOTS)
+    {
+        for (int i = 0; i < SLOTS; i++)
+            handles[i] = conn_slab_handle(&((conn_t *)conn_slab_alloc(&slab))->slot);
+        for (int i = 0; i < SLOTS; i++)
+            sink += ((conn_t *)conn_slab_get(&slab, handles[(i * 7) % SLOTS]))->fd;
+        for (int i = 0; i < SLOTS; i++)
+            conn_slab_free(&slab, conn_slab_get(&slab, handles[i]));
+    }
+    double slab_elapsed = now_sec() - start;
+
+    uint32_t top = 0;
+    for (int i = 0; i < SLOTS; i++)
+        free_list[top++] = &pool[i];
+    start = now_sec();
+    for (long op = 0; op < operations; op += SLOTS)
+    {
+        for (int i = 0; i < SLOTS; i++)
+            handles[i] = (uint64_t)(uintptr_t)free_list[--top];
+        for (int i = 0; i < SLOTS; i++)
+            sink += ((conn_t *)(uintptr_t)handles[(i * 7) % SLOTS])->fd;
+        for (int i = 0; i < SLOTS; i++)
+            free_list[top++] = (conn_t *)(uintptr_t)handles[i];
+    }
+    double ptr_elapsed = now_sec() - start;
+
+    printf("alloc+get+get+free  slab handles %6.2f ns  raw pointers %6.2f ns\n", slab_elapsed / operations * 1e9,
+           ptr_elapsed / operations * 1e9);
+    free(handles);
+    free(free_list);
+    free(pool);
+    conn_slab_destroy(&slab);
+}
+
+int main(int argc, char **argv)
+{
+    long operations = argc > 1 ? atol(argv[1]) : 50000000;
+    stress(operations);
+    timing(operations);
+    return 0;
+}
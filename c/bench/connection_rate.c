@@ -0,0 +1,130 @@
+// connection_rate.c — New-connection throughput of a running server
+// gcc -O3 -pthread -o connection_rate connection_rate.c
+// Run with: ./connection_rate [host] [port] [threads] [seconds]
+//
+// Every request is on a fresh connection: connect, send one
+// "Connection: close" GET, read until the server closes, close. This stresses
+// accept and connection setup rather than request handling. Compare
+// epoll_simple.c built with and without -Dper_core_workers=1. The server closes
+// first, so its side holds TIME_WAIT and the client's ephemeral ports recycle.
+// Run the client pinned away from the server's cores (taskset) on big hosts.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct sockaddr_in server_addr;
+static atomic_int stop;
+
+typedef struct
+{
+    pthread_t tid;
+    long connections;
+    long errors;
+    double latency_sum; // seconds, connect to close
+    double latency_max;
+} client_t;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* One connection: returns 0 when a response was read to EOF. */
+static int one_connection(void)
+{
+    static const char request[] = "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+    char buf[4096];
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 ||
+        send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) != sizeof(request) - 1)
+    {
+        close(fd);
+        return -1;
+    }
+    size_t total = 0;
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+        total += n;
+    close(fd);
+    return n == 0 && total > 0 ? 0 : -1;
+}
+
+static void *client_main(void *arg)
+{
+    client_t *c = arg;
+    while (!atomic_load_explicit(&stop, memory_order_relaxed))
+    {
+        double start = now_sec();
+        if (one_connection() < 0)
+        {
+            c->errors++;
+            continue;
+        }
+        double latency = now_sec() - start;
+        c->connections++;
+        c->latency_sum += latency;
+        if (latency > c->latency_max)
+            c->latency_max = latency;
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 8080;
+    int threads = argc > 3 ? atoi(argv[3]) : 16;
+    int seconds = argc > 4 ? atoi(argv[4]) : 10;
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &server_addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "bad IPv4 address: %s\n", host);
+        return 1;
+    }
+
+    client_t *clients = calloc(threads, sizeof(client_t));
+    double start = now_sec();
+    for (int i = 0; i < threads; i++)
+        pthread_create(&clients[i].tid, NULL, client_main, &clients[i]);
+    sleep(seconds);
+    atomic_store(&stop, 1);
+
+    long connections = 0, errors = 0;
+    double latency_sum = 0, latency_max = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(clients[i].tid, NULL);
+        connections += clients[i].connections;
+        errors += clients[i].errors;
+        latency_sum += clients[i].latency_sum;
+        if (clients[i].latency_max > latency_max)
+            latency_max = clients[i].latency_max;
+    }
+    double elapsed = now_sec() - start;
+
+    printf("%s:%d, %d threads, %.1f s\n", host, port, threads, elapsed);
+    printf("connections/s  %10.0f\n", connections / elapsed);
+    printf("latency avg    %10.1f us\n", connections ? latency_sum / connections * 1e6 : 0);
+    printf("latency max    %10.1f us\n", latency_max * 1e6);
+    printf("errors         %10ld\n", errors);
+    free(clients);
+    return 0;
+}
@@ -0,0 +1,192 @@
+// flat_router_bench.c — flat_router.h against router.h's pointer trie
+// gcc -O3 -march=native -o flat_router_bench flat_router_bench.c
+// Run with: ./flat_router_bench [seconds_per_case]
+//
+// The route tables of router_bench.c (10, 1,000 and 10,000 routes, a quarter
+// static, one miss in ten, shuffled) looked up through a router_t and through
+// the flat_router_t built from it (every eighth route is a POST, so method
+// bits are not all GET). Besides lookups/s it counts L1 data cache
+// read misses per lookup with perf_event_open(2); where hardware counters are
+// not available (containers, VMs, perf_event_paranoid) that column is n/a.
+// Every flat lookup is checked against router_lookup first.
+
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include "../http_parser.h"
+#include "../router.h"
+#include "../flat_router.h"
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* A counter of this thread's L1D read misses, or -1. */
+static int l1_miss_counter(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t read_counter(int fd)
+{
+    uint64_t value = 0;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value))
+        return 0;
+    return value;
+}
+
+static void noop_handler(void *data, request_view_t *req, response_writer_t *res)
+{
+    (void)data;
+    (void)req;
+    (void)res;
+}
+
+static void make_route(int i, char *pattern, char *path, size_t size)
+{
+    switch (i % 4)
+    {
+    case 0:
+        snprintf(pattern, size, "/api/v%d/res%d", i % 3, i);
+        snprintf(path, size, "/api/v%d/res%d", i % 3, i);
+        break;
+    case 1:
+        snprintf(pattern, size, "/api/v%d/res%d/:id", i % 3, i);
+        snprintf(path, size, "/api/v%d/res%d/12345", i % 3, i);
+        break;
+    case 2:
+        snprintf(pattern, size, "/api/v%d/res%d/:id/items/:item", i % 3, i);
+        snprintf(path, size, "/api/v%d/res%d/12345/items/abc", i % 3, i);
+        break;
+    default:
+        snprintf(pattern, size, "/users/:user/res%d/settings", i);
+        snprintf(path, size, "/users/alice/res%d/settings", i);
+        break;
+    }
+}
+
+typedef struct
+{
+    char pattern[64];
+    char path[64];
+} route_case_t;
+
+static void report(int routes, const char *name, long lookups, double elapsed, int counter, uint64_t misses)
+{
+    printf("%6d routes  %-12s %12.0f lookups/s  %6.1f ns/lookup", routes, name, lookups / elapsed,
+           elapsed / lookups * 1e9);
+    if (counter >= 0)
+        printf("  %6.2f L1D misses/lookup\n", (double)misses / lookups);
+    else
+        printf("  n/a L1D misses/lookup\n");
+}
+
+static void run(int routes, double seconds, int counter)
+{
+    int paths = routes + routes / 10 + 1;
+    route_case_t *cases = malloc(sizeof(route_case_t) * paths);
+    router_t router;
+    router_init(&router);
+    for (int i = 0; i < routes; i++)
+    {
+        make_route(i, cases[i].pattern, cases[i].path, sizeof(cases[i].pattern));
+        if (router_add(&router, i % 8 == 0 ? "POST" : "GET", cases[i].pattern, noop_handler, (void *)(intptr_t)i) < 0)
+        {
+            fprintf(stderr, "router_add %s failed\n", cases[i].pattern);
+            exit(1);
+        }
+    }
+    for (int i = routes; i < paths; i++)
+        snprintf(cases[i].path, sizeof(cases[i].path), "/api/v%d/missing%d/1", i % 3, i);
+    flat_router_t flat;
+    if (flat_router_build(&flat, &router) < 0)
+    {
+        fputs("flat_router_build failed\n", stderr);
+        exit(1);
+    }
+
+    http_request_t *requests = calloc(paths, sizeof(http_request_t));
+    srand(42);
+    for (int i = 0; i < paths; i++)
+    {
+        int j = rand() % (i + 1); // inside-out shuffle
+        requests[i] = requests[j];
+        requests[j].method = i % 8 == 0 && i < routes ? (http_slice_t){"POST", 4} : (http_slice_t){"GET", 3};
+        requests[j].path = (http_slice_t){cases[i].path, strlen(cases[i].path)};
+    }
+
+    for (int i = 0; i < paths; i++)
+    {
+        request_view_t a, b;
+        request_view_init(&a, &requests[i]);
+        request_view_init(&b, &requests[i]);
+        int found_a, found_b;
+        const router_route_t *route = router_lookup(&router, &a, &found_a);
+        const flat_route_t *flat_route = flat_router_lookup(&flat, &b, &found_b);
+        if (!route != !flat_route || (route && route->data != flat_route->data) || found_a != found_b ||
+            a.param_count != b.param_count)
+        {
+            fprintf(stderr, "flat_router and router.h disagree on %.*s\n", (int)requests[i].path.len,
+                    requests[i].path.ptr);
+            exit(1);
+        }
+    }
+
+    for (int is_flat = 0; is_flat < 2; is_flat++)
+    {
+        long lookups = 0;
+        volatile long sink = 0;
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+        double start = now_sec(), elapsed;
+        do
+        {
+            for (int i = 0; i < paths; i++)
+            {
+                request_view_t req;
+                request_view_init(&req, &requests[i]);
+                sink += is_flat ? flat_router_lookup(&flat, &req, NULL) != NULL
+                                : router_lookup(&router, &req, NULL) != NULL;
+            }
+            lookups += paths;
+        } while ((elapsed = now_sec() - start) < seconds);
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        report(routes, is_flat ? "flat trie" : "radix trie", lookups, elapsed, counter, read_counter(counter));
+    }
+    printf("%6d routes  %u nodes, %zu bytes of nodes, edge bytes and routes\n", routes, flat.node_count,
+           flat.node_count * (sizeof(flat_node_t) + 1) + flat.route_count * sizeof(flat_route_t));
+
+    flat_router_free(&flat);
+    router_free(&router);
+    free(requests);
+    free(cases);
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+    int counter = l1_miss_counter();
+    if (counter < 0)
+        perror("perf_event_open (L1D misses)");
+    run(10, seconds, counter);
+    run(1000, seconds, counter);
+    run(10000, seconds, counter);
+    return 0;
+}
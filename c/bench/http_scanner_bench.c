@@ -0,0 +1,97 @@
+// http_scanner_bench.c — Scalar vs SSE4.2 vs AVX2 head scanning in http_parser.h
+// gcc -O3 -o http_scanner_bench http_scanner_bench.c
+// Run with: ./http_scanner_bench [iterations]
+//
+// Parses requests whose heads are ~200 B, 1 KB and just under 8 KB (the large
+// ones carry big cookies, as real browser traffic does) with each scanner the
+// CPU supports. 8 KB is the largest request epoll_simple.c and io_uring.c take.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../http_parser.h"
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Builds a realistic request head of about target bytes, never more, into buf. */
+static size_t build_request(char *buf, size_t cap, size_t target)
+{
+    size_t n = (size_t)snprintf(buf, cap,
+                                "GET /api/v1/users/123?fields=name,email HTTP/1.1\r\n"
+                                "Host: www.example.com\r\n"
+                                "Accept: */*\r\n"
+                                "Connection: keep-alive\r\n");
+    if (target > n + 64)
+    {
+        n += (size_t)snprintf(buf + n, cap - n,
+                              "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+                              "Accept-Language: en-US,en;q=0.9\r\n"
+                              "Accept-Encoding: gzip, deflate, br\r\n");
+    }
+    if (target > n + 16)
+    {
+        n += (size_t)snprintf(buf + n, cap - n, "Cookie: ");
+        for (int k = 0; n + 24 < target && n + 32 < cap; k++) // room for one more and the end
+            n += (size_t)snprintf(buf + n, cap - n, "c%d=%08x; ", k, (unsigned)(k * 2654435761u));
+        n += (size_t)snprintf(buf + n, cap - n, "\r\n");
+    }
+    n += (size_t)snprintf(buf + n, cap - n, "\r\n");
+    return n;
+}
+
+static void run(const http_scanner_t *scanner, const char *label, const char *req_buf, size_t len, long iterations)
+{
+    http_scanner = scanner;
+    http_parser_t parser;
+    http_request_t req;
+
+    double start = now_sec();
+    for (long i = 0; i < iterations; i++)
+    {
+        http_parser_reset(&parser);
+        if (http_parse_request(&parser, req_buf, len, &req) != (int)len)
+        {
+            fprintf(stderr, "%s: parse failed\n", scanner->name);
+            exit(1);
+        }
+    }
+    double elapsed = now_sec() - start;
+    printf("%-6s %-7s %10.2f MB/s %10.2f Mreq/s\n",
+           label, scanner->name, len * iterations / elapsed / 1e6, iterations / elapsed / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    long base = argc > 1 ? atol(argv[1]) : 4000000;
+    static const struct
+    {
+        const char *label;
+        size_t size;
+    } sets[] = {{"200B", 200}, {"1KB", 1024}, {"8KB", 8192}};
+
+    const http_scanner_t *scanners[3];
+    int nscanners = 0;
+    scanners[nscanners++] = &http_scanner_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("sse4.2"))
+        scanners[nscanners++] = &http_scanner_sse42;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi"))
+        scanners[nscanners++] = &http_scanner_avx2;
+#endif
+
+    static char buf[16384];
+    for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++)
+    {
+        size_t len = build_request(buf, sizeof(buf), sets[s].size);
+        long iterations = base * 200 / (long)len;
+        for (int k = 0; k < nscanners; k++)
+            run(scanners[k], sets[s].label, buf, len, iterations);
+    }
+    return 0;
+}
@@ -0,0 +1,570 @@
+// loadgen.c — HTTP/1.1 load generator with pipelining and log-linear latency histograms
+// gcc -O3 -pthread -o loadgen loadgen.c
+// Run with: ./loadgen [-c connections] [-t threads] [-d seconds] [-p pipeline]
+//                     [-R requests_per_s] [-w warmup_seconds] [-l label]
+//                     [-f text|csv] [host:port[/path]]
+//
+// wrk's model without Lua: each thread runs an epoll loop over its share of
+// the connections, keeps pipeline requests in flight on each (a new batch
+// once the last one is answered), and times every response from the moment
+// its batch was written to the moment its last byte was read. Latencies go
+// to a per-thread histogram (../histogram.h) merged at the end, so p99.9 and
+// max are exact to within 0.8% instead of wrk's sampled stdev.
+//
+// That closed loop only sends when the server has answered, so a server that
+// stalls gets fewer requests while it stalls, and the requests that would
+// have waited behind the stall are never timed (coordinated omission): the
+// tail looks better the worse the stall. -R switches to wrk2's open loop:
+// each thread follows a fixed schedule of rate / threads requests per second,
+// dealt round robin to its connections, and every latency is counted from
+// when its request was due, not when it could be sent. A connection with
+// pipeline requests in flight (or still connecting) keeps the ones falling
+// due, which then go out together, late, and are timed from their slots. The
+// backlog still owed at the end shows how far the server fell behind.
+//
+// Responses are framed by Content-Length, or by the server closing when there
+// is none (webserver.c); a response with "Connection: close" or a server that
+// hangs up ends the connection and a new one is opened in its place.
+// Requests still unanswered when that happens count as errors, so use -p 1
+// against servers that close after each response. Nothing is recorded during
+// the warmup.
+//
+// -f csv prints one line (see LOADGEN_CSV_HEADER, or -f csv-header for it)
+// for bench/run_servers.sh to collect into a table.
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "../histogram.h"
+
+#define MAX_PIPELINE 256
+#define IN_BUFFER (16 * 1024)
+#define LOADGEN_CSV_HEADER                                                                                     \
+    "label,connections,threads,pipeline,seconds,requests,requests_per_s,mb_per_s,mean_us,p50_us,p90_us,p99_us," \
+    "p999_us,max_us,errors,non2xx,reconnects,rate,p9999_us,backlog"
+
+typedef struct
+{
+    int fd;
+    int connecting;
+    int close_after;  // the response being read ends the connection
+    int want_out;     // EPOLLOUT is registered
+    size_t out_off;   // bytes of the batch in flight already written
+    size_t out_len;
+    uint64_t sent[MAX_PIPELINE]; // ring: when each request in flight was (to be) sent
+    int head;         // oldest request in flight
+    int inflight;
+    long owed;        // -R: requests scheduled but not written yet
+    double owed_ns;   // -R: when the first of them was due
+    size_t in_len;
+    long body_left;   // bytes of the current body still to come, -1: until EOF
+    int head_done;    // the current response's head is parsed
+    int status;
+    char in[IN_BUFFER];
+} conn_t;
+
+typedef struct
+{
+    pthread_t tid;
+    int connections;
+    double interval_ns; // -R: between this thread's requests
+    histogram_t latency; // ns
+    long requests;
+    long bytes;
+    long errors;
+    long non2xx;
+    long reconnects;
+    long backlog; // -R: requests owed or unanswered at the end
+} loadgen_thread_t;
+
+static struct sockaddr_in server_addr;
+static char *batch;
+static size_t batch_len, request_len;
+static int pipeline = 1;
+static double rate; // requests/s over all connections; 0: closed loop
+static atomic_int recording, stop;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int conn_open(int epfd, conn_t *c)
+{
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->fd < 0)
+        return -1;
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(c->fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0 && errno != EINPROGRESS)
+    {
+        close(c->fd);
+        return -1;
+    }
+    c->connecting = 1;
+    c->close_after = 0;
+    c->want_out = 1;
+    c->out_off = c->out_len = 0;
+    c->head = 0;
+    c->inflight = 0;
+    c->in_len = 0;
+    c->head_done = 0;
+    struct epoll_event ev = {.events = EPOLLOUT, .data.ptr = c};
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+/* Requests in flight are lost (errors); with -R the owed ones go out on the new connection. */
+static void conn_reopen(int epfd, conn_t *c, loadgen_thread_t *t)
+{
+    if (atomic_load_explicit(&recording, memory_order_relaxed))
+    {
+        t->errors += c->inflight;
+        t->reconnects++;
+    }
+    close(c->fd);
+    while (conn_open(epfd, c) < 0 && !atomic_load_explicit(&stop, memory_order_relaxed))
+    {
+        t->errors++;
+        usleep(1000);
+    }
+}
+
+/*
+ * Starts a batch if the last one is written and there is something to send:
+ * closed loop, pipeline requests once none is in flight, stamped now; with
+ * -R, the owed requests (up to pipeline in flight), stamped when they were
+ * due. Then writes what it can; EPOLLOUT is wanted until the batch is out.
+ */
+static int conn_write(int epfd, conn_t *c, const loadgen_thread_t *t)
+{
+    if (c->connecting)
+        return 0;
+    if (c->out_off == c->out_len)
+    {
+        int k;
+        if (rate)
+            k = c->owed < pipeline - c->inflight ? (int)c->owed : pipeline - c->inflight;
+        else
+            k = c->inflight ? 0 : pipeline;
+        if (k == 0)
+            return 0;
+        uint64_t now = now_ns();
+        double step = t->interval_ns * t->connections; // each connection takes every connections-th request
+        for (int i = 0; i < k; i++)
+            c->sent[(c->head + c->inflight + i) % MAX_PIPELINE] = rate ? (uint64_t)(c->owed_ns + i * step) : now;
+        if (rate)
+        {
+            c->owed -= k;
+            c->owed_ns += k * step;
+        }
+        c->inflight += k;
+        c->out_off = 0;
+        c->out_len = request_len * k;
+    }
+    while (c->out_off < c->out_len)
+    {
+        ssize_t n = send(c->fd, batch + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (n < 0 && errno == EAGAIN)
+            break;
+        if (n <= 0)
+            return -1;
+        c->out_off += n;
+    }
+    int want_out = c->out_off < c->out_len;
+    if (want_out == c->want_out)
+        return 0;
+    c->want_out = want_out;
+    struct epoll_event ev = {.events = want_out ? EPOLLIN | EPOLLOUT : EPOLLIN, .data.ptr = c};
+    return epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/* Parses the head at the start of c->in: 1 when done, 0 if incomplete, -1 if malformed. */
+static int parse_head(conn_t *c, size_t *head_len)
+{
+    const char *end = memmem(c->in, c->in_len, "\r\n\r\n", 4);
+    if (!end)
+        return c->in_len == sizeof(c->in) ? -1 : 0;
+    if (c->in_len < 12 || memcmp(c->in, "HTTP/1.", 7) != 0)
+        return -1;
+    c->status = atoi(c->in + 9);
+    c->body_left = -1;
+    for (const char *line = memchr(c->in, '\n', end - c->in); line && line < end;
+         line = memchr(line + 1, '\n', end - line))
+    {
+        if (strncasecmp(line + 1, "Content-Length:", 15) == 0)
+            c->body_left = atol(line + 16);
+        else if (strncasecmp(line + 1, "Connection:", 11) == 0 && memmem(line, end - line, "close", 5))
+            c->close_after = 1;
+    }
+    if (c->body_left < 0)
+        c->close_after = 1; // the body runs to EOF
+    *head_len = end + 4 - c->in;
+    return 1;
+}
+
+/* Latency is from when the request was sent, or with -R was due: queueing in the client counts. */
+static void response_done(conn_t *c, loadgen_thread_t *t, uint64_t now)
+{
+    uint64_t sent = c->sent[c->head];
+    c->head = (c->head + 1) % MAX_PIPELINE;
+    c->inflight--;
+    c->head_done = 0;
+    if (!atomic_load_explicit(&recording, memory_order_relaxed))
+        return;
+    t->requests++;
+    if (c->status < 200 || c->status > 299)
+        t->non2xx++;
+    histogram_record(&t->latency, now > sent ? now - sent : 0);
+}
+
+/*
+ * Consumes whole responses from c->in. Returns 1 when the connection must be
+ * reopened (closed by the server, or malformed), else 0.
+ */
+static int conn_read(int epfd, conn_t *c, loadgen_thread_t *t)
+{
+    for (;;)
+    {
+        ssize_t n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+        if (n < 0 && errno == EAGAIN)
+            return 0;
+        uint64_t now = now_ns();
+        if (n <= 0)
+        {
+            if (n == 0 && c->head_done && c->body_left < 0)
+                response_done(c, t, now); // EOF-framed body complete
+            return 1;
+        }
+        if (atomic_load_explicit(&recording, memory_order_relaxed))
+            t->bytes += n;
+        c->in_len += n;
+
+        size_t off = 0;
+        while (off < c->in_len)
+        {
+            if (!c->head_done)
+            {
+                size_t head_len;
+                memmove(c->in, c->in + off, c->in_len - off);
+                c->in_len -= off;
+                off = 0;
+                int r = parse_head(c, &head_len);
+                if (r < 0)
+                {
+                    if (atomic_load_explicit(&recording, memory_order_relaxed))
+                        t->errors++;
+                    return 1;
+                }
+                if (r == 0)
+                    break;
+                c->head_done = 1;
+                off = head_len;
+            }
+            if (c->body_left < 0)
+            {
+                off = c->in_len; // discard until EOF
+                break;
+            }
+            size_t take = c->in_len - off < (size_t)c->body_left ? c->in_len - off : (size_t)c->body_left;
+            off += take;
+            c->body_left -= take;
+            if (c->body_left > 0)
+                break;
+            if (c->inflight == 0)
+            {
+                if (atomic_load_explicit(&recording, memory_order_relaxed))
+                    t->errors++; // a response nobody asked for
+                return 1;
+            }
+            response_done(c, t, now);
+            if (c->close_after)
+                return 1;
+            if (conn_write(epfd, c, t) < 0)
+                return 1;
+        }
+        memmove(c->in, c->in + off, c->in_len - off);
+        c->in_len -= off;
+    }
+}
+
+static void *thread_main(void *arg)
+{
+    loadgen_thread_t *t = arg;
+    int epfd = epoll_create1(0);
+    conn_t *conns = calloc(t->connections, sizeof(conn_t));
+    if (epfd < 0 || !conns)
+    {
+        perror("loadgen thread");
+        exit(1);
+    }
+    for (int i = 0; i < t->connections; i++)
+        if (conn_open(epfd, &conns[i]) < 0)
+        {
+            perror("connect");
+            exit(1);
+        }
+
+    // -R: request j of this thread is due at next_ns + j * interval_ns, on connection j % connections
+    double next_ns = now_ns();
+    int next_conn = 0;
+    struct epoll_event events[256];
+    while (!atomic_load_explicit(&stop, memory_order_relaxed))
+    {
+        struct timespec timeout = {0, 100 * 1000000};
+        if (rate)
+        {
+            uint64_t now = now_ns();
+            int first = next_conn, due = 0;
+            for (; next_ns <= now; next_ns += t->interval_ns, due++)
+            {
+                conn_t *c = &conns[next_conn];
+                if (c->owed++ == 0)
+                    c->owed_ns = next_ns;
+                next_conn = next_conn + 1 == t->connections ? 0 : next_conn + 1;
+            }
+            for (int i = 0; i < due && i < t->connections; i++)
+            {
+                conn_t *c = &conns[(first + i) % t->connections];
+                if (conn_write(epfd, c, t) < 0)
+                    conn_reopen(epfd, c, t);
+            }
+            uint64_t wait = (uint64_t)next_ns - now;
+            if (wait < 100 * 1000000)
+                timeout.tv_nsec = wait;
+        }
+        int n = epoll_pwait2(epfd, events, 256, &timeout, NULL);
+        for (int i = 0; i < n; i++)
+        {
+            conn_t *c = events[i].data.ptr;
+            int reopen = 0;
+            if (c->connecting)
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                c->connecting = 0;
+                reopen = err != 0 || conn_write(epfd, c, t) < 0;
+                if (!reopen && c->want_out && c->out_off == c->out_len)
+                {
+                    // Nothing to send yet (-R): stop polling for writable
+                    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+                    c->want_out = 0;
+                    reopen = epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0;
+                }
+            }
+            else
+            {
+                if ((events[i].events & EPOLLOUT) && conn_write(epfd, c, t) < 0)
+                    reopen = 1;
+                if (!reopen && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                    reopen = conn_read(epfd, c, t);
+            }
+            if (reopen)
+                conn_reopen(epfd, c, t);
+        }
+    }
+    for (int i = 0; i < t->connections; i++)
+    {
+        t->backlog += conns[i].owed + conns[i].inflight;
+        close(conns[i].fd);
+    }
+    close(epfd);
+    free(conns);
+    return NULL;
+}
+
+/* Waits up to 5 s for the server to accept, for scripts that have just started it. */
+static int wait_for_server(void)
+{
+    for (int i = 0; i < 100; i++)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        int r = connect(fd, (struct sockaddr *)&server_addr, sizeof(server_addr));
+        close(fd);
+        if (r == 0)
+            return 0;
+        usleep(50 * 1000);
+    }
+    return -1;
+}
+
+static int parse_target(const char *target, char *host, size_t host_size, int *port, const char **path)
+{
+    *port = 8080;
+    *path = "/";
+    const char *slash = strchr(target, '/');
+    const char *colon = strchr(target, ':');
+    size_t host_len = colon && (!slash || colon < slash) ? (size_t)(colon - target)
+                                                        : slash ? (size_t)(slash - target) : strlen(target);
+    if (host_len >= host_size)
+        return -1;
+    memcpy(host, target, host_len);
+    host[host_len] = 0;
+    if (colon && (!slash || colon < slash))
+        *port = atoi(colon + 1);
+    if (slash)
+        *path = slash;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int connections = 64, threads = 4, seconds = 10, warmup = 1, csv = 0, opt;
+    const char *label = "-";
+    while ((opt = getopt(argc, argv, "c:t:d:p:R:w:l:f:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            connections = atoi(optarg);
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        case 'p':
+            pipeline = atoi(optarg);
+            break;
+        case 'R':
+            rate = atof(optarg);
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 'l':
+            label = optarg;
+            break;
+        case 'f':
+            if (strcmp(optarg, "csv-header") == 0)
+            {
+                puts(LOADGEN_CSV_HEADER);
+                return 0;
+            }
+            csv = strcmp(optarg, "csv") == 0;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-c connections] [-t threads] [-d seconds] [-p pipeline] [-R requests/s] "
+                            "[-w warmup_seconds] [-l label] [-f text|csv|csv-header] [host:port[/path]]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (threads < 1 || connections < threads || pipeline < 1 || pipeline > MAX_PIPELINE || rate < 0)
+    {
+        fputs("need 1 <= threads <= connections, 1 <= pipeline <= 256 and a rate >= 0\n", stderr);
+        return 1;
+    }
+
+    char host[256];
+    int port;
+    const char *path;
+    if (parse_target(optind < argc ? argv[optind] : "127.0.0.1:8080/", host, sizeof(host), &port, &path) < 0)
+    {
+        fputs("bad target\n", stderr);
+        return 1;
+    }
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &server_addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "bad IPv4 address: %s\n", host);
+        return 1;
+    }
+
+    char request[1024];
+    request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s:%d\r\n\r\n", path, host, port);
+    if (request_len >= sizeof(request))
+    {
+        fputs("path too long\n", stderr);
+        return 1;
+    }
+    batch_len = request_len * pipeline;
+    batch = malloc(batch_len);
+    for (int i = 0; i < pipeline; i++)
+        memcpy(batch + request_len * i, request, request_len);
+
+    if (wait_for_server() < 0)
+    {
+        fprintf(stderr, "nothing accepts on %s:%d\n", host, port);
+        return 1;
+    }
+
+    loadgen_thread_t *ts = calloc(threads, sizeof(loadgen_thread_t));
+    for (int i = 0; i < threads; i++)
+    {
+        ts[i].connections = connections / threads + (i < connections % threads);
+        ts[i].interval_ns = rate ? 1e9 / (rate * ts[i].connections / connections) : 0;
+        pthread_create(&ts[i].tid, NULL, thread_main, &ts[i]);
+    }
+    sleep(warmup);
+    atomic_store(&recording, 1);
+    uint64_t start = now_ns();
+    sleep(seconds);
+    atomic_store(&recording, 0);
+    double elapsed = (now_ns() - start) / 1e9;
+    atomic_store(&stop, 1);
+
+    static histogram_t latency;
+    long requests = 0, bytes = 0, errors = 0, non2xx = 0, reconnects = 0, backlog = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(ts[i].tid, NULL);
+        histogram_add(&latency, &ts[i].latency);
+        requests += ts[i].requests;
+        bytes += ts[i].bytes;
+        errors += ts[i].errors;
+        non2xx += ts[i].non2xx;
+        reconnects += ts[i].reconnects;
+        backlog += ts[i].backlog;
+    }
+
+    double p50 = histogram_percentile(&latency, 50) / 1e3, p90 = histogram_percentile(&latency, 90) / 1e3,
+           p99 = histogram_percentile(&latency, 99) / 1e3, p999 = histogram_percentile(&latency, 99.9) / 1e3,
+           p9999 = histogram_percentile(&latency, 99.99) / 1e3, max = latency.max / 1e3,
+           mean = histogram_mean(&latency) / 1e3;
+    if (csv)
+        printf("%s,%d,%d,%d,%.1f,%ld,%.0f,%.2f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%ld,%ld,%ld,%.0f,%.1f,%ld\n", label,
+               connections, threads, pipeline, elapsed, requests, requests / elapsed, bytes / elapsed / 1e6, mean, p50,
+               p90, p99, p999, max, errors, non2xx, reconnects, rate, p9999, backlog);
+    else
+    {
+        printf("%s:%d%s, %d connections, %d threads, pipeline %d, %.1f s\n", host, port, path, connections, threads,
+               pipeline, elapsed);
+        if (rate)
+            printf("offered/s      %10.0f (open loop, latency from when each request was due)\n", rate);
+        printf("requests/s     %10.0f\n", requests / elapsed);
+        printf("transfer/s     %10.2f MB\n", bytes / elapsed / 1e6);
+        printf("latency mean   %10.1f us\n", mean);
+        printf("latency p50    %10.1f us\n", p50);
+        printf("latency p90    %10.1f us\n", p90);
+        printf("latency p99    %10.1f us\n", p99);
+        printf("latency p99.9  %10.1f us\n", p999);
+        printf("latency p99.99 %10.1f us\n", p9999);
+        printf("latency max    %10.1f us\n", max);
+        printf("errors         %10ld\n", errors);
+        printf("non-2xx        %10ld\n", non2xx);
+        printf("reconnects     %10ld\n", reconnects);
+        if (rate)
+            printf("backlog        %10ld (owed or unanswered at the end)\n", backlog);
+    }
+    free(ts);
+    free(batch);
+    return 0;
+}
@@ -0,0 +1,155 @@
+// metrics_bench.c — What metrics.h costs a worker per request
+// gcc -O3 -march=native -pthread -o metrics_bench metrics_bench.c
+// Run with: ./metrics_bench [requests]
+//
+// Plays a worker's event loop without the kernel: passes of BATCH events,
+// each one a connection that reads a request, parses it (http_parser.h) and
+// sends its response, with the calls io_uring.c and epoll_simple.c make per
+// pass and per request: the pass stamps, read/write/byte/request counters and
+// the burst that times the request. The same loop runs without them, and a
+// scraper thread renders /metrics every SCRAPE_MS throughout, so the
+// difference includes the cache lines a scrape pulls away from the worker.
+// At 1M requests/s a core has 1000 ns per request; the calls must stay under
+// 1% of that (exit status 1 otherwise).
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../http_parser.h"
+#include "../metrics.h"
+
+#define CONNS 1024
+#define BATCH 32
+#define ROUNDS 41
+#define SCRAPE_MS 10
+#define BUDGET_NS 1000.0 /* per request at 1M requests/s */
+
+#if !METRICS_PORT
+#error "build without -DMETRICS_PORT=0: there is nothing to measure"
+#endif
+
+static const char request[] = "GET /user/42 HTTP/1.1\r\nHost: localhost:8080\r\nUser-Agent: metrics_bench\r\n"
+                              "Accept: */*\r\nConnection: keep-alive\r\n\r\n";
+
+typedef struct
+{
+    http_parser_t parser;
+    uint64_t burst_ns;
+} conn_t;
+
+static conn_t conns[CONNS];
+static worker_metrics_t metrics;
+static atomic_int stop;
+static long scrapes;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *scraper(void *arg)
+{
+    FILE *out = arg;
+    struct timespec interval = {0, SCRAPE_MS * 1000000L};
+    while (!atomic_load_explicit(&stop, memory_order_relaxed))
+    {
+        metrics_print(out);
+        fflush(out);
+        scrapes++;
+        nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+/* ns per request; inlined twice so the loop without metrics has no trace of them */
+static inline __attribute__((always_inline)) double run(long requests, int with_metrics)
+{
+    volatile size_t sink = 0;
+    unsigned c = 0;
+    double start = now_sec();
+    for (long done = 0; done < requests; done += BATCH)
+    {
+        if (with_metrics)
+            metrics_pass_begin(&metrics);
+        for (int e = 0; e < BATCH; e++)
+        {
+            conn_t *conn = &conns[c++ % CONNS];
+            if (with_metrics)
+            {
+                metrics_add(&metrics, METRIC_READS, 1);
+                metrics_add(&metrics, METRIC_BYTES_IN, sizeof(request) - 1);
+            }
+            http_request_t req;
+            int n = http_parse_request(&conn->parser, request, sizeof(request) - 1, &req);
+            http_parser_reset(&conn->parser);
+            sink += n + req.path.len;
+            if (with_metrics)
+            {
+                metrics_add(&metrics, METRIC_REQUESTS, 1);
+                metrics_burst_begin(&metrics, &conn->burst_ns);
+                metrics_add(&metrics, METRIC_WRITES, 1);
+                metrics_add(&metrics, METRIC_BYTES_OUT, 64);
+                metrics_burst_end(&metrics, &conn->burst_ns);
+            }
+        }
+        if (with_metrics)
+            metrics_pass_end(&metrics, BATCH);
+    }
+    return (now_sec() - start) / requests * 1e9;
+}
+
+static int compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double median(double *v, int n)
+{
+    qsort(v, n, sizeof(double), compare);
+    return v[n / 2];
+}
+
+int main(int argc, char **argv)
+{
+    long requests = argc > 1 ? atol(argv[1]) : 2000000; // per round and loop
+    FILE *devnull = fopen("/dev/null", "w");
+    if (!devnull)
+    {
+        perror("/dev/null");
+        return 1;
+    }
+    metrics_register(&metrics, "0");
+    for (int i = 0; i < CONNS; i++)
+        http_parser_reset(&conns[i].parser);
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, scraper, devnull);
+    // Rounds alternate the two loops, so frequency changes and the scraper hit
+    // both alike; medians drop the rounds that were preempted
+    double plain[ROUNDS], timed[ROUNDS], cost[ROUNDS];
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        plain[r] = run(requests, 0);
+        timed[r] = run(requests, 1);
+        cost[r] = timed[r] - plain[r];
+    }
+    atomic_store(&stop, 1);
+    pthread_join(tid, NULL);
+
+    double median_cost = median(cost, ROUNDS);
+    printf("%ld requests x %d rounds, passes of %d, %ld scrapes\n", requests, ROUNDS, BATCH, scrapes);
+    printf("without metrics  %7.2f ns/request (median)\n", median(plain, ROUNDS));
+    printf("with metrics     %7.2f ns/request\n", median(timed, ROUNDS));
+    printf("metrics cost     %7.2f ns/request (median of the rounds' differences), %.2f%% of %.0f ns"
+           " (1M requests/s per core)\n",
+           median_cost, median_cost / BUDGET_NS * 100, BUDGET_NS);
+    printf("requests timed   %llu, p50 %.0f ns, p99 %.0f ns\n", (unsigned long long)metrics.latency.count,
+           (double)histogram_percentile(&metrics.latency, 50), (double)histogram_percentile(&metrics.latency, 99));
+    return median_cost < BUDGET_NS / 100 ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+// mpmc_queue_bench.c — mpmc_queue.h against a mutex + condition variable ring
+// gcc -O3 -pthread -o mpmc_queue_bench mpmc_queue_bench.c
+// Run with: ./mpmc_queue_bench [items]
+//
+// For 1..64 threads, half produce and half consume (one thread alternates
+// push and pop) through a 1024-cell queue, as the acceptor and workers of
+// 10_circular_queue.c, 9_adaptive_event_handling_example.c and
+// 4_spin_loop_example.c do. Producers retry when the queue is full; each
+// consumer stops at a -1 pushed once the producers are done.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../mpmc_queue.h"
+
+#define QUEUE_SIZE 1024
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ================= Baseline: mutex + condvar ring ================= */
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    int items[QUEUE_SIZE];
+    int front, back, count;
+} locked_queue_t;
+
+static int locked_push(locked_queue_t *q, int value)
+{
+    pthread_mutex_lock(&q->lock);
+    if (q->count == QUEUE_SIZE)
+    {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
+    }
+    q->items[q->back] = value;
+    q->back = (q->back + 1) % QUEUE_SIZE;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+static int locked_pop(locked_queue_t *q)
+{
+    pthread_mutex_lock(&q->lock);
+    while (!q->count)
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    int value = q->items[q->front];
+    q->front = (q->front + 1) % QUEUE_SIZE;
+    q->count--;
+    pthread_mutex_unlock(&q->lock);
+    return value;
+}
+
+/* ================= Harness ================= */
+
+static mpmc_queue_t ring;
+static locked_queue_t locked;
+static int use_ring;
+static long items_per_producer;
+
+static int push(int value)
+{
+    return use_ring ? mpmc_queue_push(&ring, value) : locked_push(&locked, value);
+}
+
+static int pop(void)
+{
+    return use_ring ? mpmc_queue_pop(&ring) : locked_pop(&locked);
+}
+
+static void *producer(void *arg)
+{
+    (void)arg;
+    for (long i = 0; i < items_per_producer; i++)
+        while (push((int)(i & 0x7fffffff)) < 0)
+            sched_yield();
+    return NULL;
+}
+
+static void *consumer(void *arg)
+{
+    long *popped = arg;
+    while (pop() != -1)
+        (*popped)++;
+    return NULL;
+}
+
+/* Returns millions of items per second through the queue. */
+static double run(int threads, long items)
+{
+    mpmc_queue_init(&ring, QUEUE_SIZE);
+    pthread_mutex_init(&locked.lock, NULL);
+    pthread_cond_init(&locked.not_empty, NULL);
+    locked.front = locked.back = locked.count = 0;
+
+    double start = now_sec();
+    if (threads == 1)
+    {
+        for (long i = 0; i < items; i++)
+        {
+            push((int)i);
+            pop();
+        }
+    }
+    else
+    {
+        int producers = threads / 2, consumers = threads - producers;
+        pthread_t tids[64];
+        long popped[64] = {0};
+        items_per_producer = items / producers;
+        items = items_per_producer * producers;
+        for (int i = 0; i < consumers; i++)
+            pthread_create(&tids[i], NULL, consumer, &popped[i]);
+        for (int i = 0; i < producers; i++)
+            pthread_create(&tids[consumers + i], NULL, producer, NULL);
+        for (int i = 0; i < producers; i++)
+            pthread_join(tids[consumers + i], NULL);
+        for (int i = 0; i < consumers; i++)
+            while (push(-1) < 0)
+                sched_yield();
+        long total = 0;
+        for (int i = 0; i < consumers; i++)
+        {
+            pthread_join(tids[i], NULL);
+            total += popped[i];
+        }
+        if (total != items)
+        {
+            fprintf(stderr, "lost items: %ld of %ld\n", items - total, items);
+            exit(1);
+        }
+    }
+    double elapsed = now_sec() - start;
+
+    mpmc_queue_destroy(&ring);
+    pthread_mutex_destroy(&locked.lock);
+    pthread_cond_destroy(&locked.not_empty);
+    return items / elapsed / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    long items = argc > 1 ? atol(argv[1]) : 4000000;
+    static const int thread_counts[] = {1, 2, 4, 8, 16, 32, 64};
+
+    printf("%-8s %14s %14s\n", "threads", "mpmc Mops/s", "mutex Mops/s");
+    for (unsigned i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++)
+    {
+        int threads = thread_counts[i];
+        use_ring = 1;
+        double ring_rate = run(threads, items);
+        use_ring = 0;
+        double locked_rate = run(threads, items);
+        printf("%-8d %14.2f %14.2f\n", threads, ring_rate, locked_rate);
+    }
+    return 0;
+}
@@ -0,0 +1,232 @@
+// route_gen_bench.c — Routers generated by route_gen.c against router.h's trie
+// Built and run by route_gen_bench.sh, which generates the routers it includes.
+//
+// First the route set and loop of the V tries' bench() (radix_trie.v,
+// patricia_trie.v): 100,000 rounds of 7 requests, each answered by a handler
+// that formats its body, timed end to end like V's benchmark.measure. Then
+// lookups alone on tables of 10, 1,000 and 10,000 routes (see the script), in
+// shuffled order with one miss in ten; every generated lookup is checked
+// against router_lookup first.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../http_parser.h"
+#include "../router.h"
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ================= The V route set ================= */
+
+static void user_reply(response_writer_t *res, const char *what, request_view_t *req)
+{
+    http_slice_t id = request_param(req, "id"), name = request_param(req, "name");
+    char body[128];
+    int len = snprintf(body, sizeof(body), "%s %.*s %.*s", what, (int)id.len, id.ptr ? id.ptr : "", (int)name.len,
+                       name.ptr ? name.ptr : "");
+    response_send(res, "200 OK", "text/plain", body, len);
+}
+
+static void get_user(void *data, request_view_t *req, response_writer_t *res)
+{
+    (void)data;
+    user_reply(res, "GET user", req);
+}
+
+static void create_user(void *data, request_view_t *req, response_writer_t *res)
+{
+    (void)data;
+    user_reply(res, "POST create user", req);
+}
+
+static void update_user(void *data, request_view_t *req, response_writer_t *res)
+{
+    (void)data;
+    user_reply(res, "PUT update user", req);
+}
+
+static void delete_user(void *data, request_view_t *req, response_writer_t *res)
+{
+    (void)data;
+    user_reply(res, "DELETE user", req);
+}
+
+static void update_user_name(void *data, request_view_t *req, response_writer_t *res)
+{
+    (void)data;
+    user_reply(res, "PUT update user name", req);
+}
+
+static void noop_handler(void *data, request_view_t *req, response_writer_t *res)
+{
+    (void)data;
+    (void)req;
+    (void)res;
+}
+
+#include "routes_v.h"
+#include "routes_10.h"
+#include "routes_1000.h"
+#include "routes_10000.h"
+
+static request_handler_t v_handler(const char *name)
+{
+    static const struct
+    {
+        const char *name;
+        request_handler_t fn;
+    } handlers[] = {{"get_user", get_user},
+                    {"create_user", create_user},
+                    {"update_user", update_user},
+                    {"delete_user", delete_user},
+                    {"update_user_name", update_user_name}};
+    for (size_t i = 0; i < sizeof(handlers) / sizeof(handlers[0]); i++)
+        if (strcmp(handlers[i].name, name) == 0)
+            return handlers[i].fn;
+    return noop_handler;
+}
+
+static void bench_v(void)
+{
+    static const char *requests[][2] = {{"GET", "/user"},           {"GET", "/user/123"},
+                                        {"POST", "/user"},          {"PUT", "/user/123"},
+                                        {"DELETE", "/user/123"},    {"PUT", "/user/123/John"},
+                                        {"PUT", "/user/123/name/John"}};
+    enum
+    {
+        count = sizeof(requests) / sizeof(requests[0]),
+        rounds = 100000
+    };
+    http_request_t http[count];
+    memset(http, 0, sizeof(http));
+    for (int i = 0; i < count; i++)
+    {
+        http[i].method = (http_slice_t){requests[i][0], strlen(requests[i][0])};
+        http[i].path = (http_slice_t){requests[i][1], strlen(requests[i][1])};
+    }
+    router_t router;
+    router_init(&router);
+    for (int i = 0; i < RV_COUNT; i++)
+        router_add(&router, rv_table[i].method, rv_table[i].pattern, v_handler(rv_table[i].handler), NULL);
+
+    for (int generated = 0; generated < 2; generated++)
+    {
+        char buf[256];
+        volatile size_t sink = 0;
+        double start = now_sec();
+        for (int round = 0; round < rounds; round++)
+            for (int i = 0; i < count; i++)
+            {
+                request_view_t req;
+                request_view_init(&req, &http[i]);
+                response_writer_t res;
+                response_writer_init(&res, buf, sizeof(buf));
+                if (generated)
+                    rv_dispatch(NULL, &req, &res);
+                else
+                    router_dispatch(&router, &req, &res);
+                sink += res.len;
+            }
+        double elapsed = now_sec() - start;
+        printf("V route set, %d x %d requests  %-16s %8.1f ms  %6.1f ns/request\n", rounds, count,
+               generated ? "route_gen" : "router.h", elapsed * 1e3, elapsed / (rounds * count) * 1e9);
+    }
+    router_free(&router);
+}
+
+/* ================= Lookups ================= */
+
+/* The path a pattern matches with every param set to 12345. */
+static void concrete_path(const char *pattern, char *path, size_t size)
+{
+    size_t len = 0;
+    for (const char *p = pattern; *p && len + 6 < size;)
+    {
+        if (*p == ':' && p[-1] == '/')
+        {
+            memcpy(path + len, "12345", 5);
+            len += 5;
+            while (*p && *p != '/')
+                p++;
+        }
+        else
+            path[len++] = *p++;
+    }
+    path[len] = 0;
+}
+
+static void bench_lookups(int routes, const route_gen_entry_t *table, int (*lookup)(request_view_t *))
+{
+    int paths = routes + routes / 10 + 1;
+    char(*text)[128] = malloc(128 * paths);
+    router_t router;
+    router_init(&router);
+    for (int i = 0; i < routes; i++)
+    {
+        router_add(&router, table[i].method, table[i].pattern, noop_handler, (void *)(intptr_t)i);
+        concrete_path(table[i].pattern, text[i], sizeof(text[i]));
+    }
+    for (int i = routes; i < paths; i++)
+        snprintf(text[i], sizeof(text[i]), "/api/v%d/missing%d/1", i % 3, i);
+
+    http_request_t *http = calloc(paths, sizeof(http_request_t));
+    srand(42);
+    for (int i = 0; i < paths; i++)
+    {
+        int j = rand() % (i + 1); // inside-out shuffle
+        http[i] = http[j];
+        http[j].method = (http_slice_t){"GET", 3};
+        http[j].path = (http_slice_t){text[i], strlen(text[i])};
+    }
+
+    for (int i = 0; i < paths; i++)
+    {
+        request_view_t a, b;
+        request_view_init(&a, &http[i]);
+        request_view_init(&b, &http[i]);
+        const router_route_t *route = router_lookup(&router, &a, NULL);
+        int expected = route ? (int)(intptr_t)route->data : -1;
+        if (lookup(&b) != expected || a.param_count != b.param_count)
+        {
+            fprintf(stderr, "route_gen and router.h disagree on %.*s\n", (int)http[i].path.len, http[i].path.ptr);
+            exit(1);
+        }
+    }
+
+    for (int generated = 0; generated < 2; generated++)
+    {
+        long lookups = 0;
+        volatile long sink = 0;
+        double start = now_sec(), elapsed;
+        do
+        {
+            for (int i = 0; i < paths; i++)
+            {
+                request_view_t req;
+                request_view_init(&req, &http[i]);
+                sink += generated ? lookup(&req) : router_lookup(&router, &req, NULL) != NULL;
+            }
+            lookups += paths;
+        } while ((elapsed = now_sec() - start) < 0.5);
+        printf("%6d routes  %-16s %12.0f lookups/s  %6.1f ns/lookup\n", routes, generated ? "route_gen" : "router.h",
+               lookups / elapsed, elapsed / lookups * 1e9);
+    }
+    router_free(&router);
+    free(http);
+    free(text);
+}
+
+int main(void)
+{
+    bench_v();
+    bench_lookups(R10_COUNT, r10_table, r10_lookup);
+    bench_lookups(R1000_COUNT, r1000_table, r1000_lookup);
+    bench_lookups(R10000_COUNT, r10000_table, r10000_lookup);
+    return 0;
+}
@@ -0,0 +1,37 @@
+#!/bin/sh
+# route_gen_bench.sh — Generated routers (route_gen.c) against router.h and the V tries
+# Run from c/: sh bench/route_gen_bench.sh
+#
+# Writes route tables of 10, 1,000 and 10,000 routes (a quarter static, the
+# rest with one or two :param segments, as in router_bench.c), generates a
+# router for each and for bench/routes_v.txt (the V tries' routes), then runs
+# bench/route_gen_bench.c. If the V compiler is on PATH, the V tries' own
+# bench() runs too, for the same 100,000 x 7 requests.
+
+set -e
+out=${TMPDIR:-/tmp}/route_gen_bench
+mkdir -p "$out"
+
+gcc -O2 -o "$out/route_gen" route_gen.c
+for n in 10 1000 10000; do
+    awk -v n="$n" 'BEGIN {
+        for (i = 0; i < n; i++) {
+            if (i % 4 == 0) p = sprintf("/api/v%d/res%d", i % 3, i)
+            else if (i % 4 == 1) p = sprintf("/api/v%d/res%d/:id", i % 3, i)
+            else if (i % 4 == 2) p = sprintf("/api/v%d/res%d/:id/items/:item", i % 3, i)
+            else p = sprintf("/users/:user/res%d/settings", i)
+            print "GET", p, "noop_handler"
+        }
+    }' >"$out/routes_$n.txt"
+    "$out/route_gen" -p "r${n}_" "$out/routes_$n.txt" >"$out/routes_$n.h"
+done
+"$out/route_gen" -p rv_ bench/routes_v.txt >"$out/routes_v.h"
+
+gcc -O3 -march=native -I. -I"$out" -o "$out/route_gen_bench" bench/route_gen_bench.c
+"$out/route_gen_bench"
+
+if command -v v >/dev/null 2>&1; then
+    for trie in radix_trie patricia_trie; do
+        v -prod run "../compile_time_builded_route_manager/$trie/$trie.v" | tail -n 2
+    done
+fi
@@ -0,0 +1,175 @@
+// router_bench.c — router.h lookups against a linear scan of the route table
+// gcc -O3 -o router_bench router_bench.c
+// Run with: ./router_bench [seconds_per_case]
+//
+// Builds route tables of 10, 1,000 and 10,000 routes, a quarter of them static
+// and the rest with one or two ":param" segments, and looks up one concrete
+// path per route (params filled in) in shuffled order, plus one miss in ten.
+// The linear scan matches every pattern segment by segment until one fits: what
+// a chain of per-route ifs or a route list costs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../http_parser.h"
+#include "../router.h"
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void noop_handler(void *data, request_view_t *req, response_writer_t *res)
+{
+    (void)data;
+    (void)req;
+    (void)res;
+}
+
+static void make_route(int i, char *pattern, char *path, size_t size)
+{
+    switch (i % 4)
+    {
+    case 0:
+        snprintf(pattern, size, "/api/v%d/res%d", i % 3, i);
+        snprintf(path, size, "/api/v%d/res%d", i % 3, i);
+        break;
+    case 1:
+        snprintf(pattern, size, "/api/v%d/res%d/:id", i % 3, i);
+        snprintf(path, size, "/api/v%d/res%d/12345", i % 3, i);
+        break;
+    case 2:
+        snprintf(pattern, size, "/api/v%d/res%d/:id/items/:item", i % 3, i);
+        snprintf(path, size, "/api/v%d/res%d/12345/items/abc", i % 3, i);
+        break;
+    default:
+        snprintf(pattern, size, "/users/:user/res%d/settings", i);
+        snprintf(path, size, "/users/alice/res%d/settings", i);
+        break;
+    }
+}
+
+/* Segment by segment, ":name" matching any one segment. */
+static int linear_match(const char *pattern, const char *p, const char *end)
+{
+    while (*pattern && p < end)
+    {
+        if (*pattern == ':')
+        {
+            while (*pattern && *pattern != '/')
+                pattern++;
+            while (p < end && *p != '/')
+                p++;
+        }
+        else if (*pattern++ != *p++)
+            return 0;
+    }
+    return !*pattern && p == end;
+}
+
+typedef struct
+{
+    char pattern[64];
+    char path[64];
+} route_case_t;
+
+static void run(int routes, double seconds)
+{
+    int paths = routes + routes / 10 + 1;
+    route_case_t *cases = malloc(sizeof(route_case_t) * paths);
+    router_t router;
+    router_init(&router);
+    for (int i = 0; i < routes; i++)
+    {
+        make_route(i, cases[i].pattern, cases[i].path, sizeof(cases[i].pattern));
+        if (router_add(&router, "GET", cases[i].pattern, noop_handler, NULL) < 0)
+        {
+            fprintf(stderr, "router_add %s failed\n", cases[i].pattern);
+            exit(1);
+        }
+    }
+    for (int i = routes; i < paths; i++)
+        snprintf(cases[i].path, sizeof(cases[i].path), "/api/v%d/missing%d/1", i % 3, i);
+
+    // Shuffled lookup order
+    int *order = malloc(sizeof(int) * paths);
+    for (int i = 0; i < paths; i++)
+        order[i] = i;
+    srand(42);
+    for (int i = paths - 1; i > 0; i--)
+    {
+        int j = rand() % (i + 1), t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    http_request_t *requests = calloc(paths, sizeof(http_request_t));
+    for (int i = 0; i < paths; i++)
+    {
+        requests[i].method = (http_slice_t){"GET", 3};
+        requests[i].path = (http_slice_t){cases[order[i]].path, strlen(cases[order[i]].path)};
+    }
+
+    // Every path finds its route and every miss misses
+    for (int i = 0; i < paths; i++)
+    {
+        request_view_t req;
+        request_view_init(&req, &requests[i]);
+        int hit = router_lookup(&router, &req, NULL) != NULL;
+        if (hit != (order[i] < routes))
+        {
+            fprintf(stderr, "wrong result for %s\n", cases[order[i]].path);
+            exit(1);
+        }
+    }
+
+    long lookups = 0;
+    volatile long sink = 0;
+    double start = now_sec(), elapsed;
+    do
+    {
+        for (int i = 0; i < paths; i++)
+        {
+            request_view_t req;
+            request_view_init(&req, &requests[i]);
+            sink += router_lookup(&router, &req, NULL) != NULL;
+        }
+        lookups += paths;
+    } while ((elapsed = now_sec() - start) < seconds);
+    printf("%6d routes %6zu nodes  radix trie  %12.0f lookups/s  %8.1f ns/lookup\n", routes, router.node_count,
+           lookups / elapsed, elapsed / lookups * 1e9);
+
+    lookups = 0;
+    start = now_sec();
+    do
+    {
+        for (int i = 0; i < paths; i++)
+        {
+            const char *p = requests[i].path.ptr, *end = p + requests[i].path.len;
+            for (int r = 0; r < routes; r++)
+                if (linear_match(cases[r].pattern, p, end))
+                {
+                    sink += r;
+                    break;
+                }
+        }
+        lookups += paths;
+    } while ((elapsed = now_sec() - start) < seconds);
+    printf("%6d routes               linear scan %12.0f lookups/s  %8.1f ns/lookup\n", routes, lookups / elapsed,
+           elapsed / lookups * 1e9);
+
+    router_free(&router);
+    free(requests);
+    free(order);
+    free(cases);
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 0.5;
+    run(10, seconds);
+    run(1000, seconds);
+    run(10000, seconds);
+    return 0;
+}
@@ -0,0 +1,119 @@
+#!/bin/sh
+# run_servers.sh — Builds every server variant and sweeps bench/loadgen.c over it
+# Run from c/: sh bench/run_servers.sh > results.csv
+#
+# For each variant: build it, start it on :8080, run loadgen for every
+# combination of CONNECTIONS, THREADS (loadgen threads) and PIPELINE, stop
+# it. A variant fails when :8080 already accepts before it starts: the
+# numbers would be another process's. Servers that close after each response
+# (webserver.c, the pool servers) only get pipeline 1. One CSV line per run
+# goes to stdout, prefixed with the commit, host and CPU count so tables from
+# different runs and machines can be concatenated and compared; server output
+# goes to $out/<variant>.log.
+#
+# With RATES set, every combination is instead run open loop (loadgen -R) at
+# each offered rate in turn, PIPELINE capping the requests in flight per
+# connection. Latency is then counted from when each request was due, so the
+# p50/p99/p99.9/p99.99 columns against the rate column are the variant's
+# latency curve. Once a run serves under 90% of its offered rate, or ends
+# with over 1% of its requests still queued (the backlog column), the variant
+# is saturated: that is reported on stderr and higher rates are skipped.
+#
+# Environment (defaults in brackets):
+#   VARIANTS     names from the table below [all of them]
+#   CONNECTIONS  [16 64 256 1024]   THREADS [1 4]   PIPELINE [1 16]
+#   RATES        offered requests/s, ascending [unset: closed loop]
+#   DURATION     seconds per run [10]   WARMUP [1]
+#   URING        how to link liburing [-luring]
+#   SERVER_CPUS, CLIENT_CPUS  taskset -c lists to keep the two apart [unset]
+#
+# Compare two tables, e.g. requests_per_s per variant and load, old then new:
+#   awk -F, 'NR == FNR { old[$4 FS $5 FS $6 FS $7] = $10; next }
+#            ($4 FS $5 FS $6 FS $7) in old { print $4, $5, $6, $7, old[$4 FS $5 FS $6 FS $7], $10 }' old.csv new.csv
+
+set -e
+out=${TMPDIR:-/tmp}/run_servers
+mkdir -p "$out"
+CONNECTIONS=${CONNECTIONS:-16 64 256 1024}
+THREADS=${THREADS:-1 4}
+PIPELINE=${PIPELINE:-1 16}
+DURATION=${DURATION:-10}
+WARMUP=${WARMUP:-1}
+URING=${URING:--luring}
+
+# name | source | flags | keep-alive
+variants() {
+    cat <<EOF
+webserver|../webserver.c||0
+epoll_simple|epoll_simple.c|-pthread|1
+epoll_per_core|epoll_simple.c|-pthread -Dper_core_workers=1|1
+io_uring|io_uring.c|-march=native -pthread $URING|1
+single_thread_io_uring|single-thread-io_uring.c|-pthread $URING|1
+spin_loop|4_spin_loop_example.c|-pthread|0
+adaptive|9_adaptive_event_handling_example.c|-pthread|0
+circular_queue|10_circular_queue.c|-pthread|0
+EOF
+}
+
+pin() {
+    if [ -n "$1" ]; then echo "taskset -c $1"; fi
+}
+
+# Whether something already accepts on :8080
+port_taken() {
+    bash -c 'exec 3<>/dev/tcp/127.0.0.1/8080' 2>/dev/null
+}
+
+commit=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+host=$(hostname)
+cpus=$(nproc)
+
+gcc -O3 -pthread -o "$out/loadgen" bench/loadgen.c
+echo "commit,host,cpus,$("$out/loadgen" -f csv-header)"
+
+variants | while IFS='|' read -r name source flags keepalive; do
+    if [ -n "$VARIANTS" ] && ! echo " $VARIANTS " | grep -q " $name "; then
+        continue
+    fi
+    # shellcheck disable=SC2086
+    if ! gcc -O3 -o "$out/$name" "$source" $flags 2>"$out/$name.build.log"; then
+        echo "$name: build failed, see $out/$name.build.log" >&2
+        continue
+    fi
+    if port_taken; then
+        echo "$name: :8080 already accepts connections before it starts (a stale server?), not run" >&2
+        continue
+    fi
+    # shellcheck disable=SC2046
+    $(pin "$SERVER_CPUS") "$out/$name" >"$out/$name.log" 2>&1 &
+    pid=$!
+    for c in $CONNECTIONS; do
+        for t in $THREADS; do
+            for p in $PIPELINE; do
+                if [ "$t" -gt "$c" ] || { [ "$keepalive" = 0 ] && [ "$p" != 1 ]; }; then
+                    continue
+                fi
+                for r in ${RATES:-0}; do
+                    # shellcheck disable=SC2046
+                    line=$($(pin "$CLIENT_CPUS") "$out/loadgen" -f csv -l "$name" -c "$c" -t "$t" -p "$p" \
+                        -R "$r" -d "$DURATION" -w "$WARMUP" 127.0.0.1:8080/) || line=
+                    if [ -z "$line" ]; then
+                        echo "$name: loadgen failed (-c $c -t $t -p $p -R $r)" >&2
+                        continue
+                    fi
+                    echo "$commit,$host,$cpus,$line"
+                    requests=$(echo "$line" | cut -d, -f6)
+                    served=$(echo "$line" | cut -d, -f7)
+                    backlog=$(echo "$line" | cut -d, -f20)
+                    if [ "$r" != 0 ] && { [ "$((served * 10))" -lt "$((r * 9))" ] ||
+                        [ "$((backlog * 100))" -gt "$requests" ]; }; then
+                        echo "$name: saturated at $r requests/s offered, $served served (-c $c -t $t -p $p)" >&2
+                        break
+                    fi
+                done
+            done
+        done
+    done
+    kill "$pid" 2>/dev/null || true
+    wait "$pid" 2>/dev/null || true
+done
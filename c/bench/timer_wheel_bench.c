@@ -0,0 +1,124 @@
+// timer_wheel_bench.c — Cost of connection timeouts (timer_wheel.h) at 100k connections
+// gcc -O3 -o timer_wheel_bench timer_wheel_bench.c
+// Run with: ./timer_wheel_bench [connections] [requests]
+//
+// Replays what a server worker does per request: arm the write timeout when
+// the response is queued, then push the keep-alive idle timeout back when it
+// is sent, with the clock ticking (100 ms) every 50k requests. The result is
+// compared with the recv() + send() pair the server spends on the same
+// request, measured on a socketpair. A final pass lets every connection idle
+// out to time expiry.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "../timer_wheel.h"
+
+#define TICK_MS 100
+#define IDLE_TICKS (60000 / TICK_MS)
+#define WRITE_TICKS (30000 / TICK_MS)
+#define REQUESTS_PER_TICK 50000
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long expired_count;
+
+static void on_expired(void *arg, uint32_t id)
+{
+    (void)arg;
+    (void)id;
+    expired_count++;
+}
+
+/* ns per request of the server-side syscalls: one recv of the request, one send of the response */
+static double io_ns_per_request(long iterations)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+        perror("socketpair");
+        exit(1);
+    }
+    static const char request[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    static const char response[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: keep-alive\r\n\r\nOK";
+    char buf[256];
+
+    double start = now_sec();
+    for (long i = 0; i < iterations; i++)
+    {
+        send(sv[0], request, sizeof(request) - 1, 0);
+        recv(sv[1], buf, sizeof(buf), 0);
+        send(sv[1], response, sizeof(response) - 1, 0);
+        recv(sv[0], buf, sizeof(buf), 0);
+    }
+    double elapsed = now_sec() - start;
+    close(sv[0]);
+    close(sv[1]);
+    return elapsed / iterations * 1e9 / 2; // the client half is not the server's cost
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t connections = argc > 1 ? (uint32_t)atol(argv[1]) : 100000;
+    long requests = argc > 2 ? atol(argv[2]) : 50000000;
+
+    timer_wheel_t tw;
+    uint32_t tick = 0;
+    if (timer_wheel_init(&tw, connections, tick) < 0)
+    {
+        perror("timer_wheel_init");
+        return 1;
+    }
+    for (uint32_t i = 0; i < connections; i++)
+        timer_wheel_arm(&tw, i, IDLE_TICKS);
+
+    // Random connection order, as requests arrive on many sockets
+    uint32_t *order = malloc(sizeof(uint32_t) * (1 << 20));
+    uint64_t x = 88172645463325252ull;
+    for (int i = 0; i < 1 << 20; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        order[i] = (uint32_t)(x % connections);
+    }
+
+    double start = now_sec();
+    for (long r = 0; r < requests; r++)
+    {
+        uint32_t id = order[r & ((1 << 20) - 1)];
+        timer_wheel_arm(&tw, id, WRITE_TICKS); // response queued
+        timer_wheel_arm(&tw, id, IDLE_TICKS);  // response sent, back to keep-alive
+        if (r % REQUESTS_PER_TICK == 0)
+            timer_wheel_advance(&tw, ++tick, on_expired, NULL);
+    }
+    double timer_ns = (now_sec() - start) / requests * 1e9;
+
+    double io_ns = io_ns_per_request(requests / 50 > 200000 ? 200000 : requests / 50);
+
+    printf("connections        %u\n", connections);
+    printf("timers per request %10.1f ns (write + idle re-arm, ticks included)\n", timer_ns);
+    printf("recv + send        %10.1f ns\n", io_ns);
+    printf("timer overhead     %10.2f %%\n", timer_ns / (timer_ns + io_ns) * 100);
+
+    // Everyone goes idle: run the wheel until every connection has timed out
+    expired_count = 0;
+    start = now_sec();
+    while (tw.count)
+        timer_wheel_advance(&tw, ++tick, on_expired, NULL);
+    double expire_elapsed = now_sec() - start;
+    printf("idle expiry        %10.1f ns per connection (%ld expired, %u ticks)\n",
+           expire_elapsed / expired_count * 1e9, expired_count, tick);
+
+    timer_wheel_destroy(&tw);
+    free(order);
+    return 0;
+}
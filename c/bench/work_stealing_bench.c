@@ -0,0 +1,133 @@
+// work_stealing_bench.c — work_stealing.h against one shared mpmc_queue.h queue
+// gcc -O3 -pthread -o work_stealing_bench work_stealing_bench.c
+// Run with: ./work_stealing_bench [workers] [tasks] [blocking_every] [tasks_per_sec]
+//
+// One thread submits tasks at a fixed rate, as an acceptor would; workers run
+// them. A task spins for ~2 us (parse + respond), and every blocking_every-th
+// one sleeps for 1 ms instead (a slow file read). Reports the delay from submit
+// to start, whose tail shows tasks stuck behind a blocked worker. Keep the rate
+// below what the workers sustain, or the delays only measure queue length.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "../work_stealing.h"
+
+static long tasks, blocking_every;
+static double interval; // between submissions
+static double *submitted_at, *delays;
+static atomic_long done;
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_task(void *state, int id)
+{
+    (void)state;
+    delays[id] = now_sec() - submitted_at[id];
+    if (blocking_every && id % blocking_every == 0)
+        usleep(1000);
+    else
+    {
+        double until = now_sec() + 2e-6;
+        while (now_sec() < until)
+            ;
+    }
+    atomic_fetch_add_explicit(&done, 1, memory_order_release);
+}
+
+/* ================= Shared queue ================= */
+
+static mpmc_queue_t shared;
+
+static void *shared_worker(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        int id = mpmc_queue_pop(&shared);
+        if (id < 0)
+            return NULL;
+        run_task(NULL, id);
+    }
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Waits for the time of task i's submission, then records it. */
+static void pace(long i, double start)
+{
+    double at = start + i * interval;
+    while (now_sec() < at)
+        ;
+    submitted_at[i] = now_sec();
+}
+
+static void report(const char *name, double elapsed)
+{
+    qsort(delays, tasks, sizeof(double), cmp_double);
+    printf("%-14s %10.0f tasks/s   delay p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us\n", name, tasks / elapsed,
+           delays[tasks / 2] * 1e6, delays[tasks * 99 / 100] * 1e6, delays[tasks * 999 / 1000] * 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    int workers = argc > 1 ? atoi(argv[1]) : 16;
+    tasks = argc > 2 ? atol(argv[2]) : 200000;
+    blocking_every = argc > 3 ? atol(argv[3]) : 100;
+    double rate = argc > 4 ? atof(argv[4]) : 100000;
+    interval = 1 / rate;
+    submitted_at = malloc(sizeof(double) * tasks);
+    delays = malloc(sizeof(double) * tasks);
+    printf("%d workers, %ld tasks at %.0f/s, one in %ld blocks for 1 ms\n", workers, tasks, rate, blocking_every);
+
+    // Work stealing
+    static ws_executor_t ex;
+    ws_executor_init(&ex, run_task, NULL, NULL);
+    for (int i = 0; i < workers; i++)
+        ws_executor_add_worker(&ex);
+    double start = now_sec();
+    for (long i = 0; i < tasks; i++)
+    {
+        pace(i, start);
+        while (ws_executor_submit(&ex, (int)i) < 0)
+            sched_yield();
+    }
+    while (atomic_load_explicit(&done, memory_order_acquire) < tasks)
+        usleep(100);
+    report("work stealing", now_sec() - start);
+
+    // One shared queue
+    atomic_store(&done, 0);
+    mpmc_queue_init(&shared, 1024);
+    pthread_t *tids = malloc(sizeof(pthread_t) * workers);
+    for (int i = 0; i < workers; i++)
+        pthread_create(&tids[i], NULL, shared_worker, NULL);
+    start = now_sec();
+    for (long i = 0; i < tasks; i++)
+    {
+        pace(i, start);
+        while (mpmc_queue_push(&shared, (int)i) < 0)
+            sched_yield();
+    }
+    while (atomic_load_explicit(&done, memory_order_acquire) < tasks)
+        usleep(100);
+    report("shared queue", now_sec() - start);
+    for (int i = 0; i < workers; i++)
+        while (mpmc_queue_push(&shared, -1) < 0)
+            sched_yield();
+    for (int i = 0; i < workers; i++)
+        pthread_join(tids[i], NULL);
+    return 0;
+}
@@ -0,0 +1,203 @@
+// conn_slab.h — Per-worker connection slots addressed by generation-tagged handles
+// Header-only, shared by the io_uring servers in this directory: #include "conn_slab.h"
+//
+// A completion carries back the 64-bit user_data of its SQE. A conn_t pointer
+// or an fd packed in there names a place, not a connection: once the
+// connection is closed the slot (or fd) is reused, and a completion still in
+// flight for the old connection lands on the new one. A slab handle is the
+// slot index plus the slot's generation, which moves on every time the slot
+// is taken and every time it is given back, so conn_slab_get() turns a stale
+// handle into NULL instead of a live connection. Handles take 48 bits,
+// leaving the top 16 of user_data for the op.
+//
+// A slot is split over two arrays. The hot part starts with a conn_slot_t and
+// holds what every completion touches (fd, state, the buffer being sent):
+// keep it to a cache line. The cold part holds buffers and the state of rarer
+// paths. conn_slab_init() maps both on the calling thread's NUMA node and
+// faults them in there, so a worker that is pinned before it builds its slab
+// keeps its connections in local memory.
+
+#ifndef CONN_SLAB_H
+#define CONN_SLAB_H
+
+#include <linux/mempolicy.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define CONN_SLAB_INDEX_BITS 20
+#define CONN_SLAB_MAX (1u << CONN_SLAB_INDEX_BITS)
+#define CONN_SLAB_GEN_MASK ((1u << (48 - CONN_SLAB_INDEX_BITS)) - 1)
+#define CONN_SLAB_HANDLE_MASK ((1ull << 48) - 1)
+
+/* First member of a slab's hot struct. The generation is odd while the slot is in use. */
+typedef struct
+{
+    uint32_t gen;
+    uint32_t index;
+} conn_slot_t;
+
+typedef struct
+{
+    char *hot;
+    char *cold;
+    size_t hot_size;
+    size_t cold_size;
+    uint32_t *free_stack;
+    uint32_t free_top;
+    uint32_t cap;
+    int node; // NUMA node the slots were placed on, or -1
+} conn_slab_t;
+
+/* The NUMA node of the CPU the calling thread runs on, or -1. */
+static inline int conn_slab_node(void)
+{
+    unsigned cpu, node;
+    return syscall(SYS_getcpu, &cpu, &node, NULL) == 0 ? (int)node : -1;
+}
+
+static inline size_t conn_slab_bytes(size_t len)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (len + page - 1) & ~(page - 1);
+}
+
+/* Anonymous memory preferring node (if >= 0), faulted in by this thread. */
+static inline void *conn_slab_map(size_t len, int node)
+{
+    len = conn_slab_bytes(len);
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    if (node >= 0 && node < 64)
+    {
+        // Best effort: without mbind (one node, seccomp) first touch below still places the pages
+        unsigned long mask = 1ul << node;
+        syscall(SYS_mbind, p, len, MPOL_PREFERRED, &mask, 64, 0);
+    }
+    memset(p, 0, len);
+    return p;
+}
+
+/**
+ * Maps a worker's slots on its NUMA node; call it on the worker's thread,
+ * after pinning it.
+ * @param s The slab.
+ * @param cap Number of slots, at most CONN_SLAB_MAX.
+ * @param hot_size Size of the hot struct (starting with a conn_slot_t).
+ * @param cold_size Size of the cold struct (may be 0).
+ * @return 0, or -1 if cap is too large or out of memory.
+ */
+static inline int conn_slab_init(conn_slab_t *s, uint32_t cap, size_t hot_size, size_t cold_size)
+{
+    memset(s, 0, sizeof(*s));
+    if (cap == 0 || cap > CONN_SLAB_MAX)
+        return -1;
+    s->cap = cap;
+    s->hot_size = hot_size;
+    s->cold_size = cold_size;
+    s->node = conn_slab_node();
+    s->hot = conn_slab_map(hot_size * cap, s->node);
+    s->cold = cold_size ? conn_slab_map(cold_size * cap, s->node) : NULL;
+    s->free_stack = conn_slab_map(sizeof(uint32_t) * cap, s->node);
+    if (!s->hot || (cold_size && !s->cold) || !s->free_stack)
+        return -1;
+    for (uint32_t i = 0; i < cap; i++)
+    {
+        ((conn_slot_t *)(s->hot + hot_size * i))->index = i;
+        s->free_stack[s->free_top++] = cap - 1 - i; // slot 0 is taken first
+    }
+    return 0;
+}
+
+static inline void conn_slab_destroy(conn_slab_t *s)
+{
+    if (s->hot)
+        munmap(s->hot, conn_slab_bytes(s->hot_size * s->cap));
+    if (s->cold)
+        munmap(s->cold, conn_slab_bytes(s->cold_size * s->cap));
+    if (s->free_stack)
+        munmap(s->free_stack, conn_slab_bytes(sizeof(uint32_t) * s->cap));
+    memset(s, 0, sizeof(*s));
+}
+
+static inline void *conn_slab_hot(const conn_slab_t *s, uint32_t i)
+{
+    return s->hot + s->hot_size * i;
+}
+
+static inline void *conn_slab_cold(const conn_slab_t *s, uint32_t i)
+{
+    return s->cold + s->cold_size * i;
+}
+
+/* The handle of a slot in use: generation and index, 48 bits. */
+static inline uint64_t conn_slab_handle(const conn_slot_t *slot)
+{
+    return (uint64_t)slot->gen << CONN_SLAB_INDEX_BITS | slot->index;
+}
+
+/**
+ * Resolves a handle from a completion.
+ * @param s The slab.
+ * @param handle The handle (bits above 48 are ignored).
+ * @return The slot's hot struct, or NULL if the handle is stale (the slot
+ *         was freed, and maybe taken again, since it was made).
+ */
+static inline void *conn_slab_get(const conn_slab_t *s, uint64_t handle)
+{
+    uint32_t i = (uint32_t)handle & (CONN_SLAB_MAX - 1);
+    if (i >= s->cap)
+        return NULL;
+    conn_slot_t *slot = conn_slab_hot(s, i);
+    return slot->gen == ((handle & CONN_SLAB_HANDLE_MASK) >> CONN_SLAB_INDEX_BITS) ? slot : NULL;
+}
+
+/**
+ * Takes a free slot.
+ * @param s The slab.
+ * @return Its hot struct (the rest of it as the last user left it), or NULL
+ *         if every slot is in use.
+ */
+static inline void *conn_slab_alloc(conn_slab_t *s)
+{
+    if (!s->free_top)
+        return NULL;
+    conn_slot_t *slot = conn_slab_hot(s, s->free_stack[--s->free_top]);
+    slot->gen = (slot->gen + 1) & CONN_SLAB_GEN_MASK;
+    return slot;
+}
+
+/* Gives a slot back; handles made while it was in use go stale. */
+static inline void conn_slab_free(conn_slab_t *s, void *hot)
+{
+    conn_slot_t *slot = hot;
+    slot->gen = (slot->gen + 1) & CONN_SLAB_GEN_MASK;
+    s->free_stack[s->free_top++] = slot->index;
+}
+
+/*
+ * For slabs whose slot numbers are chosen elsewhere (the kernel's fixed file
+ * table): conn_slab_claim() takes slot i, conn_slab_retire() ends its use.
+ * Do not mix them with conn_slab_alloc()/conn_slab_free() on one slab.
+ */
+static inline void *conn_slab_claim(conn_slab_t *s, uint32_t i)
+{
+    if (i >= s->cap)
+        return NULL;
+    conn_slot_t *slot = conn_slab_hot(s, i);
+    if (!(slot->gen & 1))
+        slot->gen = (slot->gen + 1) & CONN_SLAB_GEN_MASK;
+    return slot;
+}
+
+static inline void conn_slab_retire(conn_slab_t *s, void *hot)
+{
+    (void)s;
+    conn_slot_t *slot = hot;
+    slot->gen = (slot->gen + 1) & CONN_SLAB_GEN_MASK;
+}
+
+#endif
@@ -0,0 +1,196 @@
+// coro.h — Stackless coroutines for request handlers on an io_uring event loop
+// Header-only: #include "coro.h" (after <liburing.h>)
+//
+// A handler is a function of its frame, written as straight-line code with a
+// CORO_AWAIT around each I/O step. An await queues one SQE on the worker's
+// ring, tagged with the frame, and returns to the event loop; when that CQE
+// arrives the loop calls the handler again with the result in co->res, and a
+// switch on the saved resume point (Duff's device, as in protothreads) jumps
+// back to just after the await. There is no stack to keep: state that must
+// survive an await lives in the frame (CORO_LOCALS), not in C locals. Frames
+// come from a pool owned by the worker, so nothing is allocated per request
+// and a frame never changes threads.
+//
+//   static int hello(coro_t *co)
+//   {
+//       CORO_BEGIN(co);
+//       CORO_SLEEP(co, 10);
+//       coro_respond(co, "200 OK", "text/plain", "hi", 2);
+//       CORO_END(co);
+//   }
+//
+// Rules: at most one CORO_AWAIT per source line; every await completes with
+// exactly one CQE (no multishot or zero-copy ops); a negative co->res is an
+// error the handler must handle, including -ECANCELED once the client is gone
+// (awaits then fail at once without submitting, so the handler runs straight
+// through its error path: release what it holds synchronously there).
+
+#ifndef CORO_H
+#define CORO_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CORO_LOCALS_SIZE 4096 /* handler state kept across awaits */
+#define CORO_OUT_MAX 4352     /* rendered response: head + up to 4 KB of body */
+
+#define CORO_DONE 0
+#define CORO_PENDING 1
+
+typedef struct coro coro_t;
+typedef int (*coro_fn)(coro_t *co);
+
+struct coro
+{
+    coro_fn fn;
+    struct io_uring *ring;
+    uint64_t user_data;         // tags the frame's SQEs; the loop maps the CQE back to it
+    void *ctx;                  // the engine's (e.g. its worker), for handlers
+    void *owner;                // the engine's (e.g. the connection), NULL once orphaned
+    const void *req;            // the request; valid until the first await only
+    int line;                   // resume point: 0 to start, -1 when done
+    int res;                    // result of the last await
+    uint8_t in_flight;          // an awaited op has not completed
+    uint8_t cancelled;          // awaits fail with -ECANCELED
+    struct __kernel_timespec ts; // CORO_SLEEP's timeout; read by the kernel
+    uint32_t out_len;
+    char out[CORO_OUT_MAX];
+    _Alignas(16) unsigned char locals[CORO_LOCALS_SIZE];
+};
+
+/* The handler's state of type T, kept in the frame. */
+#define CORO_LOCALS(co, T) ((T *)(co)->locals)
+
+#define CORO_BEGIN(co)      \
+    switch ((co)->line)     \
+    {                       \
+    case 0:
+
+#define CORO_END(co)       \
+    }                      \
+    (co)->line = -1;       \
+    return CORO_DONE
+
+/* Finishes the handler early. */
+#define CORO_RETURN(co)    \
+    do                     \
+    {                      \
+        (co)->line = -1;   \
+        return CORO_DONE;  \
+    } while (0)
+
+/*
+ * Runs prep, which must queue one SQE from coro_sqe(co), and suspends until
+ * it completes; its result is then in co->res.
+ */
+#define CORO_AWAIT(co, prep)                 \
+    do                                       \
+    {                                        \
+        if ((co)->cancelled)                 \
+            (co)->res = -ECANCELED;          \
+        else                                 \
+        {                                    \
+            prep;                            \
+            (co)->in_flight = 1;             \
+            (co)->line = __LINE__;           \
+            return CORO_PENDING;             \
+        case __LINE__:;                      \
+        }                                    \
+    } while (0)
+
+/* Suspends for ms milliseconds (co->res is -ETIME when the time is up). */
+#define CORO_SLEEP(co, ms)                                                 \
+    CORO_AWAIT(co, ((co)->ts.tv_sec = (ms) / 1000,                         \
+                    (co)->ts.tv_nsec = (long long)(ms) % 1000 * 1000000,   \
+                    io_uring_prep_timeout(coro_sqe(co), &(co)->ts, 0, 0)))
+
+/**
+ * An SQE on the worker's ring, tagged so its CQE resumes this frame.
+ * @param co The frame.
+ */
+static inline struct io_uring_sqe *coro_sqe(coro_t *co)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(co->ring);
+    io_uring_sqe_set_data64(sqe, co->user_data);
+    return sqe;
+}
+
+/**
+ * Prepares a frame and runs the handler up to its first await (or its end).
+ * @param co A frame from the worker's pool.
+ * @param fn The handler.
+ * @param ring The worker's ring.
+ * @param user_data Tag for the frame's SQEs.
+ * @param ctx Engine data for the handler.
+ * @param owner Engine data for the completion (e.g. the connection).
+ * @param req The request, read by the handler before its first await.
+ * @return CORO_DONE or CORO_PENDING.
+ */
+static inline int coro_start(coro_t *co, coro_fn fn, struct io_uring *ring, uint64_t user_data, void *ctx,
+                             void *owner, const void *req)
+{
+    co->fn = fn;
+    co->ring = ring;
+    co->user_data = user_data;
+    co->ctx = ctx;
+    co->owner = owner;
+    co->req = req;
+    co->line = 0;
+    co->res = 0;
+    co->in_flight = 0;
+    co->cancelled = 0;
+    co->out_len = 0;
+    return fn(co);
+}
+
+/**
+ * Continues a frame with the result of the op it awaits.
+ * @param co The frame.
+ * @param res cqe->res.
+ * @return CORO_DONE or CORO_PENDING.
+ */
+static inline int coro_resume(coro_t *co, int res)
+{
+    co->in_flight = 0;
+    co->res = res;
+    co->req = NULL;
+    return co->fn(co);
+}
+
+static inline int coro_done(const coro_t *co)
+{
+    return co->line == -1;
+}
+
+/**
+ * Renders the response into the frame.
+ * @param co The frame.
+ * @param status Status line after "HTTP/1.1 ", e.g. "200 OK".
+ * @param content_type Content-Type value.
+ * @param body The body, copied.
+ * @param len Body length.
+ * @return 0, or -1 if it does not fit CORO_OUT_MAX (a 500 is rendered instead).
+ */
+static inline int coro_respond(coro_t *co, const char *status, const char *content_type, const void *body, size_t len)
+{
+    int head = snprintf(co->out, sizeof(co->out),
+                        "HTTP/1.1 %s\r\n"
+                        "Content-Type: %s\r\n"
+                        "Content-Length: %zu\r\n"
+                        "Connection: keep-alive\r\n"
+                        "\r\n",
+                        status, content_type, len);
+    if (head < 0 || (size_t)head + len > sizeof(co->out))
+    {
+        co->out_len = snprintf(co->out, sizeof(co->out),
+                               "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n");
+        return -1;
+    }
+    memcpy(co->out + head, body, len);
+    co->out_len = head + len;
+    return 0;
+}
+
+#endif
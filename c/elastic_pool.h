@@ -0,0 +1,177 @@
+// elastic_pool.h — Sizing policy and metrics for the elastic thread pools
+// Header-only, shared by the servers in this directory: #include "elastic_pool.h"
+//
+// The acceptor stamps every fd as it queues it, and the worker that picks it
+// up records how long it waited in a log2 histogram. Every ELASTIC_CHECK_MS the
+// thread that grows the pool looks at the waits since the previous check: if
+// their p99 is above the target, it adds about a quarter more threads. Growing
+// on wait time rather than queue length reacts to slow handlers too, not only
+// to bursts. Shrinking is up to the threads: one that idles for the idle
+// timeout exits, down to the minimum. Build with -DELASTIC_STATS_MS=1000 to
+// print the pool size, queue depth and wait histogram to stderr every second
+// (Prometheus text format).
+
+#ifndef ELASTIC_POOL_H
+#define ELASTIC_POOL_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define ELASTIC_WAIT_BUCKETS 24 /* bucket i: waits up to 2^i us, the last one: the rest */
+#define ELASTIC_MAX_FDS 65536   /* fds at or above this are not timed */
+#define ELASTIC_CHECK_MS 100
+#define ELASTIC_MIN_SAMPLES 32 /* waits needed in a check before its p99 counts */
+
+#ifndef ELASTIC_STATS_MS
+#define ELASTIC_STATS_MS 0 /* 0: never print */
+#endif
+
+typedef struct
+{
+    int min_threads, max_threads;
+    unsigned target_p99_us; // grow while the p99 wait is above this
+    unsigned idle_timeout_ms;
+    atomic_ullong waits[ELASTIC_WAIT_BUCKETS];
+    atomic_ullong wait_sum_us;
+    // Checker only
+    unsigned long long checked[ELASTIC_WAIT_BUCKETS]; // waits at the previous check
+    uint64_t next_check_ns, next_stats_ns;
+    unsigned last_p99_us;
+    uint64_t queued_at[ELASTIC_MAX_FDS]; // ns; published to the worker by the queue
+} elastic_pool_t;
+
+static inline uint64_t elastic_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Sets the policy and clears the histogram.
+ * @param p The pool.
+ * @param min_threads Idle threads do not exit below this.
+ * @param max_threads Growth stops here.
+ * @param target_p99_us Wait (queue to worker) the pool grows to stay under.
+ * @param idle_timeout_ms How long a thread idles before it exits.
+ */
+static inline void elastic_pool_init(elastic_pool_t *p, int min_threads, int max_threads, unsigned target_p99_us,
+                                     unsigned idle_timeout_ms)
+{
+    memset(p, 0, sizeof(*p));
+    p->min_threads = min_threads;
+    p->max_threads = max_threads;
+    p->target_p99_us = target_p99_us;
+    p->idle_timeout_ms = idle_timeout_ms;
+}
+
+/* Acceptor: call just before queueing fd. */
+static inline void elastic_pool_queued(elastic_pool_t *p, int fd)
+{
+    if ((unsigned)fd < ELASTIC_MAX_FDS)
+        p->queued_at[fd] = elastic_now_ns();
+}
+
+/* Worker: call when it picks fd up; records the wait. */
+static inline void elastic_pool_started(elastic_pool_t *p, int fd)
+{
+    if ((unsigned)fd >= ELASTIC_MAX_FDS)
+        return;
+    uint64_t us = (elastic_now_ns() - p->queued_at[fd]) / 1000;
+    int bucket = us > 1 ? 64 - __builtin_clzll(us - 1) : 0; // le=2^bucket is inclusive
+    if (bucket >= ELASTIC_WAIT_BUCKETS)
+        bucket = ELASTIC_WAIT_BUCKETS - 1;
+    atomic_fetch_add_explicit(&p->waits[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&p->wait_sum_us, us, memory_order_relaxed);
+}
+
+/**
+ * Upper bound of the wait at or below which a fraction q of the waits fall.
+ * @param counts Waits per bucket.
+ * @param q Fraction, e.g. 0.99.
+ * @return Microseconds (2^bucket), UINT32_MAX for the last bucket, 0 if empty.
+ */
+static inline unsigned elastic_percentile_us(const unsigned long long *counts, double q)
+{
+    unsigned long long total = 0, seen = 0;
+    for (int i = 0; i < ELASTIC_WAIT_BUCKETS; i++)
+        total += counts[i];
+    if (!total)
+        return 0;
+    for (int i = 0; i < ELASTIC_WAIT_BUCKETS - 1; i++)
+    {
+        seen += counts[i];
+        if (seen >= q * total)
+            return 1u << i;
+    }
+    return UINT32_MAX;
+}
+
+/**
+ * Writes the pool's metrics in Prometheus text format.
+ * @param p The pool.
+ * @param out Where to write.
+ * @param threads Threads running now.
+ * @param queue_depth Fds queued and not yet picked up.
+ */
+static inline void elastic_pool_print(elastic_pool_t *p, FILE *out, int threads, size_t queue_depth)
+{
+    fprintf(out, "pool_threads %d\npool_threads_max %d\npool_queue_depth %zu\npool_wait_p99_seconds %g\n", threads,
+            p->max_threads, queue_depth, p->last_p99_us / 1e6);
+    unsigned long long cumulative = 0;
+    for (int i = 0; i < ELASTIC_WAIT_BUCKETS; i++)
+    {
+        cumulative += atomic_load_explicit(&p->waits[i], memory_order_relaxed);
+        if (i < ELASTIC_WAIT_BUCKETS - 1)
+            fprintf(out, "pool_wait_seconds_bucket{le=\"%g\"} %llu\n", (double)(1u << i) / 1e6, cumulative);
+        else
+            fprintf(out, "pool_wait_seconds_bucket{le=\"+Inf\"} %llu\n", cumulative);
+    }
+    fprintf(out, "pool_wait_seconds_sum %g\npool_wait_seconds_count %llu\n",
+            atomic_load_explicit(&p->wait_sum_us, memory_order_relaxed) / 1e6, cumulative);
+}
+
+/**
+ * How many threads to add now. Call it often from the one thread that grows
+ * the pool; it only decides every ELASTIC_CHECK_MS (and prints the metrics
+ * every ELASTIC_STATS_MS) and returns 0 in between.
+ * @param p The pool.
+ * @param threads Threads running now.
+ * @param queue_depth Fds queued and not yet picked up.
+ * @return Threads to start, within max_threads.
+ */
+static inline int elastic_pool_check(elastic_pool_t *p, int threads, size_t queue_depth)
+{
+    uint64_t now = elastic_now_ns();
+    if (ELASTIC_STATS_MS && now >= p->next_stats_ns)
+    {
+        p->next_stats_ns = now + ELASTIC_STATS_MS * 1000000ull;
+        elastic_pool_print(p, stderr, threads, queue_depth);
+    }
+    if (now < p->next_check_ns)
+        return 0;
+    p->next_check_ns = now + ELASTIC_CHECK_MS * 1000000ull;
+
+    // Waits since the previous check
+    unsigned long long recent[ELASTIC_WAIT_BUCKETS], samples = 0;
+    for (int i = 0; i < ELASTIC_WAIT_BUCKETS; i++)
+    {
+        unsigned long long count = atomic_load_explicit(&p->waits[i], memory_order_relaxed);
+        recent[i] = count - p->checked[i];
+        p->checked[i] = count;
+        samples += recent[i];
+    }
+    if (samples < ELASTIC_MIN_SAMPLES)
+        return 0;
+    p->last_p99_us = elastic_percentile_us(recent, 0.99);
+    // Only when the whole p99 bucket lies above the target
+    if (p->last_p99_us / 2 < p->target_p99_us || threads >= p->max_threads)
+        return 0;
+    int grow = threads / 4 + 1;
+    return threads + grow > p->max_threads ? p->max_threads - threads : grow;
+}
+
+#endif
@@ -11,37 +11,201 @@ Running 10s test @ http://localhost:8081/
   5059127 requests in 10.09s, 366.68MB read
 Requests/sec: 501562.70
 Transfer/sec:     36.35MB
+
+GET /large answers with a large_body_size body. A flush of zerocopy_threshold
+bytes or more is sent with MSG_ZEROCOPY: the kernel pins the pages instead of
+copying them and reports on the socket error queue (EPOLLERR) when it is done.
+Build with -Dzerocopy_threshold=<bytes> to tune it.
+
+curl -s -o /dev/null -w '%{size_download}\n' http://127.0.0.1:8080/large
+
+/static/<path> serves files below static_root (./public by default) through a
+per-worker cache of open descriptors (static_files.h), with Range and
+If-None-Match support. Bodies go out with sendfile().
+
+curl -v -H 'Range: bytes=0-99' http://127.0.0.1:8080/static/index.html
+
+Any other request goes to Server.request_handler (router.h), here a router,
+flattened into arrays once its routes are added (flat_router.h): GET /
+answers Hello, World! as before, GET /user/:id and PUT /user/:id/name/:name
+echo their params, the rest is 404 or 405.
+
+curl http://127.0.0.1:8080/user/42
+
+Build with -Dgenerated_routes=1 to use the same routes (routes.txt) compiled
+by route_gen.c into static tables instead of a router_t built at startup:
+
+gcc -O2 -o route_gen route_gen.c && ./route_gen routes.txt > routes_gen.h
+gcc -O3 -pthread -Dgenerated_routes=1 -o epoll_simple epoll_simple.c
+
+Each worker times out its connections with a timing wheel (timer_wheel.h)
+ticked by the epoll_wait timeout: idle keep-alive connections after
+idle_timeout_ms, requests still incomplete after header_timeout_ms (so
+slowloris clients cannot pin fds) and responses that make no progress for
+write_timeout_ms. A 400 goes out with a FIN, and whatever the client still
+sends is dropped for up to linger_ms before the close, so an RST cannot
+discard the 400 before the client reads it.
+
+Build with -Dper_core_workers=1 to drop the acceptor thread: each worker (one
+per CPU, pinned to it) then owns an SO_REUSEPORT listener in its own epoll and
+accepts its connections itself, so accept scales with the cores instead of
+being bounded by one thread. Compare the two with bench/connection_rate.c:
+
+gcc -O3 -pthread -o connection_rate bench/connection_rate.c
+./connection_rate 127.0.0.1 8080 16 10
+
+Each worker (and the acceptor thread) counts accepts, reads, writes, bytes,
+errors and EAGAINs, events per epoll_wait and the latency from reading a
+request to its response being sent (metrics.h), served in Prometheus text
+format on the loopback admin port. Build with -DMETRICS_PORT=0 to drop them.
+
+curl http://127.0.0.1:9100/metrics
+
+Accept, read, dispatch and write complete are also USDT probes (trace.h).
+Build with -DTRACE_RING=65536 to keep each thread's last events in memory
+as well; kill -USR1 dumps them to trace-<pid>-<n>.bin for trace_report.c:
+
+gcc -O3 -pthread -DTRACE_RING=65536 -o epoll_simple epoll_simple.c && ./epoll_simple
+kill -USR1 $(pidof epoll_simple) && ./trace_report trace-*.bin
 */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
+#include <signal.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <asm-generic/socket.h>
+#include <linux/errqueue.h>
+#include "http_parser.h"
+#include "metrics.h"
+#include "router.h"
+#include "flat_router.h"
+#include "static_files.h"
+#include "timer_wheel.h"
+#include "trace.h"
 
 #define max_connection_size 1024
-#define max_thread_pool_size 16
+#define max_thread_pool_size 16 // workers behind the acceptor thread
+#ifndef per_core_workers
+#define per_core_workers 0
+#endif
+#ifndef generated_routes
+#define generated_routes 0 // 1: routes_gen.h from route_gen.c (see above)
+#endif
+#define max_fd_count 65536
+#define request_buffer_size 8192 // the largest request (head + body)
+#define max_pending_responses 64
+#define response_buffer_size 4096 // handler responses of a connection not yet sent
+#define handler_response_min 1024 // room a handler is always given
+#ifndef zerocopy_threshold
+#define zerocopy_threshold (64 * 1024)
+#endif
+#define large_body_size (1024 * 1024)
+#define large_path "/large"
+#define static_prefix "/static/"
+#ifndef static_root
+#define static_root "public"
+#endif
+#define timer_tick_ms 100
+#ifndef idle_timeout_ms
+#define idle_timeout_ms 60000 // keep-alive, waiting for the next request
+#endif
+#ifndef header_timeout_ms
+#define header_timeout_ms 10000 // a request has started but is not complete
+#endif
+#ifndef write_timeout_ms
+#define write_timeout_ms 30000 // queued output is not moving
+#endif
+#ifndef linger_ms
+#define linger_ms 1000 // after a 400, unread input is discarded this long before close
+#endif
+
+enum
+{
+    timer_none,
+    timer_idle,
+    timer_header,
+    timer_write,
+    timer_linger,
+};
 
 const unsigned char tiny_bad_request_response[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const unsigned char hello_response[] = "HTTP/1.1 200 OK\r\nContent-Length: 13\r\nConnection: keep-alive\r\n\r\nHello, World!";
+
+// Head + large_body_size body. Built once in server_run and never written
+// again, so pages the kernel still holds for MSG_ZEROCOPY stay valid even
+// after the connection that sent them is closed.
+static char *large_response;
+static size_t large_response_len;
 
 typedef struct
 {
     int port;
-    int socket_fd;
-    int epoll_fds[max_thread_pool_size];
-    pthread_t threads[max_thread_pool_size];
-    void *(*request_handler)(void *);
+    int socket_fd; // the acceptor's listener; -1 with per_core_workers
+    int worker_count;
+    int *epoll_fds;
+    pthread_t *threads;
+    request_handler_t request_handler; // answers what the built-in paths do not; NULL: hello
+    void *handler_data;
 } Server;
 
+// Per-connection state, indexed by fd. Bytes of a partial request stay in buf
+// until the rest arrives; the parser resumes where it stopped. Responses are
+// queued as iovecs (pointing at static data) and flushed with one sendmsg per
+// event-loop pass; whatever the socket does not take waits for EPOLLOUT.
+// Data passed to a MSG_ZEROCOPY send must not change until zc_done catches
+// up with zc_sent, so only flushes of static data go out zero-copy: nothing
+// in this struct is ever pinned, and a reused fd may start over at zero.
+// A static file response is a barrier: its head lives in static_head and its
+// body is sent with sendfile() once the queue ahead of it is out, so parsing
+// pauses until it is done. Request handlers write their responses one after
+// the other into response_buf, which is reused once everything queued is sent.
+typedef struct
+{
+    http_parser_t parser;
+    size_t len;
+    int out_count;
+    int close_after_flush;
+    int rejected;   // the queued response is a 400: linger once it is sent
+    int draining;   // ... it was, with a FIN: input is read and dropped until EOF
+    int want_write; // EPOLLOUT is registered
+    int zerocopy;   // 0 not yet enabled, 1 SO_ZEROCOPY set, -1 disabled
+    uint32_t zc_sent; // MSG_ZEROCOPY sends issued
+    uint32_t zc_done; // ... and released by the kernel
+    int timer_state;      // which timeout is armed
+    int progress;         // a request was parsed or bytes were sent since it was armed
+    int static_busy;      // a static response is queued; static_head is in use
+    static_file_t *file;  // file whose bytes follow the queue, or NULL
+    off_t file_offset;
+    size_t file_left;
+    char static_head[STATIC_HEAD_MAX];
+    size_t response_len; // bytes of response_buf in use
+    uint64_t burst_ns;   // metrics: pass that read the first request not yet answered, or 0
+    struct iovec out[max_pending_responses];
+    char response_buf[response_buffer_size];
+    char buf[request_buffer_size];
+} Connection;
+
+static Connection *connections;
+
 struct arg_struct
 {
     Server *server;
     int epoll_fd;
+    int index;     // worker number: its metrics and trace label
+    int cpu;       // CPU the worker is pinned to, or -1
+    int listen_fd; // the worker's own SO_REUSEPORT listener, or -1
+    static_cache_t *static_cache; // open files of this worker's connections
+    timer_wheel_t timers;         // one timer per fd handled by this worker
+    worker_metrics_t metrics;
 };
 
 /**
@@ -88,9 +252,10 @@ int create_server_socket(int port)
     set_non_blocking(server_fd); // Set server socket to non-blocking
 
     int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
     {
-        perror("setsockopt SO_REUSEPORT failed");
+        perror("setsockopt failed");
         close_socket(server_fd);
         exit(EXIT_FAILURE);
     }
@@ -147,6 +312,66 @@ void remove_fd_from_epoll(int epoll_fd, int fd)
     epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
 }
 
+/**
+ * Resets the state of a newly accepted client.
+ * @param conn The client's connection slot.
+ */
+static void init_connection(Connection *conn)
+{
+    conn->len = 0;
+    conn->out_count = 0;
+    conn->close_after_flush = 0;
+    conn->rejected = 0;
+    conn->draining = 0;
+    conn->want_write = 1;
+    conn->timer_state = timer_none;
+    conn->zerocopy = 0;
+    conn->zc_sent = 0;
+    conn->zc_done = 0;
+    conn->static_busy = 0;
+    conn->file = NULL;
+    conn->response_len = 0;
+    conn->burst_ns = 0;
+    http_parser_reset(&conn->parser);
+}
+
+/**
+ * Accepts every pending connection of a worker's own listener into its epoll.
+ * @param listen_fd The worker's listener.
+ * @param epoll_fd The worker's epoll file descriptor.
+ * @param metrics The worker's metrics.
+ */
+static void accept_local_clients(int listen_fd, int epoll_fd, worker_metrics_t *metrics)
+{
+    while (1)
+    {
+        int client_fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (client_fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("accept4");
+                metrics_add(metrics, METRIC_ERRORS, 1);
+            }
+            return;
+        }
+        metrics_add(metrics, METRIC_ACCEPTS, 1);
+        trace_accept(client_fd, client_fd);
+        if (client_fd >= max_fd_count)
+        {
+            close_socket(client_fd);
+            continue;
+        }
+        init_connection(&connections[client_fd]);
+        // EPOLLOUT fires at once on a new socket, so the worker sees it
+        // (and arms its timeout) even if nothing is sent
+        if (add_fd_to_epoll(epoll_fd, client_fd, EPOLLIN | EPOLLOUT | EPOLLET) < 0)
+            close_socket(client_fd);
+    }
+}
+
 /**
  * Handles accepting new client connections in the main thread.
  * @param server Pointer to the Server struct.
@@ -155,8 +380,11 @@ void remove_fd_from_epoll(int epoll_fd, int fd)
 void handle_accept_loop(Server *server, int main_epoll_fd)
 {
     static int next_worker = 0;
+    static worker_metrics_t metrics;
     struct epoll_event events[1];
 
+    metrics_register(&metrics, "acceptor");
+    trace_register("acceptor");
     while (1)
     {
         int n = epoll_wait(main_epoll_fd, events, 1, -1);
@@ -180,12 +408,23 @@ void handle_accept_loop(Server *server, int main_epoll_fd)
                         if (errno == EAGAIN || errno == EWOULDBLOCK)
                             break;
                         perror("accept");
+                        metrics_add(&metrics, METRIC_ERRORS, 1);
+                        continue;
+                    }
+                    metrics_add(&metrics, METRIC_ACCEPTS, 1);
+                    trace_accept(client_fd, client_fd);
+                    if (client_fd >= max_fd_count)
+                    {
+                        close_socket(client_fd);
                         continue;
                     }
                     set_non_blocking(client_fd); // Set client socket to non-blocking
+                    init_connection(&connections[client_fd]);
                     int epoll_fd = server->epoll_fds[next_worker];
-                    next_worker = (next_worker + 1) % max_thread_pool_size;
-                    if (add_fd_to_epoll(epoll_fd, client_fd, EPOLLIN | EPOLLET) < 0)
+                    next_worker = (next_worker + 1) % server->worker_count;
+                    // EPOLLOUT fires at once on a new socket, so the worker
+                    // sees it (and arms its timeout) even if nothing is sent
+                    if (add_fd_to_epoll(epoll_fd, client_fd, EPOLLIN | EPOLLOUT | EPOLLET) < 0)
                     {
                         close_socket(client_fd);
                     }
@@ -195,6 +434,476 @@ void handle_accept_loop(Server *server, int main_epoll_fd)
     }
 }
 
+/**
+ * Appends a response to a connection's output queue. The data is not copied
+ * and must outlive the flush.
+ * @param conn The connection.
+ * @param data The response bytes.
+ * @param len Length of the response.
+ */
+static inline void queue_response(Connection *conn, const void *data, size_t len)
+{
+    conn->out[conn->out_count].iov_base = (void *)data;
+    conn->out[conn->out_count].iov_len = len;
+    conn->out_count++;
+}
+
+/**
+ * Queues the response to a /static/ request: the rendered head, followed by
+ * the file range static_respond() picked.
+ * @param cache The worker's open-file cache.
+ * @param conn The connection.
+ * @param request The parsed request.
+ */
+static void queue_static_response(static_cache_t *cache, Connection *conn, const http_request_t *request)
+{
+    const char *path = request->path.ptr + sizeof(static_prefix) - 1;
+    size_t path_len = request->path.len - (sizeof(static_prefix) - 1);
+    const char *query = memchr(path, '?', path_len);
+    if (query)
+        path_len = query - path;
+
+    size_t head_len = static_respond(cache, request, path, path_len, conn->static_head,
+                                     &conn->file, &conn->file_offset, &conn->file_left);
+    queue_response(conn, conn->static_head, head_len);
+    conn->static_busy = 1;
+}
+
+/**
+ * Runs the server's request handler and queues the response it wrote into
+ * the connection's response_buf.
+ * @param server The server.
+ * @param conn The connection.
+ * @param request The parsed request.
+ */
+static void queue_handler_response(const Server *server, Connection *conn, const http_request_t *request)
+{
+    request_view_t view;
+    request_view_init(&view, request);
+    response_writer_t res;
+    response_writer_init(&res, conn->response_buf + conn->response_len,
+                         sizeof(conn->response_buf) - conn->response_len);
+    server->request_handler(server->handler_data, &view, &res);
+    if (res.len == 0)
+        response_send(&res, "500 Internal Server Error", "text/plain", "", 0);
+    queue_response(conn, res.buf, res.len);
+    conn->response_len += res.len;
+}
+
+static inline int response_buf_full(const Connection *conn)
+{
+    return sizeof(conn->response_buf) - conn->response_len < handler_response_min;
+}
+
+/**
+ * Drops the file a connection was sending, if any.
+ * @param cache The worker's open-file cache.
+ * @param conn The connection.
+ */
+static inline void release_static_file(static_cache_t *cache, Connection *conn)
+{
+    if (conn->file)
+    {
+        static_file_put(cache, conn->file);
+        conn->file = NULL;
+    }
+    conn->static_busy = 0;
+}
+
+/**
+ * Parses buffered requests and reads more until the socket is drained.
+ * Stops early when the output queue is full (or holds a static response, or
+ * the handlers' responses fill response_buf), so a pipelining client cannot
+ * grow it without bound; the caller resumes after flushing.
+ * @param server The server.
+ * @param cache The worker's open-file cache.
+ * @param metrics The worker's metrics.
+ * @param fd The client file descriptor.
+ * @param conn The connection.
+ * @return 0 when the socket is drained (or the connection is closing),
+ *         1 when the output queue is full, -1 on a socket error.
+ */
+int read_requests(const Server *server, static_cache_t *cache, worker_metrics_t *metrics, int fd, Connection *conn)
+{
+    while (1)
+    {
+        size_t offset = 0;
+        while (offset < conn->len && conn->out_count < max_pending_responses && !conn->close_after_flush &&
+               !conn->static_busy && !response_buf_full(conn))
+        {
+            http_request_t request;
+            int consumed = http_parse_request(&conn->parser, conn->buf + offset, conn->len - offset, &request);
+            if (consumed == HTTP_PARSE_INCOMPLETE)
+                break;
+            if (consumed == HTTP_PARSE_ERROR)
+            {
+                queue_response(conn, tiny_bad_request_response, sizeof(tiny_bad_request_response) - 1);
+                conn->close_after_flush = 1;
+                conn->rejected = 1;
+                break;
+            }
+
+            trace_dispatch(fd, request.path.ptr, request.path.len);
+            if (request.path.len >= sizeof(static_prefix) - 1 &&
+                memcmp(request.path.ptr, static_prefix, sizeof(static_prefix) - 1) == 0)
+                queue_static_response(cache, conn, &request);
+            else if (request.path.len == sizeof(large_path) - 1 &&
+                     memcmp(request.path.ptr, large_path, sizeof(large_path) - 1) == 0)
+                queue_response(conn, large_response, large_response_len);
+            else if (server->request_handler)
+                queue_handler_response(server, conn, &request);
+            else
+                queue_response(conn, hello_response, sizeof(hello_response) - 1);
+            if (!request.keep_alive)
+                conn->close_after_flush = 1;
+            offset += consumed;
+            conn->progress = 1;
+            metrics_add(metrics, METRIC_REQUESTS, 1);
+            metrics_burst_begin(metrics, &conn->burst_ns);
+            http_parser_reset(&conn->parser);
+        }
+
+        // Keep the partial request at the front of the buffer
+        if (offset > 0)
+        {
+            memmove(conn->buf, conn->buf + offset, conn->len - offset);
+            conn->len -= offset;
+        }
+
+        if (conn->close_after_flush)
+            return 0;
+        if (conn->out_count == max_pending_responses || conn->static_busy || response_buf_full(conn))
+            return 1;
+        if (conn->len == sizeof(conn->buf))
+        {
+            // Head (or body) larger than the buffer: reject
+            queue_response(conn, tiny_bad_request_response, sizeof(tiny_bad_request_response) - 1);
+            conn->close_after_flush = 1;
+            conn->rejected = 1;
+            return 0;
+        }
+
+        ssize_t bytes_read = recv(fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len, 0);
+        if (bytes_read == 0)
+        {
+            // Peer finished sending: answer what it asked, then close
+            conn->close_after_flush = 1;
+            return 0;
+        }
+        if (bytes_read < 0)
+        {
+            int again = errno == EAGAIN || errno == EWOULDBLOCK;
+            metrics_add(metrics, again ? METRIC_EAGAIN : METRIC_ERRORS, 1);
+            return again ? 0 : -1;
+        }
+        trace_read(fd, bytes_read);
+        metrics_add(metrics, METRIC_READS, 1);
+        metrics_add(metrics, METRIC_BYTES_IN, bytes_read);
+        conn->len += bytes_read;
+    }
+}
+
+/**
+ * Decides whether a flush of len bytes goes out with MSG_ZEROCOPY, enabling
+ * SO_ZEROCOPY on the socket the first time. Below the threshold, pinning pages
+ * and handling the completion costs more than the copy it saves.
+ * @param fd The client file descriptor.
+ * @param conn The connection.
+ * @param len Bytes about to be sent.
+ * @return 1 to send zero-copy, 0 to copy.
+ */
+static inline int use_zerocopy(int fd, Connection *conn, size_t len)
+{
+    if (len < zerocopy_threshold || conn->zerocopy < 0)
+        return 0;
+    if (conn->zerocopy == 0)
+    {
+        int one = 1;
+        conn->zerocopy = setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0 ? 1 : -1;
+    }
+    return conn->zerocopy > 0;
+}
+
+/**
+ * Reads MSG_ZEROCOPY completions from the socket error queue. Each one covers
+ * a range of sends whose pages the kernel no longer holds. If the kernel had
+ * to copy anyway (loopback, devices without scatter-gather), zero-copy only
+ * adds overhead, so it is turned off for the connection.
+ * @param fd The client file descriptor.
+ * @param conn The connection.
+ * @return 0 when the error queue is drained, -1 on a socket error.
+ */
+int drain_zerocopy_completions(int fd, Connection *conn)
+{
+    while (1)
+    {
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in))];
+        struct msghdr msg = {.msg_control = control, .msg_controllen = sizeof(control)};
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+        {
+            if (cm->cmsg_level != SOL_IP || cm->cmsg_type != IP_RECVERR)
+                continue;
+            struct sock_extended_err *err = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0)
+                continue;
+            // ee_info..ee_data is the inclusive range of completed send ids
+            conn->zc_done += err->ee_data - err->ee_info + 1;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                conn->zerocopy = -1;
+        }
+    }
+}
+
+/**
+ * Handles EPOLLERR. With MSG_ZEROCOPY in flight it usually just means
+ * completions are waiting on the error queue; only a pending socket error
+ * closes the connection.
+ * @param fd The client file descriptor.
+ * @param conn The connection.
+ * @return 0 to keep the connection, -1 to close it.
+ */
+int handle_error_event(int fd, Connection *conn)
+{
+    if (conn->zc_sent == conn->zc_done || drain_zerocopy_completions(fd, conn) < 0)
+        return -1;
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0 || err != 0)
+        return -1;
+    return 0;
+}
+
+/**
+ * Writes as much of the output queue as the socket accepts in one sendmsg
+ * per attempt, keeping the unsent tail (including a partly sent iovec).
+ * Large flushes of static data go out zero-copy (see use_zerocopy). A static
+ * file body is sent with sendfile() after the queue.
+ * @param cache The worker's open-file cache.
+ * @param metrics The worker's metrics.
+ * @param fd The client file descriptor.
+ * @param conn The connection.
+ * @return 1 when everything is sent, 0 when the socket is full, -1 on error.
+ */
+int flush_responses(static_cache_t *cache, worker_metrics_t *metrics, int fd, Connection *conn)
+{
+    struct iovec *iov = conn->out;
+    int count = conn->out_count;
+
+    while (count > 0)
+    {
+        size_t pending = 0;
+        for (int i = 0; i < count; i++)
+            pending += iov[i].iov_len;
+        // Handler output and static heads are copied: response_buf and
+        // static_head are rewritten as soon as the queue drains
+        int zerocopy = !conn->response_len && !conn->static_busy && use_zerocopy(fd, conn, pending);
+
+        // MSG_MORE lets a static head share a segment with the file data
+        int flags = MSG_NOSIGNAL | (zerocopy ? MSG_ZEROCOPY : 0) | (conn->file ? MSG_MORE : 0);
+        struct msghdr msg = {.msg_iov = iov, .msg_iovlen = count};
+        ssize_t sent = sendmsg(fd, &msg, flags);
+        if (sent < 0 && zerocopy && errno == ENOBUFS)
+        {
+            // Over the socket's optmem limit for pinned pages: copy this one
+            zerocopy = 0;
+            sent = sendmsg(fd, &msg, flags & ~MSG_ZEROCOPY);
+        }
+        if (sent < 0)
+        {
+            int again = errno == EAGAIN || errno == EWOULDBLOCK;
+            metrics_add(metrics, again ? METRIC_EAGAIN : METRIC_ERRORS, 1);
+            if (again)
+                break;
+            return -1;
+        }
+        trace_write(fd, sent);
+        metrics_add(metrics, METRIC_WRITES, 1);
+        metrics_add(metrics, METRIC_BYTES_OUT, sent);
+        if (zerocopy)
+            conn->zc_sent++;
+        conn->progress = 1;
+        while (count > 0 && (size_t)sent >= iov->iov_len)
+        {
+            sent -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = (char *)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+
+    if (count > 0 && iov != conn->out)
+        memmove(conn->out, iov, count * sizeof(struct iovec));
+    conn->out_count = count;
+    if (count > 0)
+        return 0;
+    conn->response_len = 0;
+
+    while (conn->file_left > 0)
+    {
+        ssize_t sent = sendfile(fd, conn->file->fd, &conn->file_offset, conn->file_left);
+        if (sent < 0)
+        {
+            int again = errno == EAGAIN || errno == EWOULDBLOCK;
+            metrics_add(metrics, again ? METRIC_EAGAIN : METRIC_ERRORS, 1);
+            return again ? 0 : -1;
+        }
+        if (sent == 0)
+            return -1; // file shrank under us: the promised length cannot be met
+        trace_write(fd, sent);
+        metrics_add(metrics, METRIC_WRITES, 1);
+        metrics_add(metrics, METRIC_BYTES_OUT, sent);
+        conn->file_left -= sent;
+        conn->progress = 1;
+    }
+    if (conn->static_busy)
+        release_static_file(cache, conn);
+    metrics_burst_end(metrics, &conn->burst_ns);
+    return 1;
+}
+
+/**
+ * Registers or drops interest in EPOLLOUT for a connection.
+ * @param epoll_fd The worker's epoll file descriptor.
+ * @param fd The client file descriptor.
+ * @param conn The connection.
+ * @param enable 1 to wait for writability, 0 to stop.
+ * @return 0 on success, -1 on failure.
+ */
+int set_want_write(int epoll_fd, int fd, Connection *conn, int enable)
+{
+    if (conn->want_write == enable)
+        return 0;
+    struct epoll_event ev = {
+        .events = EPOLLIN | EPOLLET | (enable ? EPOLLOUT : 0),
+        .data.fd = fd};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1)
+        return -1;
+    conn->want_write = enable;
+    return 0;
+}
+
+/**
+ * Reads and drops what a rejected client still sends. Closing with its
+ * request unread would send an RST that can discard the 400 before the
+ * client reads it, so the 400 goes out with a FIN and the socket is closed
+ * at the client's EOF (EPOLLHUP) or after linger_ms.
+ * @param fd The client file descriptor.
+ * @param conn The connection.
+ * @return 0 to keep draining, -1 to close.
+ */
+static int drain_client(int fd, Connection *conn)
+{
+    for (int i = 0; i < 16; i++) // a flooding client waits for its next edge
+    {
+        ssize_t n = recv(fd, conn->buf, sizeof(conn->buf), 0);
+        if (n <= 0)
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    return 0;
+}
+
+/**
+ * Handles a readable or writable client socket: reads and parses requests,
+ * then flushes all queued responses at once. The socket is edge-triggered,
+ * so it is read until EAGAIN.
+ * @param server The server.
+ * @param cache The worker's open-file cache.
+ * @param metrics The worker's metrics.
+ * @param epoll_fd The worker's epoll file descriptor.
+ * @param fd The client file descriptor.
+ * @return 0 to keep the connection, -1 to close it.
+ */
+int handle_client_events(const Server *server, static_cache_t *cache, worker_metrics_t *metrics, int epoll_fd,
+                         int fd)
+{
+    Connection *conn = &connections[fd];
+    if (conn->draining)
+        return drain_client(fd, conn);
+
+    while (1)
+    {
+        int queue_full = read_requests(server, cache, metrics, fd, conn);
+        if (queue_full < 0)
+            return -1;
+
+        int flushed = flush_responses(cache, metrics, fd, conn);
+        if (flushed < 0)
+            return -1;
+        if (!flushed)
+            return set_want_write(epoll_fd, fd, conn, 1);
+        if (conn->close_after_flush && conn->rejected)
+        {
+            conn->draining = 1;
+            if (shutdown(fd, SHUT_WR) < 0 || set_want_write(epoll_fd, fd, conn, 0) < 0)
+                return -1;
+            return drain_client(fd, conn);
+        }
+        if (conn->close_after_flush)
+            return -1;
+        if (!queue_full)
+            return set_want_write(epoll_fd, fd, conn, 0);
+    }
+}
+
+/**
+ * Removes a client from its worker and closes it.
+ * @param worker The worker owning the client.
+ * @param fd The client file descriptor.
+ */
+static void close_client(struct arg_struct *worker, int fd)
+{
+    timer_wheel_cancel(&worker->timers, fd);
+    release_static_file(worker->static_cache, &connections[fd]);
+    remove_fd_from_epoll(worker->epoll_fd, fd);
+    close_socket(fd);
+}
+
+static void expire_client(void *worker, uint32_t fd)
+{
+    close_client(worker, fd);
+}
+
+static inline uint32_t current_tick(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t)((ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / timer_tick_ms);
+}
+
+/**
+ * Arms the timeout that matches what a connection is waiting for. It is
+ * pushed back only when the state changes or the connection made progress,
+ * so trickling bytes does not extend a header or write deadline.
+ * @param worker The worker owning the client.
+ * @param fd The client file descriptor.
+ * @param conn The connection.
+ */
+static void update_client_timer(struct arg_struct *worker, int fd, Connection *conn)
+{
+    int state = conn->draining                         ? timer_linger
+                : (conn->out_count || conn->file_left) ? timer_write
+                : conn->len                            ? timer_header
+                                                       : timer_idle;
+    if (state == conn->timer_state && !conn->progress)
+        return;
+    static const uint32_t timeout_ms[] = {
+        [timer_idle] = idle_timeout_ms,
+        [timer_header] = header_timeout_ms,
+        [timer_write] = write_timeout_ms,
+        [timer_linger] = linger_ms,
+    };
+    timer_wheel_arm(&worker->timers, fd, timeout_ms[state] / timer_tick_ms);
+    conn->timer_state = state;
+    conn->progress = 0;
+}
+
 /**
  * Worker thread function to process client events.
  * @param arguments Pointer to the arg_struct containing server and epoll_fd.
@@ -203,13 +912,30 @@ void handle_accept_loop(Server *server, int main_epoll_fd)
 void *process_events(void *arguments)
 {
     struct arg_struct *args = (struct arg_struct *)arguments;
-    Server *server = args->server;
     int epoll_fd = args->epoll_fd;
+    static_cache_t *cache = args->static_cache;
+
+    if (args->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(args->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    char label[16];
+    snprintf(label, sizeof(label), "%d", args->index);
+    metrics_register(&args->metrics, label);
+    trace_register(label);
 
     struct epoll_event events[max_connection_size];
     while (1)
     {
-        int num_events = epoll_wait(epoll_fd, events, max_connection_size, -1);
+        // Wake once a tick while any timeout is armed
+        int timeout = args->timers.count ? timer_tick_ms : -1;
+        int num_events = epoll_wait(epoll_fd, events, max_connection_size, timeout);
+        // An empty wheel is not ticked: catch its clock up before arming (expires nothing)
+        if (!args->timers.count)
+            timer_wheel_advance(&args->timers, current_tick(), expire_client, args);
         if (num_events < 0)
         {
             if (errno == EINTR)
@@ -217,43 +943,35 @@ void *process_events(void *arguments)
             perror("epoll_wait");
             break;
         }
+        metrics_pass_begin(&args->metrics);
 
         for (int i = 0; i < num_events; i++)
         {
             int fd = events[i].data.fd;
-            if (events[i].events & (EPOLLHUP | EPOLLERR))
+            if (fd == args->listen_fd)
             {
-                remove_fd_from_epoll(epoll_fd, fd);
-                close_socket(fd);
+                accept_local_clients(fd, epoll_fd, &args->metrics);
                 continue;
             }
-
-            if (events[i].events & EPOLLIN)
+            if ((events[i].events & EPOLLHUP) ||
+                ((events[i].events & EPOLLERR) && handle_error_event(fd, &connections[fd]) < 0))
             {
-                char request_buffer[1024];
-                int bytes_read = recv(fd, request_buffer, sizeof(request_buffer), 0);
-                if (bytes_read <= 0)
-                {
-                    // free(request_buffer);
-                    if (bytes_read == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
-                    {
-                        remove_fd_from_epoll(epoll_fd, fd);
-                        close_socket(fd);
-                    }
-                    continue;
-                }
-
-                const char *response;
-                response = "HTTP/1.1 200 OK\r\nContent-Length: 13\r\nConnection: keep-alive\r\n\r\nHello, World!";
+                close_client(args, fd);
+                continue;
+            }
 
-                ssize_t sent = send(fd, response, strlen(response), MSG_NOSIGNAL);
-                if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
-                {
-                    remove_fd_from_epoll(epoll_fd, fd);
-                    close_socket(fd);
-                }
+            if (events[i].events & (EPOLLIN | EPOLLOUT))
+            {
+                if (handle_client_events(args->server, cache, &args->metrics, epoll_fd, fd) < 0)
+                    close_client(args, fd);
+                else
+                    update_client_timer(args, fd, &connections[fd]);
             }
         }
+        // Timeouts are ticks, not batches
+        if (num_events)
+            metrics_pass_end(&args->metrics, num_events);
+        timer_wheel_advance(&args->timers, current_tick(), expire_client, args);
     }
     pthread_exit(NULL);
     return NULL;
@@ -265,12 +983,48 @@ void *process_events(void *arguments)
  */
 void server_run(Server *server)
 {
+#if per_core_workers
+    server->socket_fd = -1;
+    server->worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+#else
     server->socket_fd = create_server_socket(server->port);
     if (server->socket_fd < 0)
     {
         return;
     }
+    server->worker_count = max_thread_pool_size;
+#endif
+
+    connections = calloc(max_fd_count, sizeof(Connection));
+    server->epoll_fds = calloc(server->worker_count, sizeof(int));
+    server->threads = calloc(server->worker_count, sizeof(pthread_t));
+    if (!connections || !server->epoll_fds || !server->threads)
+    {
+        perror("calloc");
+        close_socket(server->socket_fd);
+        exit(EXIT_FAILURE);
+    }
+
+    char head[128];
+    int head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+                            "Content-Length: %d\r\nConnection: keep-alive\r\n\r\n",
+                            large_body_size);
+    large_response_len = head_len + large_body_size;
+    large_response = aligned_alloc(4096, (large_response_len + 4095) & ~(size_t)4095);
+    if (!large_response)
+    {
+        perror("aligned_alloc");
+        close_socket(server->socket_fd);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(large_response, head, head_len);
+    memset(large_response + head_len, 'x', large_body_size);
+
+    // Before any thread starts: they inherit SIGUSR1 blocked
+    trace_start();
 
+#if !per_core_workers
     int main_epoll_fd = epoll_create1(0);
     if (main_epoll_fd < 0)
     {
@@ -285,65 +1039,131 @@ void server_run(Server *server)
         close_socket(main_epoll_fd);
         exit(EXIT_FAILURE);
     }
+#endif
 
-    for (int i = 0; i < max_thread_pool_size; i++)
+    for (int i = 0; i < server->worker_count; i++)
     {
         server->epoll_fds[i] = epoll_create1(0);
         if (server->epoll_fds[i] < 0)
         {
             perror("epoll_create1");
-            for (int j = 0; j < i; j++)
-            {
-                close_socket(server->epoll_fds[j]);
-            }
-            close_socket(main_epoll_fd);
-            close_socket(server->socket_fd);
             exit(EXIT_FAILURE);
         }
 
-        struct arg_struct *args = malloc(sizeof(struct arg_struct));
+        // Aligned: each worker's metrics start on their own cache line
+        struct arg_struct *args = aligned_alloc(_Alignof(struct arg_struct), sizeof(struct arg_struct));
         if (!args)
         {
-            perror("malloc");
-            for (int j = 0; j <= i; j++)
-            {
-                close_socket(server->epoll_fds[j]);
-            }
-            close_socket(main_epoll_fd);
-            close_socket(server->socket_fd);
+            perror("aligned_alloc");
             exit(EXIT_FAILURE);
         }
         args->server = server;
+        args->index = i;
         args->epoll_fd = server->epoll_fds[i];
+#if per_core_workers
+        // One listener per worker: the kernel spreads incoming connections
+        // over them by flow hash, and each worker accepts its own
+        args->cpu = i;
+        args->listen_fd = create_server_socket(server->port);
+        if (add_fd_to_epoll(args->epoll_fd, args->listen_fd, EPOLLIN) < 0)
+            exit(EXIT_FAILURE);
+#else
+        args->cpu = -1;
+        args->listen_fd = -1;
+#endif
+        args->static_cache = malloc(sizeof(static_cache_t));
+        if (!args->static_cache)
+        {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        if (timer_wheel_init(&args->timers, max_fd_count, current_tick()) < 0)
+        {
+            perror("timer_wheel_init");
+            exit(EXIT_FAILURE);
+        }
+        if (static_cache_init(args->static_cache, static_root) < 0 && i == 0)
+            fprintf(stderr, "static root '%s' not found: /static/ answers 404\n", static_root);
 
         if (pthread_create(&(server->threads[i]), NULL, process_events, args) != 0)
         {
             perror("pthread_create");
-            free(args);
-            for (int j = 0; j <= i; j++)
-            {
-                close_socket(server->epoll_fds[j]);
-            }
-            close_socket(main_epoll_fd);
-            close_socket(server->socket_fd);
             exit(EXIT_FAILURE);
         }
     }
 
-    printf("listening on http://localhost:%d/\n", server->port);
+    metrics_start();
+    printf("listening on http://localhost:%d/ (%d workers%s)\n", server->port, server->worker_count,
+           per_core_workers ? ", one SO_REUSEPORT listener each" : "");
+#if per_core_workers
+    for (int i = 0; i < server->worker_count; i++)
+        pthread_join(server->threads[i], NULL);
+#else
     handle_accept_loop(server, main_epoll_fd);
+#endif
 }
 
+static void hello_handler(void *data, request_view_t *req, response_writer_t *res)
+{
+    (void)data;
+    (void)req;
+    response_write(res, hello_response, sizeof(hello_response) - 1);
+}
+
+static void user_handler(void *data, request_view_t *req, response_writer_t *res)
+{
+    (void)data;
+    http_slice_t id = request_param(req, "id");
+    http_slice_t name = request_param(req, "name");
+    char body[256];
+    int len = snprintf(body, sizeof(body), "user %.*s%s%.*s", (int)id.len, id.ptr, name.ptr ? " name " : "",
+                       (int)name.len, name.ptr ? name.ptr : "");
+    response_send(res, "200 OK", "text/plain", body, len < (int)sizeof(body) ? len : (int)sizeof(body) - 1);
+}
+
+#if generated_routes
+#include "routes_gen.h"
+#endif
+
 /**
  * Main entry point of the program.
  * @return Exit status.
  */
 int main()
 {
+    // sendfile() has no MSG_NOSIGNAL: peer resets must surface as EPIPE
+    signal(SIGPIPE, SIG_IGN);
+
+#if generated_routes
+    Server server = {
+        .port = 8080,
+        .socket_fd = -1,
+        .request_handler = routes_dispatch};
+#else
+    router_t router;
+    router_init(&router);
+    if (router_add(&router, "GET", "/", hello_handler, NULL) < 0 ||
+        router_add(&router, "GET", "/user/:id", user_handler, NULL) < 0 ||
+        router_add(&router, "PUT", "/user/:id/name/:name", user_handler, NULL) < 0)
+    {
+        fputs("router_add failed\n", stderr);
+        return 1;
+    }
+    // Served from the flattened copy (flat_router.h)
+    static flat_router_t flat_router;
+    if (flat_router_build(&flat_router, &router) < 0)
+    {
+        fputs("flat_router_build failed\n", stderr);
+        return 1;
+    }
+    router_free(&router);
+
     Server server = {
         .port = 8080,
         .socket_fd = -1,
-        .request_handler = NULL};
+        .request_handler = flat_router_dispatch,
+        .handler_data = &flat_router};
+#endif
     server_run(&server);
     return 0;
 }
\ No newline at end of file
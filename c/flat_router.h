@@ -0,0 +1,294 @@
+// flat_router.h — router.h's radix trie flattened into contiguous arrays
+// Header-only: #include "flat_router.h" (after router.h)
+//
+// router_t is built by router_add() as heap nodes: each has its own children
+// pointer array, first-byte array and a linked list of methods (the shape of
+// trie_node.v and patricia_trie.v, minus the maps). A lookup hops between
+// allocations and every hop is likely a cache miss. flat_router_build() copies
+// a finished router_t into four arrays:
+//   nodes  20-byte nodes in breadth-first order: a node's static children are
+//          adjacent, sorted by first byte, with its ":name" child right after
+//   first  the first label byte of every node, by node index, so a node's
+//          edges are one compact sorted byte run (searched 16 at a time)
+//   labels every label and param name, siblings next to each other
+//   routes {handler, data} per method served, in method-bit order
+// A node's methods are a bitmask; the route for a method is found by counting
+// the bits below it. A lookup touches a node, its edge bytes and a label per
+// edge, mostly on lines it just used, and nothing is freed or reallocated
+// behind it. Matching is router_lookup()'s: static edges before the param,
+// backtracking, a trailing slash ignored, 404 vs 405.
+
+#ifndef FLAT_ROUTER_H
+#define FLAT_ROUTER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Methods a flat router serves, one bit each
+static const char *const flat_router_methods[] = {"GET", "HEAD", "POST", "PUT", "DELETE",
+                                                  "PATCH", "OPTIONS", "CONNECT", "TRACE"};
+#define FLAT_ROUTER_METHOD_COUNT (sizeof(flat_router_methods) / sizeof(flat_router_methods[0]))
+
+typedef struct
+{
+    uint32_t label;       // offset in labels: the edge's bytes, or a param node's name
+    uint16_t label_len;
+    uint16_t child_count; // static children, nodes[children..children + child_count)
+    uint32_t children;    // first child; the ":name" child follows the static ones
+    uint16_t methods;     // bit per flat_router_methods entry served here
+    uint16_t has_param;
+    uint32_t routes;      // the route for the lowest method bit
+} flat_node_t;
+
+typedef struct
+{
+    request_handler_t handler;
+    void *data;
+} flat_route_t;
+
+typedef struct
+{
+    flat_node_t *nodes; // nodes[0] is the root
+    unsigned char *first;
+    char *labels;
+    flat_route_t *routes;
+    uint32_t node_count;
+    uint32_t route_count;
+} flat_router_t;
+
+/* The bit of a method, or 0 if it is not one a flat router serves. */
+static inline uint16_t flat_router_method_bit(const char *method, size_t len)
+{
+    int i;
+    switch (len)
+    {
+    case 3:
+        i = method[0] == 'G' ? 0 : 3;
+        break;
+    case 4:
+        i = method[0] == 'H' ? 1 : 2;
+        break;
+    case 5:
+        i = method[0] == 'P' ? 5 : 8;
+        break;
+    case 6:
+        i = 4;
+        break;
+    case 7:
+        i = method[0] == 'O' ? 6 : 7;
+        break;
+    default:
+        return 0;
+    }
+    return memcmp(method, flat_router_methods[i], len) == 0 ? (uint16_t)(1u << i) : 0;
+}
+
+static inline void flat_router_free(flat_router_t *f)
+{
+    free(f->nodes);
+    free(f->first);
+    free(f->labels);
+    free(f->routes);
+    memset(f, 0, sizeof(*f));
+}
+
+static int flat_router_cmp_first(const void *a, const void *b)
+{
+    return (unsigned char)(*(router_node_t *const *)a)->label[0] -
+           (unsigned char)(*(router_node_t *const *)b)->label[0];
+}
+
+/**
+ * Flattens a router. The router_t is not used afterwards and can be freed;
+ * route data pointers are copied as they are.
+ * @param f The flat router to fill.
+ * @param r A router whose routes are all registered.
+ * @return 0, or -1 if a route has a method outside flat_router_methods or if
+ *         out of memory.
+ */
+static inline int flat_router_build(flat_router_t *f, const router_t *r)
+{
+    memset(f, 0, sizeof(*f));
+    size_t cap = r->node_count, labels_len = 0, labels_cap = 256;
+    const router_node_t **queue = malloc(sizeof(*queue) * cap);
+    f->nodes = calloc(cap, sizeof(*f->nodes));
+    f->first = calloc(cap + 16, 1); // padded for 16-byte loads
+    f->labels = malloc(labels_cap);
+    f->routes = malloc(sizeof(*f->routes) * (r->route_count ? r->route_count : 1));
+    if (!queue || !f->nodes || !f->first || !f->labels || !f->routes)
+        goto fail;
+
+    queue[0] = &r->root;
+    size_t count = 1;
+    for (size_t i = 0; i < count; i++)
+    {
+        const router_node_t *src = queue[i];
+        flat_node_t *dst = &f->nodes[i];
+        if (count + src->child_count + (src->param != NULL) > cap)
+            goto fail;
+
+        // Children, sorted by first byte, then the param
+        dst->children = (uint32_t)count;
+        dst->child_count = (uint16_t)src->child_count;
+        dst->has_param = src->param != NULL;
+        if (src->child_count)
+            memcpy(queue + count, src->children, sizeof(*queue) * src->child_count);
+        qsort(queue + count, src->child_count, sizeof(*queue), flat_router_cmp_first);
+        for (size_t k = 0; k < src->child_count; k++)
+            f->first[count + k] = (unsigned char)queue[count + k]->label[0];
+        count += src->child_count;
+        if (src->param)
+            queue[count++] = src->param;
+
+        const char *label = src->param_name ? src->param_name : src->label;
+        size_t len = src->param_name ? src->param_name_len : src->label_len;
+        if (len > UINT16_MAX)
+            goto fail;
+        if (labels_len + len > labels_cap)
+        {
+            while (labels_len + len > labels_cap)
+                labels_cap *= 2;
+            char *labels = realloc(f->labels, labels_cap);
+            if (!labels)
+                goto fail;
+            f->labels = labels;
+        }
+        if (len)
+            memcpy(f->labels + labels_len, label, len);
+        dst->label = (uint32_t)labels_len;
+        dst->label_len = (uint16_t)len;
+        labels_len += len;
+
+        // Routes in method-bit order
+        dst->routes = f->route_count;
+        for (const router_route_t *route = src->routes; route; route = route->next)
+        {
+            uint16_t bit = flat_router_method_bit(route->method, route->method_len);
+            if (!bit)
+                goto fail;
+            dst->methods |= bit;
+        }
+        for (unsigned b = 0; b < FLAT_ROUTER_METHOD_COUNT; b++)
+            for (const router_route_t *route = src->routes; route; route = route->next)
+                if (flat_router_method_bit(route->method, route->method_len) == 1u << b)
+                    f->routes[f->route_count++] = (flat_route_t){route->handler, route->data};
+    }
+    f->node_count = (uint32_t)count;
+    free(queue);
+    return 0;
+
+fail:
+    free(queue);
+    flat_router_free(f);
+    return -1;
+}
+
+/* Index of c in the sorted edge bytes e[0..n), or -1. */
+static inline int flat_router_find(const unsigned char *e, unsigned n, unsigned char c)
+{
+#ifdef __SSE2__
+    // The bytes are padded, so a block may run past n: masked off
+    __m128i needle = _mm_set1_epi8((char)c);
+    for (unsigned i = 0; i < n; i += 16)
+    {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(e + i)), needle));
+        if (n - i < 16)
+            mask &= (1u << (n - i)) - 1;
+        if (mask)
+            return (int)(i + __builtin_ctz(mask));
+    }
+#else
+    for (unsigned i = 0; i < n && e[i] <= c; i++)
+        if (e[i] == c)
+            return (int)i;
+#endif
+    return -1;
+}
+
+static inline uint32_t flat_router_match(const flat_router_t *f, uint32_t i, const char *p, const char *end,
+                                         request_view_t *req)
+{
+    const flat_node_t *n = &f->nodes[i];
+    if (p == end)
+        return n->methods ? i : UINT32_MAX;
+    int k = flat_router_find(f->first + n->children, n->child_count, (unsigned char)*p);
+    if (k >= 0)
+    {
+        uint32_t c = n->children + (uint32_t)k;
+        const flat_node_t *child = &f->nodes[c];
+        if ((size_t)(end - p) >= child->label_len && memcmp(p, f->labels + child->label, child->label_len) == 0)
+        {
+            uint32_t found = flat_router_match(f, c, p + child->label_len, end, req);
+            if (found != UINT32_MAX)
+                return found;
+        }
+    }
+    if (n->has_param && *p != '/' && req->param_count < ROUTER_MAX_PARAMS)
+    {
+        uint32_t c = n->children + n->child_count;
+        const char *value_end = memchr(p, '/', end - p);
+        if (!value_end)
+            value_end = end;
+        route_param_t *param = &req->params[req->param_count++];
+        param->name.ptr = f->labels + f->nodes[c].label;
+        param->name.len = f->nodes[c].label_len;
+        param->value.ptr = p;
+        param->value.len = value_end - p;
+        uint32_t found = flat_router_match(f, c, value_end, end, req);
+        if (found != UINT32_MAX)
+            return found;
+        req->param_count--;
+    }
+    return UINT32_MAX;
+}
+
+/**
+ * Finds the route for a request and fills in its params, as router_lookup().
+ * @param f The flat router.
+ * @param req The request; its params are set on a match.
+ * @param path_found Set to whether any method is served at the path (to tell
+ *        404 from 405); may be NULL.
+ * @return The route, or NULL.
+ */
+static inline const flat_route_t *flat_router_lookup(const flat_router_t *f, request_view_t *req, int *path_found)
+{
+    req->param_count = 0;
+    const char *path = req->path.ptr;
+    uint32_t i = flat_router_match(f, 0, path, path + router_trim(path, req->path.len), req);
+    if (path_found)
+        *path_found = i != UINT32_MAX;
+    if (i == UINT32_MAX)
+        return NULL;
+    const flat_node_t *n = &f->nodes[i];
+    uint16_t bit = flat_router_method_bit(req->http->method.ptr, req->http->method.len);
+    if (!(n->methods & bit))
+    {
+        req->param_count = 0;
+        return NULL;
+    }
+    return &f->routes[n->routes + __builtin_popcount(n->methods & (bit - 1u))];
+}
+
+/**
+ * A request_handler_t over a flat router, as router_dispatch().
+ * @param data The flat_router_t.
+ * @param req The request.
+ * @param res The writer.
+ */
+static inline void flat_router_dispatch(void *data, request_view_t *req, response_writer_t *res)
+{
+    int path_found;
+    const flat_route_t *route = flat_router_lookup(data, req, &path_found);
+    if (route)
+        route->handler(route->data, req, res);
+    else if (path_found)
+        response_send(res, "405 Method Not Allowed", "text/plain", "Method Not Allowed", 18);
+    else
+        response_send(res, "404 Not Found", "text/plain", "Not Found", 9);
+}
+
+#endif
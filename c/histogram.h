@@ -0,0 +1,139 @@
+// histogram.h — Log-linear histogram of latencies (HdrHistogram's bucket layout)
+// Header-only, shared by the servers and benches in this directory: #include "histogram.h"
+//
+// Values below 2^HISTOGRAM_SUB_BITS get a bucket each; above that every power
+// of two is cut into 2^(HISTOGRAM_SUB_BITS - 1) equal buckets, so a bucket is
+// never wider than 1/128 of the values in it (0.8% with the default 8 bits)
+// and a percentile reads back within that of the value recorded. The bucket
+// of a value is one count-leading-zeros and a shift. Values at or above
+// 2^HISTOGRAM_MAX_BITS land in the last bucket: with nanoseconds, 2^40 is
+// over 18 minutes.
+//
+// One thread records into a histogram; any thread may read it while it does
+// (the counts are stored with relaxed atomics, which compile to plain moves),
+// so per-thread histograms are merged into a reader's copy without a lock.
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef HISTOGRAM_SUB_BITS
+#define HISTOGRAM_SUB_BITS 8
+#endif
+#ifndef HISTOGRAM_MAX_BITS
+#define HISTOGRAM_MAX_BITS 40
+#endif
+#define HISTOGRAM_HALF (1u << (HISTOGRAM_SUB_BITS - 1))
+#define HISTOGRAM_BUCKETS (HISTOGRAM_HALF * (HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 2) + 1) // + overflow
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+static inline void histogram_reset(histogram_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+static inline unsigned histogram_bucket(uint64_t v)
+{
+    if (v < 2 * HISTOGRAM_HALF)
+        return (unsigned)v;
+    if (v >> HISTOGRAM_MAX_BITS)
+        return HISTOGRAM_BUCKETS - 1;
+    unsigned shift = 63 - __builtin_clzll(v) - (HISTOGRAM_SUB_BITS - 1);
+    return HISTOGRAM_HALF * shift + (unsigned)(v >> shift);
+}
+
+/* The highest value that lands in bucket i. */
+static inline uint64_t histogram_bucket_max(unsigned i)
+{
+    if (i == HISTOGRAM_BUCKETS - 1)
+        return UINT64_MAX;
+    if (i < 2 * HISTOGRAM_HALF)
+        return i;
+    unsigned shift = i / HISTOGRAM_HALF - 1;
+    return ((uint64_t)(i % HISTOGRAM_HALF + HISTOGRAM_HALF + 1) << shift) - 1;
+}
+
+#define HISTOGRAM_LOAD(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define HISTOGRAM_STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+/**
+ * Records a value n times; only the histogram's owner calls this.
+ * @param h The histogram.
+ * @param v The value (nanoseconds, bytes...).
+ * @param n How many times it was seen.
+ */
+static inline void histogram_record_n(histogram_t *h, uint64_t v, uint64_t n)
+{
+    unsigned i = histogram_bucket(v);
+    HISTOGRAM_STORE(h->buckets[i], HISTOGRAM_LOAD(h->buckets[i]) + n);
+    HISTOGRAM_STORE(h->count, HISTOGRAM_LOAD(h->count) + n);
+    HISTOGRAM_STORE(h->sum, HISTOGRAM_LOAD(h->sum) + v * n);
+    if (v > HISTOGRAM_LOAD(h->max))
+        HISTOGRAM_STORE(h->max, v);
+}
+
+static inline void histogram_record(histogram_t *h, uint64_t v)
+{
+    histogram_record_n(h, v, 1);
+}
+
+/**
+ * Adds src's counts to dst; src may be recorded into meanwhile.
+ * @param dst The reader's histogram.
+ * @param src A histogram owned by another thread.
+ */
+static inline void histogram_add(histogram_t *dst, const histogram_t *src)
+{
+    for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++)
+        dst->buckets[i] += HISTOGRAM_LOAD(src->buckets[i]);
+    dst->count += HISTOGRAM_LOAD(src->count);
+    dst->sum += HISTOGRAM_LOAD(src->sum);
+    uint64_t max = HISTOGRAM_LOAD(src->max);
+    if (max > dst->max)
+        dst->max = max;
+}
+
+/**
+ * @param h The histogram (not being recorded into).
+ * @param percentile 0 to 100.
+ * @return The value at or below which percentile % of the values fall, rounded
+ *         up to its bucket's highest value; never above the largest recorded.
+ */
+static inline uint64_t histogram_percentile(const histogram_t *h, double percentile)
+{
+    uint64_t total = 0;
+    for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++)
+        total += h->buckets[i];
+    if (!total)
+        return 0;
+    uint64_t rank = (uint64_t)(percentile / 100 * total + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank)
+        {
+            uint64_t v = histogram_bucket_max(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+static inline double histogram_mean(const histogram_t *h)
+{
+    return h->count ? (double)h->sum / h->count : 0;
+}
+
+#endif
@@ -0,0 +1,448 @@
+// http_parser.h — Zero-copy incremental HTTP/1.1 request parser
+// Header-only, shared by the servers in this directory: #include "http_parser.h"
+//
+// Every field of http_request_t is a view (pointer + length) into the caller's
+// receive buffer: nothing is copied and nothing is allocated. The caller keeps
+// unconsumed bytes in its buffer between reads and calls http_parse_request()
+// again with the grown length. http_parser_t remembers how far the head was
+// already scanned, so a request split across many reads is scanned only once.
+//
+// Views stay valid until the caller moves or overwrites the buffer. After
+// consuming a request (or compacting the buffer) call http_parser_reset().
+
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+#include <string.h>
+
+#define HTTP_MAX_HEADERS 32
+
+#define HTTP_PARSE_ERROR -1
+#define HTTP_PARSE_INCOMPLETE -2
+
+typedef struct
+{
+    const char *ptr;
+    size_t len;
+} http_slice_t;
+
+typedef struct
+{
+    http_slice_t name;
+    http_slice_t value;
+} http_header_t;
+
+typedef struct
+{
+    http_slice_t method;
+    http_slice_t path;
+    int minor_version;
+    http_header_t headers[HTTP_MAX_HEADERS];
+    size_t num_headers;
+    size_t content_length;
+    http_slice_t body;
+    int keep_alive;
+} http_request_t;
+
+typedef struct
+{
+    size_t scanned; // bytes already searched for the end of the head
+} http_parser_t;
+
+/**
+ * Prepares a parser for a new request at the start of the buffer.
+ * @param parser The parser state to reset.
+ */
+static inline void http_parser_reset(http_parser_t *parser)
+{
+    parser->scanned = 0;
+}
+
+/**
+ * Compares a slice with a lowercase literal, ignoring ASCII case.
+ * @param s The slice to compare.
+ * @param lower The lowercase literal.
+ * @param lower_len Length of the literal.
+ * @return 1 if equal, 0 otherwise.
+ */
+static inline int http_slice_ieq(http_slice_t s, const char *lower, size_t lower_len)
+{
+    if (s.len != lower_len)
+        return 0;
+    for (size_t i = 0; i < lower_len; i++)
+    {
+        if ((s.ptr[i] | 0x20) != lower[i])
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Looks up a header by lowercase name.
+ * @param req The parsed request.
+ * @param lower The lowercase header name.
+ * @param lower_len Length of the name.
+ * @return Pointer to the header, or NULL if absent.
+ */
+static inline const http_header_t *http_find_header(const http_request_t *req, const char *lower, size_t lower_len)
+{
+    for (size_t i = 0; i < req->num_headers; i++)
+    {
+        if (http_slice_ieq(req->headers[i].name, lower, lower_len))
+            return &req->headers[i];
+    }
+    return NULL;
+}
+
+/* ================= Scanning ================= */
+
+// The three hot scans of a request head. Each has a scalar version and, on
+// x86, SSE4.2 and AVX2 versions; http_scanner points at the best one for the
+// running CPU, chosen once at startup.
+typedef struct
+{
+    const char *name;
+    // Returns a pointer just past the first "\r\n\r\n" at or after from, or NULL.
+    const char *(*head_end)(const char *buf, size_t len, size_t from);
+    // Returns the first CTL byte other than HTAB in [p, end), or end.
+    const char *(*value_end)(const char *p, const char *end);
+    // Returns the first CTL, SP, ':' or non-ASCII byte in [p, end), or end.
+    const char *(*name_end)(const char *p, const char *end);
+} http_scanner_t;
+
+static inline const char *http_head_end_scalar(const char *buf, size_t len, size_t from)
+{
+    for (size_t i = from; i + 3 < len; i++)
+    {
+        if (buf[i] == '\r' && buf[i + 1] == '\n' && buf[i + 2] == '\r' && buf[i + 3] == '\n')
+            return buf + i + 4;
+    }
+    return NULL;
+}
+
+static inline const char *http_value_end_scalar(const char *p, const char *end)
+{
+    for (; p < end; p++)
+    {
+        unsigned char ch = (unsigned char)*p;
+        if ((ch < 0x20 && ch != '\t') || ch == 0x7f)
+            break;
+    }
+    return p;
+}
+
+static inline const char *http_name_end_scalar(const char *p, const char *end)
+{
+    for (; p < end; p++)
+    {
+        unsigned char ch = (unsigned char)*p;
+        if (ch <= 0x20 || ch == ':' || ch >= 0x7f)
+            break;
+    }
+    return p;
+}
+
+static const http_scanner_t http_scanner_scalar = {
+    "scalar", http_head_end_scalar, http_value_end_scalar, http_name_end_scalar};
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+#define HTTP_SSE42 __attribute__((target("sse4.2")))
+#define HTTP_AVX2 __attribute__((target("avx2,sse4.2,bmi")))
+
+HTTP_SSE42 static const char *http_head_end_sse42(const char *buf, size_t len, size_t from)
+{
+    const __m128i crlfcrlf = _mm_setr_epi8('\r', '\n', '\r', '\n', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    size_t i = from;
+    while (i + 16 <= len)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        int idx = _mm_cmpestri(crlfcrlf, 4, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ORDERED);
+        if (idx == 16)
+            i += 16;
+        else if (idx <= 12)
+            return buf + i + idx + 4;
+        else
+            i += idx; // match cut by the block edge: reload from its start
+    }
+    return http_head_end_scalar(buf, len, i);
+}
+
+HTTP_SSE42 static const char *http_ranges_sse42(const char *p, const char *end, __m128i ranges, int nranges)
+{
+    while (end - p >= 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int idx = _mm_cmpestri(ranges, nranges, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES);
+        if (idx != 16)
+            return p + idx;
+        p += 16;
+    }
+    return p;
+}
+
+HTTP_SSE42 static const char *http_value_end_sse42(const char *p, const char *end)
+{
+    const __m128i ranges = _mm_setr_epi8(0x00, 0x08, 0x0a, 0x1f, 0x7f, 0x7f, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    return http_value_end_scalar(http_ranges_sse42(p, end, ranges, 6), end);
+}
+
+HTTP_SSE42 static const char *http_name_end_sse42(const char *p, const char *end)
+{
+    const __m128i ranges = _mm_setr_epi8(0x00, 0x20, ':', ':', 0x7f, (char)0xff, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    return http_name_end_scalar(http_ranges_sse42(p, end, ranges, 6), end);
+}
+
+// AVX2 tails go scalar: calling the legacy-SSE versions from VEX code costs
+// an SSE/AVX transition per call, which is slower than the scalar tail.
+HTTP_AVX2 static const char *http_head_end_avx2(const char *buf, size_t len, size_t from)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    size_t i = from;
+    for (; i + 35 <= len; i += 32)
+    {
+        const char *q = buf + i;
+        __m256i m = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)q), cr),
+                             _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(q + 1)), lf)),
+            _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(q + 2)), cr),
+                             _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(q + 3)), lf)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if (mask)
+            return q + _tzcnt_u32(mask) + 4;
+    }
+    return http_head_end_scalar(buf, len, i);
+}
+
+HTTP_AVX2 static const char *http_value_end_avx2(const char *p, const char *end)
+{
+    const __m256i us = _mm256_set1_epi8(0x1f);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    while (end - p >= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(v, us), v);
+        ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), ctl);
+        ctl = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, del));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(ctl);
+        if (mask)
+            return p + _tzcnt_u32(mask);
+        p += 32;
+    }
+    return http_value_end_scalar(p, end);
+}
+
+HTTP_AVX2 static const char *http_name_end_avx2(const char *p, const char *end)
+{
+    const __m256i sp = _mm256_set1_epi8(0x20);
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    while (end - p >= 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)p);
+        __m256i stop = _mm256_cmpeq_epi8(_mm256_min_epu8(v, sp), v);
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, colon));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(_mm256_max_epu8(v, del), v));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(stop);
+        if (mask)
+            return p + _tzcnt_u32(mask);
+        p += 32;
+    }
+    return http_name_end_scalar(p, end);
+}
+
+static const http_scanner_t http_scanner_sse42 = {
+    "sse4.2", http_head_end_sse42, http_value_end_sse42, http_name_end_sse42};
+static const http_scanner_t http_scanner_avx2 = {
+    "avx2", http_head_end_avx2, http_value_end_avx2, http_name_end_avx2};
+#endif
+
+static const http_scanner_t *http_scanner = &http_scanner_scalar;
+
+/**
+ * Runtime CPU dispatch: points http_scanner at the widest supported scanner.
+ * Runs before main, so worker threads only ever read the pointer.
+ */
+__attribute__((constructor)) static void http_scanner_init(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi"))
+        http_scanner = &http_scanner_avx2;
+    else if (__builtin_cpu_supports("sse4.2"))
+        http_scanner = &http_scanner_sse42;
+#endif
+}
+
+// RFC 9110 tchar: visible ASCII except separators.
+static inline int http_is_token_char(unsigned char ch)
+{
+    if (ch <= 0x20 || ch >= 0x7f)
+        return 0;
+    switch (ch)
+    {
+    case '"': case '(': case ')': case ',': case '/': case ':': case ';':
+    case '<': case '=': case '>': case '?': case '@': case '[': case '\\':
+    case ']': case '{': case '}':
+        return 0;
+    }
+    return 1;
+}
+
+static inline const char *http_parse_token(const char *p, const char *end, char delim, http_slice_t *out)
+{
+    const char *start = p;
+    while (p < end && http_is_token_char((unsigned char)*p))
+        p++;
+    if (p == start || p == end || *p != delim)
+        return NULL;
+    out->ptr = start;
+    out->len = (size_t)(p - start);
+    return p + 1;
+}
+
+static inline const char *http_parse_header_name(const char *p, const char *end, http_slice_t *out)
+{
+    const char *start = p;
+    p = http_scanner->name_end(p, end);
+    if (p == start || p == end || *p != ':')
+        return NULL;
+    for (const char *q = start; q < p; q++)
+    {
+        if (!http_is_token_char((unsigned char)*q))
+            return NULL;
+    }
+    out->ptr = start;
+    out->len = (size_t)(p - start);
+    return p + 1;
+}
+
+static inline int http_parse_content_length(http_slice_t v, size_t *out)
+{
+    if (v.len == 0)
+        return -1;
+    size_t n = 0;
+    for (size_t i = 0; i < v.len; i++)
+    {
+        unsigned d = (unsigned char)v.ptr[i] - '0';
+        if (d > 9 || n > ((size_t)-1 - d) / 10)
+            return -1;
+        n = n * 10 + d;
+    }
+    *out = n;
+    return 0;
+}
+
+/* ================= Parser ================= */
+
+/**
+ * Parses one request from the start of buf.
+ * @param parser Incremental state; reset it before the first call for a request.
+ * @param buf The receive buffer, holding the request at offset 0.
+ * @param len Number of valid bytes in buf.
+ * @param req Output; filled only when a full request is available.
+ * @return Total bytes of the request (head + body), HTTP_PARSE_INCOMPLETE if
+ *         more bytes are needed, or HTTP_PARSE_ERROR on a malformed request.
+ */
+static inline int http_parse_request(http_parser_t *parser, const char *buf, size_t len, http_request_t *req)
+{
+    size_t from = parser->scanned > 3 ? parser->scanned - 3 : 0;
+    const char *head_end = http_scanner->head_end(buf, len, from);
+    if (!head_end)
+    {
+        parser->scanned = len;
+        return HTTP_PARSE_INCOMPLETE;
+    }
+
+    const char *p = buf;
+    const char *end = head_end;
+
+    // Request line: method SP request-target SP HTTP/1.x CRLF
+    p = http_parse_token(p, end, ' ', &req->method);
+    if (!p)
+        return HTTP_PARSE_ERROR;
+
+    const char *path = p;
+    while (p < end && (unsigned char)*p > 0x20 && *p != 0x7f)
+        p++;
+    if (p == path || p == end || *p != ' ')
+        return HTTP_PARSE_ERROR;
+    req->path.ptr = path;
+    req->path.len = (size_t)(p - path);
+    p++;
+
+    if (end - p < 10 || memcmp(p, "HTTP/1.", 7) != 0 || p[7] < '0' || p[7] > '9' || p[8] != '\r' || p[9] != '\n')
+        return HTTP_PARSE_ERROR;
+    req->minor_version = p[7] - '0';
+    p += 10;
+
+    req->num_headers = 0;
+    req->content_length = 0;
+    req->keep_alive = req->minor_version >= 1;
+    int has_length = 0;
+
+    // Header fields: name ":" OWS value OWS CRLF, terminated by an empty line
+    while (!(p[0] == '\r' && p[1] == '\n'))
+    {
+        if (req->num_headers == HTTP_MAX_HEADERS)
+            return HTTP_PARSE_ERROR;
+        http_header_t *h = &req->headers[req->num_headers++];
+
+        p = http_parse_header_name(p, end, &h->name);
+        if (!p)
+            return HTTP_PARSE_ERROR;
+        while (*p == ' ' || *p == '\t')
+            p++;
+
+        const char *value = p;
+        p = http_scanner->value_end(p, end);
+        if (p == end || p[0] != '\r' || p[1] != '\n')
+            return HTTP_PARSE_ERROR;
+        const char *value_end = p;
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+            value_end--;
+        h->value.ptr = value;
+        h->value.len = (size_t)(value_end - value);
+        p += 2;
+
+        if (http_slice_ieq(h->name, "content-length", 14))
+        {
+            size_t length;
+            if (http_parse_content_length(h->value, &length) < 0)
+                return HTTP_PARSE_ERROR;
+            // Differing duplicates would frame the body two ways (RFC 9112 6.3)
+            if (has_length && length != req->content_length)
+                return HTTP_PARSE_ERROR;
+            req->content_length = length;
+            has_length = 1;
+        }
+        else if (http_slice_ieq(h->name, "connection", 10))
+        {
+            if (http_slice_ieq(h->value, "close", 5))
+                req->keep_alive = 0;
+            else if (http_slice_ieq(h->value, "keep-alive", 10))
+                req->keep_alive = 1;
+        }
+        else if (http_slice_ieq(h->name, "transfer-encoding", 17))
+        {
+            return HTTP_PARSE_ERROR; // chunked bodies are not supported
+        }
+    }
+
+    size_t head_len = (size_t)(head_end - buf);
+    if (req->content_length > len - head_len)
+    {
+        parser->scanned = head_len - 1; // resume right at the known head end
+        return HTTP_PARSE_INCOMPLETE;
+    }
+
+    req->body.ptr = head_end;
+    req->body.len = req->content_length;
+    return (int)(head_len + req->content_length);
+}
+
+#endif // HTTP_PARSER_H
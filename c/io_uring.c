@@ -3,45 +3,264 @@
 // Run with: ./iouring
 // Access with: curl -v http://localhost:8080/
 // wrk -c 512 -t 16 -d 15s http://localhost:8080/
-// Note: Requires Linux 5.10+ with io_uring and liburing installed.
+// Pipelined (wrk/scripts/pipeline.lua): wrk -c 512 -t 16 -d 15s -s pipeline.lua http://localhost:8080/ -- 16
+// Note: Requires Linux 6.0+ (multishot recv) with io_uring and liburing installed.
+//
+// Reads use one multishot recv per connection that picks buffers from a
+// per-worker provided-buffer ring. A buffer is handed back as soon as its
+// requests are counted, so an idle keep-alive connection owns no buffer at all
+// (conn_t fits in one cache line). Only a request split across reads
+// borrows a spill buffer until it is complete. With MAX_CONN per worker,
+// 16 workers hold 1M mostly-idle connections (ulimit -n accordingly).
+//
+// Connections live in a per-worker slab (conn_slab.h) mapped on the worker's
+// NUMA node once it is pinned: conn_t, the one line every completion touches,
+// in one array and the state of rarer paths (static files, zero-copy, timers)
+// in another. Connection ops carry a slot index and generation in user_data,
+// not a pointer, so a completion still in flight when its connection closes
+// resolves to nothing instead of the next connection in that slot. Churn it
+// with bench/conn_churn.c.
+//
+// Fixed mode: gcc -O3 -march=native -flto -pthread -DUSE_FIXED=1 iouring.c -luring -o iouring-fixed
+// Connections become direct descriptors (multishot accept into a sparse
+// registered file table, IOSQE_FIXED_FILE on every op) and the responses are
+// registered buffers, so recv/write skip fd lookups and page pinning. The
+// sparse table needs ulimit -n >= MAX_CONN. Compare both builds with:
+//   wrk -c 512 -t 16 -d 15s http://localhost:8080/
+//   wrk -c 10000 -t 16 -d 15s http://localhost:8080/   (ulimit -n 65536 on both ends)
+//
+// GET /large answers with a LARGE_BODY_SIZE body. Sends of ZC_THRESHOLD bytes
+// or more go out as IORING_OP_SEND_ZC: the kernel reads the pages in place and
+// posts a second, F_NOTIF CQE once it no longer needs them. A connection is not
+// recycled until all its notifications are in, and the shared response stays
+// immutable for the life of the process. Tune with -DZC_THRESHOLD=<bytes>.
+//
+// /static/<path> serves files below STATIC_ROOT (./public by default) through a
+// per-worker cache of open descriptors (static_files.h), with Range and
+// If-None-Match support. The head is sent like any response; the body moves
+// file -> pipe -> socket with two linked IORING_OP_SPLICEs per chunk, so file
+// pages are never copied to user space. Splice runs in io-wq, so each slow
+// client being served a file holds a kernel worker thread while it blocks.
+//
+// Each worker times out its connections with a timing wheel (timer_wheel.h)
+// indexed like the slab and ticked by one IORING_OP_TIMEOUT while any timer
+// is armed: keep-alive connections idle for IDLE_TIMEOUT_MS, partial requests
+// older than HEADER_TIMEOUT_MS and sends or splices that make no progress for
+// WRITE_TIMEOUT_MS are cancelled and the connection closed. Tune with -D.
+//
+// Steered build: gcc ... -DREUSEPORT_CBPF=1 iouring.c -luring -o iouring-steered
+// The kernel picks one of the per-CPU SO_REUSEPORT listeners by flow hash, so
+// a connection is usually accepted and served on another core than the one
+// whose softirq received it. This build attaches a classic BPF program to the
+// group that returns the current CPU as the socket index: the listeners are
+// created in CPU order, so accept, processing and softirq stay on one core
+// (best with RSS/RPS spreading flows over the cores). Compare both builds
+// with bench/connection_rate.c.
+//
+// Requests under /coro/ run coroutine handlers (coro.h): plain C that awaits
+// SQEs on the worker's ring and resumes on their CQEs, with frames from a
+// per-worker pool of CORO_MAX. /coro/file/<path> reads a small file below
+// STATIC_ROOT (openat2 + read); /coro/upstream relays the body a local
+// upstream on UPSTREAM_PORT answers to a GET. Their responses queue on the
+// connection like static ones, so pipelined answers keep their order, and a
+// handler still awaiting when the write timeout fires is cancelled.
+//
+// Each worker counts accepts, reads, writes, bytes, errors and ENOBUFS
+// retries, CQEs per wait and the latency from reading a request to its
+// response being sent (metrics.h); curl http://127.0.0.1:9100/metrics for
+// all workers in Prometheus text format. -DMETRICS_PORT=0 compiles it out.
+// Accept, read, dispatch and write complete are USDT probes (trace.h), and
+// with -DTRACE_RING=65536 each worker also logs them to a ring in memory,
+// dumped to trace-<pid>-<n>.bin by kill -USR1 (read it with trace_report.c).
 
 #define _GNU_SOURCE
 #include <arpa/inet.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <liburing.h>
+#include <linux/filter.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <pthread.h>
 #include <sched.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
 #include <unistd.h>
+#include "conn_slab.h"
+#include "coro.h"
+#include "http_parser.h"
+#include "metrics.h"
+#include "static_files.h"
+#include "timer_wheel.h"
+#include "trace.h"
 
 #define PORT 8080
 #define RING_ENTRIES 4096
-#define MAX_CONN 4096
-#define BUF_SIZE 1024
+#define MAX_CONN 65536
+#define BUF_SIZE 2048      /* provided buffer size */
+#define MAX_REQUEST 8192   /* spill buffer size: the largest request (head + body) */
+#define BR_ENTRIES 2048    /* provided buffers per worker (power of two) */
+#define SPILL_BUFS 1024    /* partial requests held at once per worker */
+#define BGID 0
+#define PIPELINE_MAX 64 /* responses coalesced into one send */
+#define OUT_RUNS 4      /* runs of identical owed answers tracked per conn */
+
+#ifndef ZC_THRESHOLD
+#define ZC_THRESHOLD (64 * 1024) /* sends at least this large use SEND_ZC */
+#endif
+#ifndef LARGE_BODY_SIZE
+#define LARGE_BODY_SIZE (1024 * 1024)
+#endif
+#define LARGE_PATH "/large"
+#define STATIC_PREFIX "/static/"
+#ifndef STATIC_ROOT
+#define STATIC_ROOT "public"
+#endif
+#define XFER_MAX 1024           /* static responses in progress per worker */
+#define XFER_PER_CONN 8         /* ... per connection (pipelined) */
+#define XFER_CHUNK (64 * 1024) /* bytes per splice pair: one default pipe */
+#define CORO_PREFIX "/coro/"
+#define CORO_MAX 128 /* coroutine frames per worker */
+#define CORO_BODY_MAX 3072 /* file or upstream body a /coro/ handler relays */
+#ifndef UPSTREAM_PORT
+#define UPSTREAM_PORT 9000 /* on 127.0.0.1 */
+#endif
+
+#define TIMER_TICK_MS 100
+#ifndef IDLE_TIMEOUT_MS
+#define IDLE_TIMEOUT_MS 60000 /* keep-alive, waiting for the next request */
+#endif
+#ifndef HEADER_TIMEOUT_MS
+#define HEADER_TIMEOUT_MS 10000 /* a request has started but is not complete */
+#endif
+#ifndef WRITE_TIMEOUT_MS
+#define WRITE_TIMEOUT_MS 30000 /* owed answers are not moving */
+#endif
+
+#define TIMER_NONE 0 /* also: progress was made, re-arm */
+#define TIMER_IDLE 1
+#define TIMER_HEADER 2
+#define TIMER_WRITE 3
+
+#ifndef REUSEPORT_CBPF
+#define REUSEPORT_CBPF 0
+#endif
+
+#ifndef USE_FIXED
+#define USE_FIXED 0
+#endif
 
 #define OP_ACCEPT 1
 #define OP_READ 2
 #define OP_WRITE 3
+#define OP_CLOSE 4
+#define OP_CANCEL 5
+#define OP_SPLICE_IN 6  /* file -> pipe */
+#define OP_SPLICE_OUT 7 /* pipe -> socket */
+#define OP_TIMER 8      /* timer wheel tick */
+#define OP_CORO 9       /* an op a coroutine handler awaits */
+
+/* Registered buffer indices (USE_FIXED) */
+#define BUF_IDX_RESP 0
+#define BUF_IDX_BAD 1
+#define BUF_IDX_LARGE 2
+#define BUF_IDX_XFER 3 /* every static response head */
+#define BUF_IDX_CORO 4 /* every coroutine response */
 
 #define PACK(op, ptr) ((((uint64_t)(op)) << 48) | (uint64_t)(uintptr_t)(ptr))
 #define OP(x) ((int)((x) >> 48))
 #define PTR(x) ((void *)(uintptr_t)((x) & 0x0000FFFFFFFFFFFFULL))
+/* Connection ops carry a slab handle (conn_slab.h), not the conn_t pointer */
+#define CONN_TAG(op, c) PACK(op, conn_slab_handle(&(c)->slot))
 
 static const char RESP[] =
     "HTTP/1.1 200 OK\r\n"
     "Content-Length: 2\r\n"
     "Connection: keep-alive\r\n"
     "\r\nOK";
+#define RESP_LEN (sizeof(RESP) - 1)
 
+/* RESP repeated PIPELINE_MAX times: n pipelined answers are its first n * RESP_LEN bytes */
+static char resp_batch[PIPELINE_MAX * RESP_LEN];
+
+/* Writable, so it can be registered as a fixed buffer */
+static char BAD_REQUEST[] =
+    "HTTP/1.1 400 Bad Request\r\n"
+    "Content-Length: 0\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+/* Head + LARGE_BODY_SIZE body, page aligned; built once in main, never written again */
+static char *large_resp;
+static size_t large_resp_len;
+
+#define KIND_OK 0
+#define KIND_LARGE 1
+#define KIND_XFER 2 /* one transfer each (file or coroutine response), queued on the conn in order */
+
+/*
+ * A static response in progress: the rendered head, then the file range moved
+ * through the pipe. The pipe is created on first use and kept when the
+ * transfer returns to the worker's pool. For a /coro/ request, the response is
+ * the frame's output instead, sent once its handler is done.
+ */
 typedef struct
 {
+    static_file_t *file; // body source, or NULL (HEAD, 304, errors)
+    off_t off;           // next file byte to move into the pipe
+    size_t left;         // file bytes not yet in the pipe
+    uint32_t in_pipe;    // bytes in the pipe not yet sent
+    uint16_t head_len;
+    uint8_t head_sent;
+    uint8_t splicing; // splices in flight
+    int next;         // next transfer queued on the same connection, or -1
+    int coro;         // frame of the handler rendering the response, or -1
+    int pipe[2];
+    char head[STATIC_HEAD_MAX];
+} xfer_t;
+
+/*
+ * Answers are static, so the output side of a connection is a short FIFO of
+ * runs (kind, count) of owed responses, optionally followed by one 400 before
+ * closing. This is the hot half of a connection's slab slot: what every
+ * completion on it reads or writes, in one cache line.
+ */
+typedef struct
+{
+    conn_slot_t slot;              // generation and index in the worker's slab
     int fd;
-    char buf[BUF_SIZE];
+    uint8_t recv_armed;            // multishot recv in flight
+    uint8_t writing;               // send in flight
+    uint8_t closing;               // read no more; release once owed answers are sent
+    uint8_t bad;                   // owe a 400 after the pending answers
+    uint8_t dead;                  // released; the slot is freed once nothing is in flight
+    uint8_t out_buf_index;         // registered buffer holding out (USE_FIXED)
+    uint8_t run_head;              // first owed run
+    uint8_t run_len;               // owed runs
+    uint8_t run_kind[OUT_RUNS];
+    uint16_t run_count[OUT_RUNS];
+    const char *out;               // unsent part of the in-flight response
+    uint32_t out_len;
+    int spill;                     // spill buffer holding a partial request, or -1
+    uint32_t spill_len;
+    http_parser_t parser;
 } conn_t;
 
+_Static_assert(sizeof(conn_t) == 64, "conn_t is one cache line");
+
+/* The cold half: state only static files, zero-copy sends and timeouts use. */
+typedef struct
+{
+    int xfer;            // first queued static response, or -1
+    uint16_t zc_notifs;  // SEND_ZC notifications still to come
+    uint8_t timer_state; // which timeout is armed
+    uint64_t burst_ns;   // metrics: pass that read the first request not yet answered, or 0
+} conn_cold_t;
+
 typedef struct
 {
     int cpu;
@@ -49,37 +268,265 @@ typedef struct
     struct io_uring ring;
     int listen_fd;
 
-    conn_t conns[MAX_CONN];
-    int free_stack[MAX_CONN];
-    int free_top;
+    conn_slab_t conns; // conn_t and conn_cold_t, on the worker's NUMA node
+
+    struct io_uring_buf_ring *br;
+    int br_mask;
+    int br_returned; // buffers added since the last advance
+    char bufs[BR_ENTRIES][BUF_SIZE];
+
+    char spill[SPILL_BUFS][MAX_REQUEST];
+    int spill_stack[SPILL_BUFS];
+    int spill_top;
+
+    static_cache_t static_cache;
+    xfer_t xfers[XFER_MAX];
+    int xfer_stack[XFER_MAX];
+    int xfer_top;
+
+    coro_t coros[CORO_MAX];
+    int coro_stack[CORO_MAX];
+    int coro_top;
+
+    timer_wheel_t timers;           // timer i belongs to conns slot i
+    struct __kernel_timespec tick;  // read by the kernel when the tick is submitted
+    int tick_armed;
+
+    worker_metrics_t metrics;
 } worker_t;
 
 /* ================= Pool ================= */
 
 static inline void pool_init(worker_t *w)
 {
-    w->free_top = 0;
-    for (int i = 0; i < MAX_CONN; i++)
-        w->free_stack[w->free_top++] = i;
+    w->spill_top = 0;
+    for (int i = 0; i < SPILL_BUFS; i++)
+        w->spill_stack[w->spill_top++] = i;
+    w->xfer_top = 0;
+    for (int i = XFER_MAX - 1; i >= 0; i--)
+    {
+        w->xfers[i].pipe[0] = w->xfers[i].pipe[1] = -1;
+        w->xfer_stack[w->xfer_top++] = i;
+    }
+    w->coro_top = 0;
+    for (int i = CORO_MAX - 1; i >= 0; i--)
+        w->coro_stack[w->coro_top++] = i;
 }
 
-static inline conn_t *conn_acquire(worker_t *w, int fd)
+static inline conn_cold_t *conn_cold(worker_t *w, conn_t *c)
+{
+    return conn_slab_cold(&w->conns, c->slot.index);
+}
+
+static inline void conn_init(worker_t *w, conn_t *c, int fd)
 {
-    if (!w->free_top)
-        return NULL;
-    conn_t *c = &w->conns[w->free_stack[--w->free_top]];
     c->fd = fd;
+    c->recv_armed = 0;
+    c->writing = 0;
+    c->closing = 0;
+    c->bad = 0;
+    c->dead = 0;
+    c->run_head = 0;
+    c->run_len = 0;
+    c->out_len = 0;
+    c->spill = -1;
+    c->spill_len = 0;
+    http_parser_reset(&c->parser);
+    conn_cold_t *cold = conn_cold(w, c);
+    cold->xfer = -1;
+    cold->zc_notifs = 0;
+    cold->timer_state = TIMER_NONE;
+    cold->burst_ns = 0;
+}
+
+static inline int spill_acquire(worker_t *w)
+{
+    return w->spill_top ? w->spill_stack[--w->spill_top] : -1;
+}
+
+static inline void spill_release(worker_t *w, conn_t *c)
+{
+    w->spill_stack[w->spill_top++] = c->spill;
+    c->spill = -1;
+    c->spill_len = 0;
+}
+
+/*
+ * Returns a frame to the pool. A handler still awaiting (its connection is
+ * gone) is cancelled instead: it runs through its error path when the op
+ * completes, and the frame returns then.
+ */
+static inline void coro_put(worker_t *w, coro_t *co)
+{
+    if (!coro_done(co))
+    {
+        co->owner = NULL;
+        co->cancelled = 1;
+        struct io_uring_sqe *sqe = io_uring_get_sqe(&w->ring);
+        io_uring_prep_cancel64(sqe, co->user_data, 0);
+        io_uring_sqe_set_data64(sqe, PACK(OP_CANCEL, 0));
+        return;
+    }
+    w->coro_stack[w->coro_top++] = (int)(co - w->coros);
+}
+
+/* Returns the connection's first transfer to the pool. */
+static inline void xfer_pop(worker_t *w, conn_t *c)
+{
+    conn_cold_t *cold = conn_cold(w, c);
+    xfer_t *x = &w->xfers[cold->xfer];
+    if (x->coro >= 0)
+        coro_put(w, &w->coros[x->coro]);
+    if (x->file)
+        static_file_put(&w->static_cache, x->file);
+    if (x->in_pipe)
+    {
+        /* Aborted mid-chunk: the leftover bytes would leak into the next response */
+        close(x->pipe[0]);
+        close(x->pipe[1]);
+        x->pipe[0] = x->pipe[1] = -1;
+    }
+    w->xfer_stack[w->xfer_top++] = cold->xfer;
+    cold->xfer = x->next;
+}
+
+#if USE_FIXED
+/* The kernel picks the file-table slot on accept; the slot is the conn index. */
+static inline conn_t *conn_acquire(worker_t *w, int slot)
+{
+    conn_t *c = conn_slab_claim(&w->conns, slot);
+    if (c)
+        conn_init(w, c, slot);
     return c;
 }
 
-static inline void conn_release(worker_t *w, conn_t *c)
+static inline void conn_free(worker_t *w, conn_t *c)
+{
+    if (c->spill >= 0)
+        spill_release(w, c);
+    while (conn_cold(w, c)->xfer >= 0)
+        xfer_pop(w, c);
+    conn_slab_retire(&w->conns, c); /* late CQEs for it are now stale */
+    /* The slot returns to the kernel's free list once the close completes */
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&w->ring);
+    io_uring_prep_close_direct(sqe, c->fd);
+    io_uring_sqe_set_data64(sqe, PACK(OP_CLOSE, 0));
+}
+
+/* Closes an accepted socket no conn could be had for: a direct descriptor too. */
+static inline void conn_refuse(worker_t *w, int slot)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&w->ring);
+    io_uring_prep_close_direct(sqe, slot);
+    io_uring_sqe_set_data64(sqe, PACK(OP_CLOSE, 0));
+}
+#else
+static inline conn_t *conn_acquire(worker_t *w, int fd)
 {
+    conn_t *c = conn_slab_alloc(&w->conns);
+    if (c)
+        conn_init(w, c, fd);
+    return c;
+}
+
+static inline void conn_free(worker_t *w, conn_t *c)
+{
+    if (c->spill >= 0)
+        spill_release(w, c);
+    while (conn_cold(w, c)->xfer >= 0)
+        xfer_pop(w, c);
     close(c->fd);
-    w->free_stack[w->free_top++] = (int)(c - w->conns);
+    conn_slab_free(&w->conns, c);
+}
+
+static inline void conn_refuse(worker_t *w, int fd)
+{
+    (void)w;
+    close(fd);
+}
+#endif
+
+/* ================= Provided buffers ================= */
+
+static int setup_buf_ring(worker_t *w)
+{
+    size_t size = BR_ENTRIES * sizeof(struct io_uring_buf);
+    w->br = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_SHARED, -1, 0);
+    if (w->br == MAP_FAILED)
+        return -1;
+    io_uring_buf_ring_init(w->br);
+
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (unsigned long)w->br,
+        .ring_entries = BR_ENTRIES,
+        .bgid = BGID};
+    if (io_uring_register_buf_ring(&w->ring, &reg, 0) < 0)
+        return -1;
+
+    w->br_mask = io_uring_buf_ring_mask(BR_ENTRIES);
+    for (int i = 0; i < BR_ENTRIES; i++)
+        io_uring_buf_ring_add(w->br, w->bufs[i], BUF_SIZE, i, w->br_mask, i);
+    io_uring_buf_ring_advance(w->br, BR_ENTRIES);
+    w->br_returned = 0;
+    return 0;
+}
+
+/* Queues a buffer back to the ring; published in bulk before the next submit. */
+static inline void buf_return(worker_t *w, int bid)
+{
+    io_uring_buf_ring_add(w->br, w->bufs[bid], BUF_SIZE, bid, w->br_mask, w->br_returned++);
 }
 
 /* ================= io_uring ops ================= */
 
+#if USE_FIXED
+static inline void prep_accept(struct io_uring *r, int fd)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(r);
+    io_uring_prep_multishot_accept_direct(sqe, fd, NULL, NULL, SOCK_NONBLOCK);
+    io_uring_sqe_set_data64(sqe, PACK(OP_ACCEPT, 0));
+}
+
+static inline void prep_read(struct io_uring *r, conn_t *c)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(r);
+    io_uring_prep_recv_multishot(sqe, c->fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BGID;
+    io_uring_sqe_set_data64(sqe, CONN_TAG(OP_READ, c));
+    c->recv_armed = 1;
+}
+
+static inline void prep_write(struct io_uring *r, conn_t *c)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(r);
+    if (c->out_len >= ZC_THRESHOLD)
+        io_uring_prep_send_zc_fixed(sqe, c->fd, c->out, c->out_len, 0, 0, c->out_buf_index);
+    else
+        io_uring_prep_write_fixed(sqe, c->fd, c->out, c->out_len, 0, c->out_buf_index);
+    sqe->flags |= IOSQE_FIXED_FILE;
+    io_uring_sqe_set_data64(sqe, CONN_TAG(OP_WRITE, c));
+    c->writing = 1;
+}
+
+#define SPLICE_SQE_FLAGS IOSQE_FIXED_FILE /* the socket (fd_out) is a direct descriptor */
+
+/* Sparse direct-descriptor table (one slot per conn) and the fixed buffers; returns 0 or -errno. */
+static int register_fixed(worker_t *w)
+{
+    int ret = io_uring_register_files_sparse(&w->ring, MAX_CONN);
+    if (ret < 0)
+        return ret;
+    struct iovec bufs[] = {
+        [BUF_IDX_RESP] = {resp_batch, sizeof(resp_batch)},
+        [BUF_IDX_BAD] = {BAD_REQUEST, sizeof(BAD_REQUEST)},
+        [BUF_IDX_LARGE] = {large_resp, large_resp_len},
+        [BUF_IDX_XFER] = {w->xfers, sizeof(w->xfers)},
+        [BUF_IDX_CORO] = {w->coros, sizeof(w->coros)},
+    };
+    return io_uring_register_buffers(&w->ring, bufs, sizeof(bufs) / sizeof(bufs[0]));
+}
+#else
 static inline void prep_accept(struct io_uring *r, int fd)
 {
     struct io_uring_sqe *sqe = io_uring_get_sqe(r);
@@ -90,15 +537,599 @@ static inline void prep_accept(struct io_uring *r, int fd)
 static inline void prep_read(struct io_uring *r, conn_t *c)
 {
     struct io_uring_sqe *sqe = io_uring_get_sqe(r);
-    io_uring_prep_recv(sqe, c->fd, c->buf, BUF_SIZE, 0);
-    io_uring_sqe_set_data64(sqe, PACK(OP_READ, c));
+    io_uring_prep_recv_multishot(sqe, c->fd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BGID;
+    io_uring_sqe_set_data64(sqe, CONN_TAG(OP_READ, c));
+    c->recv_armed = 1;
 }
 
 static inline void prep_write(struct io_uring *r, conn_t *c)
 {
     struct io_uring_sqe *sqe = io_uring_get_sqe(r);
-    io_uring_prep_send(sqe, c->fd, RESP, sizeof(RESP) - 1, 0);
-    io_uring_sqe_set_data64(sqe, PACK(OP_WRITE, c));
+    if (c->out_len >= ZC_THRESHOLD)
+        io_uring_prep_send_zc(sqe, c->fd, c->out, c->out_len, 0, 0);
+    else
+        io_uring_prep_send(sqe, c->fd, c->out, c->out_len, 0);
+    io_uring_sqe_set_data64(sqe, CONN_TAG(OP_WRITE, c));
+    c->writing = 1;
+}
+
+#define SPLICE_SQE_FLAGS 0
+#endif
+
+/*
+ * Moves the next piece of a file body: drains what a short send left in the
+ * pipe, or fills the pipe from the file and drains it with a linked pair. A
+ * short first splice breaks the link and the second completes -ECANCELED.
+ */
+static inline void prep_splice(struct io_uring *r, conn_t *c, xfer_t *x)
+{
+    struct io_uring_sqe *sqe;
+    unsigned n = x->in_pipe;
+    if (!n)
+    {
+        n = x->left < XFER_CHUNK ? x->left : XFER_CHUNK;
+        sqe = io_uring_get_sqe(r);
+        io_uring_prep_splice(sqe, x->file->fd, x->off, x->pipe[1], -1, n, 0);
+        sqe->flags |= IOSQE_IO_LINK;
+        io_uring_sqe_set_data64(sqe, CONN_TAG(OP_SPLICE_IN, c));
+        x->splicing++;
+    }
+    sqe = io_uring_get_sqe(r);
+    io_uring_prep_splice(sqe, x->pipe[0], -1, c->fd, -1, n, 0);
+    sqe->flags |= SPLICE_SQE_FLAGS;
+    io_uring_sqe_set_data64(sqe, CONN_TAG(OP_SPLICE_OUT, c));
+    x->splicing++;
+    c->writing = 1;
+}
+
+static inline void prep_cancel_read(struct io_uring *r, conn_t *c)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(r);
+    io_uring_prep_cancel64(sqe, CONN_TAG(OP_READ, c), 0);
+    io_uring_sqe_set_data64(sqe, PACK(OP_CANCEL, 0));
+}
+
+/* Cancels the send, or the splices, in flight on a connection. */
+static inline void prep_cancel_write(worker_t *w, conn_t *c)
+{
+    struct io_uring_sqe *sqe;
+    int xfer = conn_cold(w, c)->xfer;
+    if (xfer >= 0 && w->xfers[xfer].splicing)
+    {
+        sqe = io_uring_get_sqe(&w->ring);
+        io_uring_prep_cancel64(sqe, CONN_TAG(OP_SPLICE_IN, c), IORING_ASYNC_CANCEL_ALL);
+        io_uring_sqe_set_data64(sqe, PACK(OP_CANCEL, 0));
+        sqe = io_uring_get_sqe(&w->ring);
+        io_uring_prep_cancel64(sqe, CONN_TAG(OP_SPLICE_OUT, c), IORING_ASYNC_CANCEL_ALL);
+    }
+    else
+    {
+        sqe = io_uring_get_sqe(&w->ring);
+        io_uring_prep_cancel64(sqe, CONN_TAG(OP_WRITE, c), 0);
+    }
+    io_uring_sqe_set_data64(sqe, PACK(OP_CANCEL, 0));
+}
+
+static inline void prep_tick(worker_t *w)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&w->ring);
+    w->tick.tv_sec = 0;
+    w->tick.tv_nsec = TIMER_TICK_MS * 1000000LL;
+    io_uring_prep_timeout(sqe, &w->tick, 0, 0);
+    io_uring_sqe_set_data64(sqe, PACK(OP_TIMER, 0));
+    w->tick_armed = 1;
+}
+
+/*
+ * Closes a connection. A multishot recv outlives close(), so it is cancelled
+ * first; the slot is only reused after its last CQE (including SEND_ZC
+ * notifications), which keeps late completions from landing on a new
+ * connection.
+ */
+static inline void conn_release(worker_t *w, conn_t *c)
+{
+    if (!c->dead)
+    {
+        c->dead = 1;
+        timer_wheel_cancel(&w->timers, c->slot.index);
+        if (c->recv_armed)
+            prep_cancel_read(&w->ring, c);
+    }
+    if (!c->recv_armed && !c->writing && !conn_cold(w, c)->zc_notifs)
+        conn_free(w, c);
+}
+
+/* ================= Timeouts ================= */
+
+static inline uint32_t current_tick(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint32_t)((ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / TIMER_TICK_MS);
+}
+
+/* Marks that a request was parsed or bytes were sent: the timeout restarts. */
+static inline void conn_progress(worker_t *w, conn_t *c)
+{
+    conn_cold(w, c)->timer_state = TIMER_NONE;
+}
+
+/*
+ * Arms the timeout matching what a live connection waits for. It is pushed
+ * back only on a state change or progress, so trickling bytes does not extend
+ * a header or write deadline.
+ */
+static inline void conn_timer(worker_t *w, conn_t *c)
+{
+    static const uint32_t timeout_ms[] = {
+        [TIMER_IDLE] = IDLE_TIMEOUT_MS,
+        [TIMER_HEADER] = HEADER_TIMEOUT_MS,
+        [TIMER_WRITE] = WRITE_TIMEOUT_MS,
+    };
+    if (c->dead)
+        return;
+    conn_cold_t *cold = conn_cold(w, c);
+    uint8_t state = (c->writing || c->run_len || c->bad) ? TIMER_WRITE : c->spill >= 0 ? TIMER_HEADER : TIMER_IDLE;
+    if (state == cold->timer_state)
+        return;
+    timer_wheel_arm(&w->timers, c->slot.index, timeout_ms[state] / TIMER_TICK_MS);
+    cold->timer_state = state;
+}
+
+/* Timer wheel callback: cancels whatever the connection waits on and closes it. */
+static void conn_expire(void *arg, uint32_t i)
+{
+    worker_t *w = arg;
+    conn_t *c = conn_slab_hot(&w->conns, i);
+    if (c->writing)
+        prep_cancel_write(w, c);
+    conn_release(w, c);
+}
+
+/* ================= Coroutine handlers ================= */
+
+typedef struct
+{
+    int fd;
+    struct open_how how;
+    char path[STATIC_PATH_MAX];
+    char body[CORO_BODY_MAX + 1]; // one more: tells a file that is too large
+} coro_file_t;
+
+/* GET /coro/file/<path>: a small file below STATIC_ROOT, read with awaited openat2 and read. */
+static int coro_file(coro_t *co)
+{
+    worker_t *w = co->ctx;
+    coro_file_t *l = CORO_LOCALS(co, coro_file_t);
+    CORO_BEGIN(co);
+
+    const http_request_t *req = co->req;
+    const char *path = req->path.ptr + sizeof(CORO_PREFIX "file/") - 1;
+    size_t len = req->path.len - (sizeof(CORO_PREFIX "file/") - 1);
+    const char *query = memchr(path, '?', len);
+    if (query)
+        len = query - path;
+    if (w->static_cache.root_fd < 0 || !static_path_ok(path, len))
+    {
+        coro_respond(co, "404 Not Found", "text/plain", "Not Found", 9);
+        CORO_RETURN(co);
+    }
+    memcpy(l->path, path, len); /* the request is gone after the first await */
+    l->path[len] = '\0';
+    memset(&l->how, 0, sizeof(l->how));
+    l->how.flags = O_RDONLY | O_CLOEXEC;
+    l->how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+
+    CORO_AWAIT(co, io_uring_prep_openat2(coro_sqe(co), w->static_cache.root_fd, l->path, &l->how));
+    if (co->res < 0)
+    {
+        coro_respond(co, "404 Not Found", "text/plain", "Not Found", 9);
+        CORO_RETURN(co);
+    }
+    l->fd = co->res;
+    CORO_AWAIT(co, io_uring_prep_read(coro_sqe(co), l->fd, l->body, sizeof(l->body), 0));
+    close(l->fd);
+    if (co->res < 0 || co->res > CORO_BODY_MAX)
+        coro_respond(co, "500 Internal Server Error", "text/plain", "", 0);
+    else
+        coro_respond(co, "200 OK", static_content_type(l->path, strlen(l->path)), l->body, co->res);
+    CORO_END(co);
+}
+
+static const char UPSTREAM_REQUEST[] = "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\nConnection: close\r\n\r\n";
+
+typedef struct
+{
+    int fd;
+    uint32_t len;
+    struct sockaddr_in addr;
+    char buf[CORO_BODY_MAX + 512]; // the upstream's head and body
+} coro_upstream_t;
+
+/* GET /coro/upstream: connects to the upstream, sends a GET and relays the body of its answer. */
+static int coro_upstream(coro_t *co)
+{
+    coro_upstream_t *l = CORO_LOCALS(co, coro_upstream_t);
+    CORO_BEGIN(co);
+
+    l->len = 0;
+    l->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (l->fd < 0)
+    {
+        coro_respond(co, "502 Bad Gateway", "text/plain", "", 0);
+        CORO_RETURN(co);
+    }
+    l->addr.sin_family = AF_INET;
+    l->addr.sin_port = htons(UPSTREAM_PORT);
+    l->addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CORO_AWAIT(co, io_uring_prep_connect(coro_sqe(co), l->fd, (struct sockaddr *)&l->addr, sizeof(l->addr)));
+    if (co->res < 0)
+        goto fail;
+    CORO_AWAIT(co, io_uring_prep_send(coro_sqe(co), l->fd, UPSTREAM_REQUEST, sizeof(UPSTREAM_REQUEST) - 1,
+                                      MSG_NOSIGNAL));
+    if (co->res < 0)
+        goto fail;
+    do /* until the upstream closes */
+    {
+        CORO_AWAIT(co, io_uring_prep_recv(coro_sqe(co), l->fd, l->buf + l->len, sizeof(l->buf) - l->len, 0));
+        if (co->res > 0)
+            l->len += co->res;
+    } while (co->res > 0 && l->len < sizeof(l->buf));
+    if (co->res < 0)
+        goto fail;
+    close(l->fd);
+
+    const char *body = memmem(l->buf, l->len, "\r\n\r\n", 4);
+    if (!body || l->len - (body + 4 - l->buf) > CORO_BODY_MAX)
+    {
+        coro_respond(co, "502 Bad Gateway", "text/plain", "", 0);
+        CORO_RETURN(co);
+    }
+    body += 4;
+    coro_respond(co, "200 OK", "application/octet-stream", body, l->len - (body - l->buf));
+    CORO_RETURN(co);
+
+fail:
+    close(l->fd);
+    coro_respond(co, "502 Bad Gateway", "text/plain", "", 0);
+    CORO_END(co);
+}
+
+_Static_assert(sizeof(coro_file_t) <= CORO_LOCALS_SIZE, "coro_file_t must fit a frame");
+_Static_assert(sizeof(coro_upstream_t) <= CORO_LOCALS_SIZE, "coro_upstream_t must fit a frame");
+
+/* The handler for a /coro/ path, or NULL. */
+static coro_fn coro_route(const http_request_t *req)
+{
+    static const struct
+    {
+        const char *prefix;
+        coro_fn fn;
+    } routes[] = {
+        {CORO_PREFIX "file/", coro_file},
+        {CORO_PREFIX "upstream", coro_upstream},
+    };
+    for (size_t i = 0; i < sizeof(routes) / sizeof(routes[0]); i++)
+    {
+        size_t len = strlen(routes[i].prefix);
+        if (req->path.len >= len && memcmp(req->path.ptr, routes[i].prefix, len) == 0)
+            return routes[i].fn;
+    }
+    return NULL;
+}
+
+/* ================= HTTP ================= */
+
+/* Appends one owed answer; returns -1 when the run FIFO is full. */
+static inline int conn_owe(conn_t *c, uint8_t kind)
+{
+    if (c->run_len)
+    {
+        int last = (c->run_head + c->run_len - 1) % OUT_RUNS;
+        if (c->run_kind[last] == kind && c->run_count[last] < UINT16_MAX)
+        {
+            c->run_count[last]++;
+            return 0;
+        }
+    }
+    if (c->run_len == OUT_RUNS)
+        return -1;
+    int tail = (c->run_head + c->run_len) % OUT_RUNS;
+    c->run_kind[tail] = kind;
+    c->run_count[tail] = 1;
+    c->run_len++;
+    return 0;
+}
+
+/*
+ * Queues an empty transfer on the connection; returns it, or NULL when the
+ * worker or the connection has too many.
+ */
+static xfer_t *conn_queue_xfer(worker_t *w, conn_t *c)
+{
+    int queued = 0;
+    int *tail = &conn_cold(w, c)->xfer;
+    while (*tail >= 0)
+    {
+        tail = &w->xfers[*tail].next;
+        queued++;
+    }
+    if (queued == XFER_PER_CONN || !w->xfer_top || conn_owe(c, KIND_XFER) < 0)
+        return NULL;
+
+    int i = w->xfer_stack[--w->xfer_top];
+    xfer_t *x = &w->xfers[i];
+    x->file = NULL;
+    x->left = 0;
+    x->in_pipe = 0;
+    x->head_sent = 0;
+    x->splicing = 0;
+    x->next = -1;
+    x->coro = -1;
+    *tail = i;
+    return x;
+}
+
+/*
+ * Renders the response to a /static/ request into a transfer queued on the
+ * connection; returns -1 when the worker or the connection has too many.
+ */
+static int conn_queue_static(worker_t *w, conn_t *c, const http_request_t *req)
+{
+    xfer_t *x = conn_queue_xfer(w, c);
+    if (!x)
+        return -1;
+    const char *path = req->path.ptr + sizeof(STATIC_PREFIX) - 1;
+    size_t path_len = req->path.len - (sizeof(STATIC_PREFIX) - 1);
+    const char *query = memchr(path, '?', path_len);
+    if (query)
+        path_len = query - path;
+
+    x->head_len = static_respond(&w->static_cache, req, path, path_len, x->head, &x->file, &x->off, &x->left);
+    if (x->file && x->pipe[0] < 0 && pipe2(x->pipe, O_CLOEXEC) < 0)
+    {
+        static_file_put(&w->static_cache, x->file);
+        x->file = NULL;
+        x->left = 0;
+        x->head_len = snprintf(x->head, sizeof(x->head),
+                               "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+    }
+    return 0;
+}
+
+/*
+ * Starts the coroutine handler of a /coro/ request; its response is queued on
+ * the connection like a static one. Returns -1 when the worker or the
+ * connection has too many transfers.
+ */
+static int conn_queue_coro(worker_t *w, conn_t *c, const http_request_t *req, coro_fn fn)
+{
+    xfer_t *x = conn_queue_xfer(w, c);
+    if (!x)
+        return -1;
+    if (!w->coro_top)
+    {
+        x->head_len = snprintf(x->head, sizeof(x->head),
+                               "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n");
+        return 0;
+    }
+    x->coro = w->coro_stack[--w->coro_top];
+    coro_t *co = &w->coros[x->coro];
+    coro_start(co, fn, &w->ring, PACK(OP_CORO, co), w, c, req);
+    return 0;
+}
+
+/* Counts the complete requests at the start of buf; returns the bytes they use. */
+static inline size_t conn_parse(worker_t *w, conn_t *c, const char *buf, size_t len)
+{
+    http_request_t req;
+    size_t off = 0;
+    unsigned requests = 0;
+
+    while (off < len)
+    {
+        int n = http_parse_request(&c->parser, buf + off, len - off, &req);
+        if (n == HTTP_PARSE_INCOMPLETE)
+            break;
+        if (n == HTTP_PARSE_ERROR)
+        {
+            c->bad = 1;
+            c->closing = 1;
+            break;
+        }
+        int queued;
+        coro_fn handler;
+        trace_dispatch(conn_slab_handle(&c->slot), req.path.ptr, req.path.len);
+        if (req.path.len >= sizeof(STATIC_PREFIX) - 1 &&
+            memcmp(req.path.ptr, STATIC_PREFIX, sizeof(STATIC_PREFIX) - 1) == 0)
+            queued = conn_queue_static(w, c, &req);
+        else if ((handler = coro_route(&req)))
+            queued = conn_queue_coro(w, c, &req, handler);
+        else if (req.path.len == sizeof(LARGE_PATH) - 1 &&
+                 memcmp(req.path.ptr, LARGE_PATH, sizeof(LARGE_PATH) - 1) == 0)
+            queued = conn_owe(c, KIND_LARGE);
+        else
+            queued = conn_owe(c, KIND_OK);
+        if (queued < 0)
+        {
+            /* Too many alternating pipelined requests: answer those parsed and
+             * close; pipelining clients retry the rest (RFC 9112 9.3.2) */
+            c->closing = 1;
+            break;
+        }
+        off += n;
+        requests++;
+        conn_progress(w, c);
+        http_parser_reset(&c->parser);
+        if (!req.keep_alive)
+        {
+            c->closing = 1;
+            break;
+        }
+    }
+    if (requests)
+    {
+        metrics_add(&w->metrics, METRIC_REQUESTS, requests);
+        metrics_burst_begin(&w->metrics, &conn_cold(w, c)->burst_ns);
+    }
+    return off;
+}
+
+/*
+ * Feeds received bytes to a connection. Complete requests are parsed in place
+ * from the provided buffer; only a trailing partial request is copied, into a
+ * spill buffer that is returned as soon as that request completes.
+ */
+static void conn_feed(worker_t *w, conn_t *c, const char *data, size_t len)
+{
+    while (len && !c->closing)
+    {
+        if (c->spill < 0)
+        {
+            size_t used = conn_parse(w, c, data, len);
+            data += used;
+            len -= used;
+            if (!len || c->closing)
+                break;
+
+            c->spill = spill_acquire(w);
+            if (c->spill < 0)
+            {
+                /* Too many partial requests on this worker: shed the connection */
+                c->closing = 1;
+                break;
+            }
+            memcpy(w->spill[c->spill], data, len);
+            c->spill_len = len;
+            break;
+        }
+
+        char *sb = w->spill[c->spill];
+        size_t n = MAX_REQUEST - c->spill_len;
+        if (n > len)
+            n = len;
+        memcpy(sb + c->spill_len, data, n);
+        c->spill_len += n;
+        data += n;
+        len -= n;
+
+        size_t used = conn_parse(w, c, sb, c->spill_len);
+        if (used == c->spill_len)
+            spill_release(w, c);
+        else if (used)
+        {
+            memmove(sb, sb + used, c->spill_len - used);
+            c->spill_len -= used;
+        }
+        else if (c->spill_len == MAX_REQUEST)
+        {
+            /* Request larger than a spill buffer */
+            c->bad = 1;
+            c->closing = 1;
+        }
+    }
+}
+
+/* Marks n answers of the first run as sent. */
+static inline void conn_pop(conn_t *c, unsigned n)
+{
+    int head = c->run_head;
+    c->run_count[head] -= n;
+    if (!c->run_count[head])
+    {
+        c->run_head = (head + 1) % OUT_RUNS;
+        c->run_len--;
+    }
+}
+
+/* Sends the next batch of owed answers; releases a closing connection when done. */
+static inline void conn_flush(worker_t *w, conn_t *c)
+{
+    if (c->writing)
+        return;
+
+    while (c->run_len && c->run_kind[c->run_head] == KIND_XFER)
+    {
+        xfer_t *x = &w->xfers[conn_cold(w, c)->xfer];
+        if (!x->head_sent)
+        {
+            if (x->coro >= 0)
+            {
+                coro_t *co = &w->coros[x->coro];
+                if (!coro_done(co))
+                    return; /* its handler awaits I/O; coro_finish flushes again */
+                c->out = co->out;
+                c->out_len = co->out_len;
+                c->out_buf_index = BUF_IDX_CORO;
+            }
+            else
+            {
+                c->out = x->head;
+                c->out_len = x->head_len;
+                c->out_buf_index = BUF_IDX_XFER;
+            }
+            x->head_sent = 1;
+            prep_write(&w->ring, c);
+            return;
+        }
+        if (x->in_pipe || x->left)
+        {
+            prep_splice(&w->ring, c, x);
+            return;
+        }
+        xfer_pop(w, c);
+        conn_pop(c, 1);
+    }
+
+    if (c->run_len)
+    {
+        int head = c->run_head;
+        unsigned n = 1;
+        if (c->run_kind[head] == KIND_LARGE)
+        {
+            c->out = large_resp;
+            c->out_len = large_resp_len;
+            c->out_buf_index = BUF_IDX_LARGE;
+        }
+        else
+        {
+            n = c->run_count[head] < PIPELINE_MAX ? c->run_count[head] : PIPELINE_MAX;
+            c->out = resp_batch;
+            c->out_len = n * RESP_LEN;
+            c->out_buf_index = BUF_IDX_RESP;
+        }
+        conn_pop(c, n);
+    }
+    else if (c->bad)
+    {
+        c->bad = 0;
+        c->out = BAD_REQUEST;
+        c->out_len = sizeof(BAD_REQUEST) - 1;
+        c->out_buf_index = BUF_IDX_BAD;
+    }
+    else
+    {
+        metrics_burst_end(&w->metrics, &conn_cold(w, c)->burst_ns);
+        if (c->closing)
+            conn_release(w, c);
+        return;
+    }
+    prep_write(&w->ring, c);
+}
+
+/* A handler that awaited is done: send its response, or free an orphaned frame. */
+static void coro_finish(worker_t *w, coro_t *co)
+{
+    conn_t *c = co->owner;
+    if (!c)
+        coro_put(w, co);
+    else if (!c->dead)
+    {
+        conn_flush(w, c);
+        conn_timer(w, c);
+    }
 }
 
 /* ================= Worker ================= */
@@ -113,22 +1144,6 @@ static void *worker_main(void *arg)
     CPU_SET(w->cpu, &set);
     pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
 
-    /* Listener */
-    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
-    int one = 1;
-    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
-    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
-    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
-
-    struct sockaddr_in addr = {
-        .sin_family = AF_INET,
-        .sin_port = htons(PORT),
-        .sin_addr.s_addr = INADDR_ANY,
-    };
-    bind(fd, (void *)&addr, sizeof(addr));
-    listen(fd, 65535);
-    w->listen_fd = fd;
-
     /* io_uring */
     struct io_uring_params p = {0};
     p.flags = IORING_SETUP_SQPOLL | IORING_SETUP_SINGLE_ISSUER;
@@ -137,6 +1152,36 @@ static void *worker_main(void *arg)
     io_uring_queue_init_params(RING_ENTRIES, &w->ring, &p);
 
     pool_init(w);
+    char label[16];
+    snprintf(label, sizeof(label), "%d", w->cpu);
+    metrics_register(&w->metrics, label);
+    trace_register(label);
+    /* After pinning: the slab is mapped and faulted in on this CPU's node */
+    if (conn_slab_init(&w->conns, MAX_CONN, sizeof(conn_t), sizeof(conn_cold_t)) < 0)
+    {
+        perror("conn_slab_init");
+        exit(1);
+    }
+    if (timer_wheel_init(&w->timers, MAX_CONN, current_tick()) < 0)
+    {
+        perror("timer_wheel_init");
+        exit(1);
+    }
+    if (static_cache_init(&w->static_cache, STATIC_ROOT) < 0 && w->cpu == 0)
+        fprintf(stderr, "static root '%s' not found: /static/ answers 404\n", STATIC_ROOT);
+    if (setup_buf_ring(w) < 0)
+    {
+        perror("setup_buf_ring");
+        exit(1);
+    }
+#if USE_FIXED
+    int ret = register_fixed(w);
+    if (ret < 0)
+    {
+        fprintf(stderr, "register_fixed: %s\n", strerror(-ret));
+        exit(1);
+    }
+#endif
 
     prep_accept(&w->ring, w->listen_fd);
     io_uring_submit(&w->ring);
@@ -145,6 +1190,10 @@ static void *worker_main(void *arg)
     {
         struct io_uring_cqe *cqe;
         io_uring_wait_cqe(&w->ring, &cqe);
+        metrics_pass_begin(&w->metrics);
+        /* An empty wheel is not ticked: catch its clock up before arming (expires nothing) */
+        if (!w->timers.count)
+            timer_wheel_advance(&w->timers, current_tick(), conn_expire, w);
 
         unsigned head, count = 0;
         io_uring_for_each_cqe(&w->ring, head, cqe)
@@ -156,13 +1205,19 @@ static void *worker_main(void *arg)
             switch (OP(d))
             {
             case OP_ACCEPT:
+                metrics_add(&w->metrics, res >= 0 ? METRIC_ACCEPTS : METRIC_ERRORS, 1);
                 if (res >= 0)
                 {
                     conn_t *c = conn_acquire(w, res);
                     if (c)
+                    {
+                        trace_accept(conn_slab_handle(&c->slot), res);
                         prep_read(&w->ring, c);
+                        conn_progress(w, c);
+                        conn_timer(w, c);
+                    }
                     else
-                        close(res);
+                        conn_refuse(w, res);
                 }
                 if (!(cqe->flags & IORING_CQE_F_MORE))
                     prep_accept(&w->ring, w->listen_fd);
@@ -170,25 +1225,156 @@ static void *worker_main(void *arg)
 
             case OP_READ:
             {
-                conn_t *c = PTR(d);
-                if (res <= 0)
+                conn_t *c = conn_slab_get(&w->conns, d);
+                if (!c)
+                {
+                    /* Stale: the connection is gone; only its buffer needs handing back */
+                    if (cqe->flags & IORING_CQE_F_BUFFER)
+                        buf_return(w, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+                    break;
+                }
+                if (!(cqe->flags & IORING_CQE_F_MORE))
+                    c->recv_armed = 0;
+                if (res > 0)
+                {
+                    trace_read(conn_slab_handle(&c->slot), res);
+                    metrics_add(&w->metrics, METRIC_READS, 1);
+                    metrics_add(&w->metrics, METRIC_BYTES_IN, res);
+                }
+                else if (res == -ENOBUFS || res == -EAGAIN)
+                    metrics_add(&w->metrics, METRIC_EAGAIN, 1);
+                else if (res < 0 && res != -ECANCELED)
+                    metrics_add(&w->metrics, METRIC_ERRORS, 1);
+                if (cqe->flags & IORING_CQE_F_BUFFER)
+                {
+                    int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                    if (res > 0 && !c->dead)
+                        conn_feed(w, c, w->bufs[bid], res);
+                    buf_return(w, bid);
+                }
+
+                if (c->dead)
+                    conn_release(w, c); /* frees once nothing is in flight */
+                else if (res < 0 && res != -ENOBUFS)
                     conn_release(w, c);
                 else
-                    prep_write(&w->ring, c);
+                {
+                    if (res == 0)
+                        c->closing = 1; /* peer done: answer what it sent, then close */
+                    else if (!c->recv_armed && !c->closing)
+                        prep_read(&w->ring, c); /* multishot ended (e.g. ring ran dry) */
+                    conn_flush(w, c);
+                    conn_timer(w, c);
+                }
                 break;
             }
             case OP_WRITE:
             {
-                conn_t *c = PTR(d);
-                if (res < 0)
+                conn_t *c = conn_slab_get(&w->conns, d);
+                if (!c)
+                    break; /* stale */
+                if (cqe->flags & IORING_CQE_F_NOTIF)
+                {
+                    /* SEND_ZC: the kernel is done with the pages */
+                    conn_cold(w, c)->zc_notifs--;
+                    if (c->dead)
+                        conn_release(w, c);
+                    break;
+                }
+                if (cqe->flags & IORING_CQE_F_MORE)
+                    conn_cold(w, c)->zc_notifs++;
+                c->writing = 0;
+                if (res > 0)
+                {
+                    trace_write(conn_slab_handle(&c->slot), res);
+                    metrics_add(&w->metrics, METRIC_WRITES, 1);
+                    metrics_add(&w->metrics, METRIC_BYTES_OUT, res);
+                }
+                else if (res < 0 && res != -ECANCELED)
+                    metrics_add(&w->metrics, METRIC_ERRORS, 1);
+                if (c->dead || res < 0)
+                {
                     conn_release(w, c);
+                    break;
+                }
+                if (res > 0)
+                    conn_progress(w, c);
+                if ((size_t)res < c->out_len)
+                {
+                    /* Short send: queue the rest */
+                    c->out += res;
+                    c->out_len -= res;
+                    prep_write(&w->ring, c);
+                }
                 else
-                    prep_read(&w->ring, c);
+                    conn_flush(w, c);
+                conn_timer(w, c);
                 break;
             }
+            case OP_SPLICE_IN:
+            case OP_SPLICE_OUT:
+            {
+                conn_t *c = conn_slab_get(&w->conns, d);
+                if (!c)
+                    break; /* stale */
+                xfer_t *x = &w->xfers[conn_cold(w, c)->xfer];
+                x->splicing--;
+                if (res > 0 && OP(d) == OP_SPLICE_IN)
+                {
+                    x->in_pipe += res;
+                    x->off += res;
+                    x->left -= res;
+                }
+                else if (res > 0)
+                {
+                    x->in_pipe -= res;
+                    conn_progress(w, c);
+                    trace_write(conn_slab_handle(&c->slot), res);
+                    metrics_add(&w->metrics, METRIC_WRITES, 1);
+                    metrics_add(&w->metrics, METRIC_BYTES_OUT, res);
+                }
+                else if (res != -ECANCELED && !c->dead)
+                {
+                    metrics_add(&w->metrics, METRIC_ERRORS, 1);
+                    conn_release(w, c); /* socket error, or the file shrank */
+                }
+                if (x->splicing)
+                    break;
+                c->writing = 0;
+                if (c->dead)
+                    conn_release(w, c);
+                else
+                {
+                    conn_flush(w, c);
+                    conn_timer(w, c);
+                }
+                break;
+            }
+            case OP_CORO:
+            {
+                coro_t *co = PTR(d);
+                if (coro_resume(co, res) == CORO_DONE)
+                    coro_finish(w, co);
+                break;
+            }
+            case OP_TIMER:
+                w->tick_armed = 0;
+                break;
+            case OP_CLOSE:
+            case OP_CANCEL:
+                break;
             }
         }
         io_uring_cq_advance(&w->ring, count);
+        metrics_pass_end(&w->metrics, count);
+        timer_wheel_advance(&w->timers, current_tick(), conn_expire, w);
+        if (w->timers.count && !w->tick_armed)
+            prep_tick(w);
+        if (w->br_returned)
+        {
+            io_uring_buf_ring_advance(w->br, w->br_returned);
+            w->br_returned = 0;
+        }
         io_uring_submit(&w->ring);
     }
     return NULL;
@@ -196,11 +1382,86 @@ static void *worker_main(void *arg)
 
 /* ================= Main ================= */
 
+/* One worker's SO_REUSEPORT listener; joins the port's group in call order. */
+static int listen_socket(void)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(PORT),
+        .sin_addr.s_addr = INADDR_ANY,
+    };
+    bind(fd, (void *)&addr, sizeof(addr));
+    listen(fd, 65535);
+    return fd;
+}
+
+#if REUSEPORT_CBPF
+/*
+ * Makes the group pick listener number (current CPU % n) for each new
+ * connection. The program runs in the softirq handling the SYN, so "current
+ * CPU" is the core that received it.
+ */
+static int attach_reuseport_cbpf(int fd, int n)
+{
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU}, /* A = cpu */
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, n},                     /* A %= n */
+        {BPF_RET | BPF_A, 0, 0, 0},                               /* socket index */
+    };
+    struct sock_fprog prog = {
+        .len = sizeof(code) / sizeof(code[0]),
+        .filter = code,
+    };
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+#endif
+
 int main(void)
 {
     int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
-    worker_t *workers = calloc(ncpu, sizeof(worker_t));
+    /* Aligned: each worker's metrics start on their own cache line */
+    worker_t *workers = aligned_alloc(_Alignof(worker_t), ncpu * sizeof(worker_t));
+    memset(workers, 0, ncpu * sizeof(worker_t));
+
+    /* Peer resets must surface as -EPIPE CQEs, not kill the process */
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int i = 0; i < PIPELINE_MAX; i++)
+        memcpy(resp_batch + i * RESP_LEN, RESP, RESP_LEN);
+
+    char head[128];
+    int head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.1 200 OK\r\n"
+                            "Content-Type: application/octet-stream\r\n"
+                            "Content-Length: %d\r\n"
+                            "Connection: keep-alive\r\n"
+                            "\r\n",
+                            LARGE_BODY_SIZE);
+    large_resp_len = head_len + LARGE_BODY_SIZE;
+    large_resp = aligned_alloc(4096, (large_resp_len + 4095) & ~(size_t)4095);
+    memcpy(large_resp, head, head_len);
+    memset(large_resp + head_len, 'x', LARGE_BODY_SIZE);
+
+    /* Created here, in CPU order, so listener i of the group is worker i's */
+    for (int i = 0; i < ncpu; i++)
+        workers[i].listen_fd = listen_socket();
+#if REUSEPORT_CBPF
+    if (attach_reuseport_cbpf(workers[0].listen_fd, ncpu) < 0)
+    {
+        perror("SO_ATTACH_REUSEPORT_CBPF");
+        exit(1);
+    }
+#endif
 
+    /* Before any thread starts: they inherit SIGUSR1 blocked */
+    trace_start();
+    metrics_start();
     for (int i = 0; i < ncpu; i++)
     {
         workers[i].cpu = i;
@@ -0,0 +1,327 @@
+// metrics.h — Per-worker counters and latency histograms, scraped in Prometheus text format
+// Header-only, shared by the servers in this directory: #include "metrics.h"
+//
+// Each worker owns a worker_metrics_t and is the only thread writing it:
+// counters are bumped with relaxed loads and stores (plain moves, no lock
+// prefix) and the struct is cache-line aligned, so workers never share a line.
+// metrics_start() runs an admin thread answering GET /metrics on
+// 127.0.0.1:METRICS_PORT; a scrape sums the counters and merges the
+// histograms of every registered worker into its own copy while the workers
+// keep running, with no lock and nothing for them to wait on.
+//
+// The clock is read twice per event-loop pass (after the wait returns and
+// before the next wait), never per request. A burst of requests on a
+// connection is stamped with the pass that read its first request and timed
+// when its last response is sent, to the end of that pass: latency is read
+// to fully sent, at pass resolution. Bursts a pass finishes mostly share a
+// start stamp, so they go into the histogram as one value and a count.
+// Each pass also records how many events (epoll_wait) or CQEs (io_uring) it
+// handled.
+//
+// Build with -DMETRICS_PORT=0 to compile it all out. bench/metrics_bench.c
+// measures what the calls cost per request.
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "histogram.h"
+
+#ifndef METRICS_PORT
+#define METRICS_PORT 9100 /* 0: no metrics */
+#endif
+#define METRICS_MAX_WORKERS 256
+#define METRICS_PASS_MAX 256 /* distinct burst starts timed per pass; more are timed to the pass start */
+
+enum
+{
+    METRIC_ACCEPTS,
+    METRIC_READS,     // recv calls or completions that returned data
+    METRIC_WRITES,    // send calls or completions that sent data
+    METRIC_BYTES_IN,
+    METRIC_BYTES_OUT,
+    METRIC_REQUESTS,  // parsed
+    METRIC_ERRORS,    // failed socket ops (the connection is closed)
+    METRIC_EAGAIN,    // EAGAIN, or ENOBUFS from an empty provided-buffer ring
+    METRIC_COUNT
+};
+
+#if METRICS_PORT
+
+static const char *const metric_names[METRIC_COUNT] = {
+    "accepts", "reads", "writes", "bytes_in", "bytes_out", "requests", "errors", "eagain",
+};
+
+typedef struct
+{
+    _Alignas(64) uint64_t counters[METRIC_COUNT];
+    char label[16]; // worker="..." in the scrape
+    histogram_t latency; // ns
+    histogram_t batch;   // events or CQEs per pass
+    // Owner only
+    _Alignas(64) uint64_t pass_ns;
+    unsigned done_count;
+    struct
+    {
+        uint64_t start; // stamp of the pass that read their first request
+        uint64_t n;     // bursts finished this pass with that stamp, one after the other
+    } done[METRICS_PASS_MAX];
+} worker_metrics_t;
+
+static worker_metrics_t *metrics_workers[METRICS_MAX_WORKERS];
+static int metrics_worker_count;
+
+static inline uint64_t metrics_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Clears a worker's metrics and adds them to the scrape.
+ * @param m The worker's metrics; must outlive the process's scrapes.
+ * @param label Its worker label (CPU number, "acceptor"...).
+ * @return 0 on success, -1 when METRICS_MAX_WORKERS are registered.
+ */
+static inline int metrics_register(worker_metrics_t *m, const char *label)
+{
+    memset(m, 0, sizeof(*m));
+    snprintf(m->label, sizeof(m->label), "%s", label);
+    int i = __atomic_fetch_add(&metrics_worker_count, 1, __ATOMIC_RELAXED);
+    if (i >= METRICS_MAX_WORKERS)
+        return -1;
+    __atomic_store_n(&metrics_workers[i], m, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static inline void metrics_add(worker_metrics_t *m, int counter, uint64_t n)
+{
+    HISTOGRAM_STORE(m->counters[counter], HISTOGRAM_LOAD(m->counters[counter]) + n);
+}
+
+/* Stamps a pass; call once its wait returns. */
+static inline void metrics_pass_begin(worker_metrics_t *m)
+{
+    m->pass_ns = metrics_now_ns();
+}
+
+/* A request was read on a connection: opens a burst unless one is open (*start != 0). */
+static inline void metrics_burst_begin(worker_metrics_t *m, uint64_t *start)
+{
+    if (!*start)
+        *start = m->pass_ns;
+}
+
+/* Everything owed on a connection is sent: closes its burst, if one is open. */
+static inline void metrics_burst_end(worker_metrics_t *m, uint64_t *start)
+{
+    if (!*start)
+        return;
+    unsigned last = m->done_count - 1;
+    if (m->done_count && m->done[last].start == *start)
+        m->done[last].n++;
+    else if (m->done_count < METRICS_PASS_MAX)
+        m->done[m->done_count++] = (__typeof__(m->done[0])){*start, 1};
+    else
+        histogram_record(&m->latency, m->pass_ns - *start);
+    *start = 0;
+}
+
+/**
+ * Ends a pass: times the bursts it finished and records its batch size.
+ * @param m The worker's metrics.
+ * @param events Events or CQEs the pass handled.
+ */
+static inline void metrics_pass_end(worker_metrics_t *m, unsigned events)
+{
+    if (m->done_count)
+    {
+        uint64_t now = metrics_now_ns();
+        for (unsigned i = 0; i < m->done_count; i++)
+            histogram_record_n(&m->latency, now - m->done[i].start, m->done[i].n);
+        m->done_count = 0;
+    }
+    histogram_record(&m->batch, events);
+}
+
+/* Writes h as a Prometheus histogram: cumulative counts at each bound, in unit per value. */
+static inline void metrics_print_histogram(FILE *out, const char *name, const histogram_t *h, const double *le,
+                                           int le_count, double unit)
+{
+    uint64_t cumulative = 0;
+    unsigned i = 0;
+    for (int b = 0; b < le_count; b++)
+    {
+        // A histogram bucket counts at the first bound its highest value fits under
+        for (; i < HISTOGRAM_BUCKETS && histogram_bucket_max(i) * unit <= le[b]; i++)
+            cumulative += h->buckets[i];
+        fprintf(out, "%s_bucket{le=\"%g\"} %llu\n", name, le[b], (unsigned long long)cumulative);
+    }
+    for (; i < HISTOGRAM_BUCKETS; i++)
+        cumulative += h->buckets[i];
+    fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %g\n%s_count %llu\n", name, (unsigned long long)cumulative,
+            name, h->sum * unit, name, (unsigned long long)cumulative);
+}
+
+/**
+ * Writes every registered worker's metrics in Prometheus text format:
+ * counters per worker, histograms merged over all of them.
+ * @param out Where to write.
+ */
+static inline void metrics_print(FILE *out)
+{
+    static const double latency_le[] = {1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3,
+                                        2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1};
+    static const double batch_le[] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024};
+    // Only the admin thread scrapes; too big for its stack
+    static histogram_t latency, batch;
+    histogram_reset(&latency);
+    histogram_reset(&batch);
+
+    int n = __atomic_load_n(&metrics_worker_count, __ATOMIC_RELAXED);
+    if (n > METRICS_MAX_WORKERS)
+        n = METRICS_MAX_WORKERS;
+    for (int c = 0; c < METRIC_COUNT; c++)
+    {
+        fprintf(out, "# TYPE server_%s_total counter\n", metric_names[c]);
+        for (int i = 0; i < n; i++)
+        {
+            worker_metrics_t *m = __atomic_load_n(&metrics_workers[i], __ATOMIC_ACQUIRE);
+            if (m)
+                fprintf(out, "server_%s_total{worker=\"%s\"} %llu\n", metric_names[c], m->label,
+                        (unsigned long long)HISTOGRAM_LOAD(m->counters[c]));
+        }
+    }
+    for (int i = 0; i < n; i++)
+    {
+        worker_metrics_t *m = __atomic_load_n(&metrics_workers[i], __ATOMIC_ACQUIRE);
+        if (m)
+        {
+            histogram_add(&latency, &m->latency);
+            histogram_add(&batch, &m->batch);
+        }
+    }
+    fputs("# TYPE server_request_latency_seconds histogram\n", out);
+    metrics_print_histogram(out, "server_request_latency_seconds", &latency, latency_le,
+                            sizeof(latency_le) / sizeof(latency_le[0]), 1e-9);
+    fputs("# TYPE server_batch_events histogram\n", out);
+    metrics_print_histogram(out, "server_batch_events", &batch, batch_le, sizeof(batch_le) / sizeof(batch_le[0]),
+                            1);
+}
+
+static void *metrics_serve(void *arg)
+{
+    int listen_fd = (int)(intptr_t)arg;
+    static const char not_found[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    while (1)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        char req[1024];
+        ssize_t len = recv(fd, req, sizeof(req) - 1, 0);
+        if (len > 0 && (size_t)len >= sizeof("GET /metrics") - 1 &&
+            memcmp(req, "GET /metrics", sizeof("GET /metrics") - 1) == 0)
+        {
+            char *body;
+            size_t body_len;
+            FILE *out = open_memstream(&body, &body_len);
+            if (out)
+            {
+                metrics_print(out);
+                fclose(out);
+                char head[160];
+                int head_len = snprintf(head, sizeof(head),
+                                        "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                        "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                                        body_len);
+                send(fd, head, head_len, MSG_NOSIGNAL | MSG_MORE);
+                send(fd, body, body_len, MSG_NOSIGNAL);
+                free(body);
+            }
+        }
+        else if (len > 0)
+            send(fd, not_found, sizeof(not_found) - 1, MSG_NOSIGNAL);
+        close(fd);
+    }
+    return NULL;
+}
+
+/**
+ * Starts the admin thread serving /metrics on 127.0.0.1:METRICS_PORT. The
+ * server runs on without it if the port is taken.
+ * @return 0 on success, -1 on failure (reported on stderr).
+ */
+static inline int metrics_start(void)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(METRICS_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    pthread_t tid;
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0 ||
+        pthread_create(&tid, NULL, metrics_serve, (void *)(intptr_t)fd) != 0)
+    {
+        perror("metrics");
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+#else
+
+typedef struct
+{
+    char unused;
+} worker_metrics_t;
+
+static inline int metrics_register(worker_metrics_t *m, const char *label)
+{
+    (void)m;
+    (void)label;
+    return 0;
+}
+static inline void metrics_add(worker_metrics_t *m, int counter, uint64_t n)
+{
+    (void)m;
+    (void)counter;
+    (void)n;
+}
+static inline void metrics_pass_begin(worker_metrics_t *m) { (void)m; }
+static inline void metrics_burst_begin(worker_metrics_t *m, uint64_t *start)
+{
+    (void)m;
+    (void)start;
+}
+static inline void metrics_burst_end(worker_metrics_t *m, uint64_t *start)
+{
+    (void)m;
+    (void)start;
+}
+static inline void metrics_pass_end(worker_metrics_t *m, unsigned events)
+{
+    (void)m;
+    (void)events;
+}
+static inline int metrics_start(void) { return 0; }
+
+#endif
+
+#endif
@@ -0,0 +1,278 @@
+// mpmc_queue.h — Bounded lock-free multi-producer multi-consumer queue of fds
+// Header-only, shared by the servers in this directory: #include "mpmc_queue.h"
+//
+// Dmitry Vyukov's bounded MPMC ring: every cell carries a sequence number that
+// says whose turn it is, so a producer or consumer claims a position with one
+// CAS on its index and then owns the cell outright; there is no lock and the
+// two ends only share cache lines through the cells themselves. Consumers that
+// find it empty spin for a while (adapting how long to how often spinning paid
+// off; not at all on a single CPU) and then sleep on a futex, with an optional
+// timeout so idle pool threads can leave. Producers only pay for a wake-up
+// when someone is asleep and no wake-up is already on its way; a woken
+// consumer passes the wake-up on if values are left.
+
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MPMC_CACHE_LINE 64
+#define MPMC_SPIN_MIN 16
+#define MPMC_SPIN_MAX 4096 /* ~ a few us before going to sleep */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define mpmc_cpu_relax() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define mpmc_cpu_relax() __asm__ __volatile__("yield")
+#else
+#define mpmc_cpu_relax() ((void)0)
+#endif
+
+typedef struct
+{
+    atomic_size_t seq;
+    int value;
+} mpmc_cell_t;
+
+typedef struct
+{
+    _Alignas(MPMC_CACHE_LINE) atomic_size_t head; // next position to pop
+    _Alignas(MPMC_CACHE_LINE) atomic_size_t tail; // next position to push
+    _Alignas(MPMC_CACHE_LINE) atomic_uint wake_seq; // futex word, bumped on each wake-up
+    atomic_int sleepers;                            // consumers in (or entering) futex_wait
+    atomic_int waking;                              // a woken consumer has not run yet
+    _Alignas(MPMC_CACHE_LINE) size_t mask;
+    mpmc_cell_t *cells;
+} mpmc_queue_t;
+
+/**
+ * Allocates an empty queue.
+ * @param q The queue.
+ * @param capacity Number of cells; must be a power of two (>= 2).
+ * @return 0 on success, -1 on a bad capacity or if out of memory.
+ */
+static inline int mpmc_queue_init(mpmc_queue_t *q, size_t capacity)
+{
+    if (capacity < 2 || (capacity & (capacity - 1)))
+        return -1;
+    q->cells = aligned_alloc(MPMC_CACHE_LINE, (capacity * sizeof(mpmc_cell_t) + MPMC_CACHE_LINE - 1) &
+                                                  ~(size_t)(MPMC_CACHE_LINE - 1));
+    if (!q->cells)
+        return -1;
+    for (size_t i = 0; i < capacity; i++)
+        atomic_init(&q->cells[i].seq, i);
+    q->mask = capacity - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->wake_seq, 0);
+    atomic_init(&q->sleepers, 0);
+    atomic_init(&q->waking, 0);
+    return 0;
+}
+
+static inline void mpmc_queue_destroy(mpmc_queue_t *q)
+{
+    free(q->cells);
+    q->cells = NULL;
+}
+
+/* Wakes one sleeping consumer unless one is already being woken. */
+static inline void mpmc_queue_wake(mpmc_queue_t *q)
+{
+    if (atomic_load_explicit(&q->sleepers, memory_order_relaxed) &&
+        !atomic_exchange_explicit(&q->waking, 1, memory_order_relaxed))
+    {
+        atomic_fetch_add_explicit(&q->wake_seq, 1, memory_order_relaxed);
+        // Nobody was in FUTEX_WAIT yet (they will see wake_seq move): nothing to wait for
+        if (syscall(SYS_futex, &q->wake_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0) <= 0)
+            atomic_store_explicit(&q->waking, 0, memory_order_relaxed);
+    }
+}
+
+/**
+ * Appends a value without blocking and wakes a sleeping consumer, if any.
+ * @param q The queue.
+ * @param value The value.
+ * @return 0 on success, -1 if the queue is full.
+ */
+static inline int mpmc_queue_push(mpmc_queue_t *q, int value)
+{
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    mpmc_cell_t *cell;
+    while (1)
+    {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            // The cell is free for this lap: claim the position
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return -1; // still holds the value from one lap ago: full
+        else
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    }
+    cell->value = value;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+    // Pairs with the fence in mpmc_queue_pop: either the sleeper sees the
+    // value on its re-check or we see the sleeper
+    atomic_thread_fence(memory_order_seq_cst);
+    mpmc_queue_wake(q);
+    return 0;
+}
+
+/**
+ * Removes the oldest value without blocking.
+ * @param q The queue.
+ * @param value Receives the value.
+ * @return 0 on success, -1 if the queue is empty.
+ */
+static inline int mpmc_queue_try_pop(mpmc_queue_t *q, int *value)
+{
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    mpmc_cell_t *cell;
+    while (1)
+    {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return -1; // not written yet: empty
+        else
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    }
+    *value = cell->value;
+    // Free the cell for the producer one lap ahead
+    atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_release);
+    return 0;
+}
+
+/**
+ * Number of values in the queue; approximate while others push or pop.
+ * @param q The queue.
+ */
+static inline size_t mpmc_queue_size(mpmc_queue_t *q)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+/**
+ * Removes the oldest value, waiting up to timeout_ms for one if the queue is
+ * empty: spins first, then sleeps on a futex until a producer wakes it.
+ * @param q The queue.
+ * @param timeout_ms How long to wait; negative waits forever.
+ * @param value Receives the value.
+ * @return 0 on success, -1 if the time ran out.
+ */
+static inline int mpmc_queue_pop_timeout(mpmc_queue_t *q, int timeout_ms, int *value)
+{
+    // Per consumer thread: grows while values tend to show up during the spin
+    static _Thread_local unsigned spin_limit = MPMC_SPIN_MIN;
+    static int single_cpu = -1; // spinning only helps if a producer runs meanwhile
+    if (single_cpu < 0)
+        single_cpu = sysconf(_SC_NPROCESSORS_ONLN) == 1;
+    if (single_cpu)
+        spin_limit = 0;
+
+    for (unsigned i = 0;; i++)
+    {
+        if (mpmc_queue_try_pop(q, value) == 0)
+        {
+            if (i && spin_limit < MPMC_SPIN_MAX)
+                spin_limit *= 2;
+            return 0;
+        }
+        if (i >= spin_limit)
+            break;
+        mpmc_cpu_relax();
+    }
+    if (spin_limit > MPMC_SPIN_MIN)
+        spin_limit /= 2;
+
+    struct timespec deadline, left, *timeout = NULL;
+    if (timeout_ms >= 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += timeout_ms % 1000 * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        timeout = &left;
+    }
+    while (1)
+    {
+        if (timeout)
+        {
+            // FUTEX_WAIT takes the time left, not the deadline
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            left.tv_sec = deadline.tv_sec - now.tv_sec;
+            left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (left.tv_nsec < 0)
+            {
+                left.tv_sec--;
+                left.tv_nsec += 1000000000L;
+            }
+            if (left.tv_sec < 0)
+                return mpmc_queue_try_pop(q, value);
+        }
+        // Read the futex word before the last check, so a wake-up between the
+        // check and the sleep makes FUTEX_WAIT return at once
+        unsigned key = atomic_load_explicit(&q->wake_seq, memory_order_relaxed);
+        atomic_fetch_add_explicit(&q->sleepers, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        int found = mpmc_queue_try_pop(q, value) == 0;
+        if (!found)
+        {
+            syscall(SYS_futex, &q->wake_seq, FUTEX_WAIT_PRIVATE, key, timeout, NULL, 0);
+            // Running again: producers may send the next wake-up
+            atomic_store_explicit(&q->waking, 0, memory_order_relaxed);
+        }
+        atomic_fetch_sub_explicit(&q->sleepers, 1, memory_order_relaxed);
+        if (found || mpmc_queue_try_pop(q, value) == 0)
+        {
+            // Values pushed while waking was set woke no one: pass it on
+            atomic_thread_fence(memory_order_seq_cst);
+            if (mpmc_queue_size(q))
+                mpmc_queue_wake(q);
+            return 0;
+        }
+    }
+}
+
+/**
+ * Removes the oldest value, waiting as long as it takes for one.
+ * @param q The queue.
+ * @return The value.
+ */
+static inline int mpmc_queue_pop(mpmc_queue_t *q)
+{
+    int value;
+    mpmc_queue_pop_timeout(q, -1, &value);
+    return value;
+}
+
+#endif
@@ -0,0 +1,225 @@
+// response_cache.h — Pre-rendered responses with a Date header refreshed once a second
+// Header-only, shared by the servers in this directory: #include "response_cache.h"
+//
+// Each response (status line, headers and body) is serialized once, when a
+// worker registers its routes, into a single blob; answering a request is a
+// route lookup and a pointer handed to write(). Only the Date header changes:
+// a timer thread renders it once a second (response_date_start()) and every
+// worker patches its own blobs in place the first time it sees the new second,
+// so nothing is formatted on the request path and workers share no writable
+// data. A cache belongs to one worker thread.
+
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RESPONSE_CACHE_MAX 16
+#define RESPONSE_DATE_LEN 29 /* "Sun, 06 Nov 1994 08:49:37 GMT" */
+
+typedef struct
+{
+    const char *route; // request path, or NULL for the fallback (404)
+    size_t route_len;
+    char *data; // head + body, sent as is
+    size_t len;
+    size_t date_offset; // Date value inside data
+} cached_response_t;
+
+typedef struct
+{
+    unsigned count;
+    unsigned date_seq; // clock sequence the Date values in data come from
+    cached_response_t responses[RESPONSE_CACHE_MAX];
+} response_cache_t;
+
+/* The process-wide clock, written by the timer thread only (seqlock: odd while writing) */
+static struct
+{
+    atomic_uint seq;
+    char value[RESPONSE_DATE_LEN + 1];
+} response_date;
+
+static inline void response_date_render(void)
+{
+    char value[RESPONSE_DATE_LEN + 1];
+    // Not time(): it reads the coarse clock, still in the old second at wake-up
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct tm tm;
+    gmtime_r(&now.tv_sec, &tm);
+    strftime(value, sizeof(value), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    unsigned seq = atomic_load_explicit(&response_date.seq, memory_order_relaxed);
+    atomic_store_explicit(&response_date.seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(response_date.value, value, RESPONSE_DATE_LEN);
+    atomic_store_explicit(&response_date.seq, seq + 2, memory_order_release);
+}
+
+static void *response_date_timer(void *arg)
+{
+    (void)arg;
+    while (1)
+    {
+        // Wake on the second boundary, when the rendered value changes
+        struct timespec next;
+        clock_gettime(CLOCK_REALTIME, &next);
+        next.tv_sec++;
+        next.tv_nsec = 0;
+        clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &next, NULL);
+        response_date_render();
+    }
+    return NULL;
+}
+
+/**
+ * Renders the Date value and starts the thread that refreshes it every
+ * second. Call once, before the workers build their caches.
+ */
+static inline void response_date_start(void)
+{
+    response_date_render();
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, response_date_timer, NULL) != 0)
+    {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(tid);
+}
+
+/**
+ * Brings the Date header of every cached response up to date. Costs one
+ * atomic load unless the second has changed since the last call.
+ * @param cache The worker's cache.
+ */
+static inline void response_cache_refresh(response_cache_t *cache)
+{
+    unsigned seq = atomic_load_explicit(&response_date.seq, memory_order_acquire);
+    if (seq == cache->date_seq)
+        return;
+
+    char value[RESPONSE_DATE_LEN];
+    while (1)
+    {
+        if (!(seq & 1))
+        {
+            memcpy(value, response_date.value, RESPONSE_DATE_LEN);
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&response_date.seq, memory_order_relaxed) == seq)
+                break;
+        }
+        seq = atomic_load_explicit(&response_date.seq, memory_order_acquire);
+    }
+
+    for (unsigned i = 0; i < cache->count; i++)
+        memcpy(cache->responses[i].data + cache->responses[i].date_offset, value, RESPONSE_DATE_LEN);
+    cache->date_seq = seq;
+}
+
+/**
+ * Prepares an empty cache.
+ * @param cache The worker's cache.
+ */
+static inline void response_cache_init(response_cache_t *cache)
+{
+    cache->count = 0;
+    cache->date_seq = 0; // never a valid sequence once the clock has started
+}
+
+/**
+ * Serializes a response and registers it for a route.
+ * @param cache The worker's cache.
+ * @param route Request path it answers, or NULL for requests no route matches.
+ * @param status Status code and reason, e.g. "200 OK".
+ * @param content_type Value of the Content-Type header.
+ * @param body The body (NUL-terminated).
+ * @param connection Value of the Connection header ("close" or "keep-alive").
+ * @return 0 on success, -1 when the cache is full or out of memory.
+ */
+static inline int response_cache_add(response_cache_t *cache, const char *route, const char *status,
+                                     const char *content_type, const char *body, const char *connection)
+{
+    if (cache->count == RESPONSE_CACHE_MAX)
+        return -1;
+
+    size_t body_len = strlen(body);
+    const char *format = "HTTP/1.1 %s\r\n"
+                         "Date: %s\r\n"
+                         "Content-Type: %s\r\n"
+                         "Content-Length: %zu\r\n"
+                         "Connection: %s\r\n"
+                         "\r\n"
+                         "%s";
+    char date[RESPONSE_DATE_LEN + 1];
+    memset(date, ' ', RESPONSE_DATE_LEN);
+    date[RESPONSE_DATE_LEN] = '\0';
+    int len = snprintf(NULL, 0, format, status, date, content_type, body_len, connection, body);
+
+    cached_response_t *r = &cache->responses[cache->count];
+    r->data = malloc(len + 1);
+    if (!r->data)
+        return -1;
+    snprintf(r->data, len + 1, format, status, date, content_type, body_len, connection, body);
+    r->len = len;
+    r->date_offset = strlen("HTTP/1.1 ") + strlen(status) + strlen("\r\nDate: ");
+    r->route = route;
+    r->route_len = route ? strlen(route) : 0;
+    cache->count++;
+    cache->date_seq = 0; // fill in the Date on the next lookup
+    return 0;
+}
+
+/**
+ * Finds the response for a raw request by the path of its request line
+ * (query string ignored), with the Date header current.
+ * @param cache The worker's cache.
+ * @param request The bytes read from the client.
+ * @param len Number of bytes read.
+ * @return The response, the fallback when no route matches, or NULL.
+ */
+static inline const cached_response_t *response_cache_find(response_cache_t *cache, const char *request, size_t len)
+{
+    const char *end = request + len;
+    const char *path = memchr(request, ' ', len);
+    size_t path_len = 0;
+    if (path)
+    {
+        path++;
+        const char *p = path;
+        while (p < end && *p != ' ' && *p != '?')
+            p++;
+        path_len = p - path;
+    }
+
+    response_cache_refresh(cache);
+    const cached_response_t *fallback = NULL;
+    for (unsigned i = 0; i < cache->count; i++)
+    {
+        const cached_response_t *r = &cache->responses[i];
+        if (!r->route)
+            fallback = r;
+        else if (path && r->route_len == path_len && memcmp(r->route, path, path_len) == 0)
+            return r;
+    }
+    return fallback;
+}
+
+/**
+ * Frees the blobs of a worker's cache.
+ * @param cache The worker's cache.
+ */
+static inline void response_cache_destroy(response_cache_t *cache)
+{
+    for (unsigned i = 0; i < cache->count; i++)
+        free(cache->responses[i].data);
+    cache->count = 0;
+}
+
+#endif
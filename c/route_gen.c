@@ -0,0 +1,415 @@
+// route_gen.c — Generates a static C router for a fixed route table (a build step)
+// gcc -O2 -o route_gen route_gen.c
+// Run with: ./route_gen [-p prefix] routes.txt > routes_gen.h
+//
+// routes.txt has one route per line, "METHOD /pattern handler", with ":name"
+// segments as in router.h; blank lines and lines starting with '#' are
+// skipped. The table is checked here (bad patterns, duplicates, params named
+// differently at one place are errors with a line number) and turned into
+// static const data: the segment trie's nodes and a minimal perfect hash over
+// its static edges, found by hash-and-displace (route_gen.h has the lookup).
+// Nothing is built at startup and a lookup neither allocates nor scans a child
+// list. Semantics match router_lookup(): static segments first, then the
+// param with backtracking, a trailing slash ignored, 404 vs 405.
+//
+// The header defines, for a prefix of "routes_" (the default):
+//   int routes_lookup(request_view_t *req);  route index, -1 (404) or -2 (405)
+//   void routes_dispatch(void *data, request_view_t *req, response_writer_t *res);
+//   routes_table[ROUTES_COUNT]               the table, for introspection
+// Include it after router.h and the handlers it names (request_handler_t).
+//
+// Emitting the trie as code instead (a switch on segment length, then on
+// bytes, per node) was tried: gcc took minutes over a 10,000-route table.
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "http_parser.h"
+#include "router.h"
+#include "route_gen.h"
+
+typedef struct node
+{
+    char *seg; // static segment, or the param name of a param node
+    size_t seg_len;
+    struct node **kids; // static children
+    int kid_count;
+    struct node *param; // ":name" child
+    int *routes;        // indices into the table
+    int route_count;
+    int id;
+} node_t;
+
+typedef struct
+{
+    char method[16];
+    char pattern[512];
+    char handler[128];
+} route_t;
+
+typedef struct
+{
+    node_t *parent;
+    node_t *child;
+    uint64_t hash;
+} edge_t;
+
+static route_t *routes;
+static int route_count;
+static node_t **nodes; // by id, breadth first
+static int node_count;
+static const char *prefix = "routes_";
+
+static void *xrealloc(void *p, size_t size)
+{
+    p = realloc(p, size ? size : 1);
+    if (!p)
+    {
+        perror("realloc");
+        exit(1);
+    }
+    return p;
+}
+
+static node_t *new_node(const char *seg, size_t len)
+{
+    node_t *n = calloc(1, sizeof(*n));
+    if (!n)
+    {
+        perror("calloc");
+        exit(1);
+    }
+    n->seg = xrealloc(NULL, len + 1);
+    memcpy(n->seg, seg, len);
+    n->seg[len] = 0;
+    n->seg_len = len;
+    return n;
+}
+
+/* Adds route i below root; returns an error message or NULL. */
+static const char *insert(node_t *root, int i)
+{
+    const char *p = routes[i].pattern;
+    if (p[0] != '/')
+        return "pattern must start with '/'";
+    size_t len = router_trim(p, strlen(p));
+    const char *end = p + len;
+    if (len == 1)
+        p = end; // "/": no segments
+    node_t *n = root;
+    int params = 0;
+    while (p < end)
+    {
+        const char *seg = p + 1, *seg_end = memchr(seg, '/', end - seg);
+        if (!seg_end)
+            seg_end = end;
+        if (seg_end == seg)
+            return "empty segment";
+        if (*seg == ':')
+        {
+            if (seg_end == seg + 1 || ++params > ROUTER_MAX_PARAMS)
+                return "empty param name or too many params";
+            if (!n->param)
+                n->param = new_node(seg + 1, seg_end - seg - 1);
+            else if (n->param->seg_len != (size_t)(seg_end - seg - 1) ||
+                     memcmp(n->param->seg, seg + 1, n->param->seg_len) != 0)
+                return "param named differently from one at the same place";
+            n = n->param;
+        }
+        else
+        {
+            node_t *kid = NULL;
+            for (int k = 0; k < n->kid_count && !kid; k++)
+                if (n->kids[k]->seg_len == (size_t)(seg_end - seg) && memcmp(n->kids[k]->seg, seg, seg_end - seg) == 0)
+                    kid = n->kids[k];
+            if (!kid)
+            {
+                kid = new_node(seg, seg_end - seg);
+                n->kids = xrealloc(n->kids, sizeof(node_t *) * (n->kid_count + 1));
+                n->kids[n->kid_count++] = kid;
+            }
+            n = kid;
+        }
+        p = seg_end;
+    }
+    for (int r = 0; r < n->route_count; r++)
+        if (strcmp(routes[n->routes[r]].method, routes[i].method) == 0)
+            return "duplicate route";
+    n->routes = xrealloc(n->routes, sizeof(int) * (n->route_count + 1));
+    n->routes[n->route_count++] = i;
+    return NULL;
+}
+
+/* Numbers the nodes breadth first: the root is 0 and siblings are adjacent. */
+static void number_nodes(node_t *root)
+{
+    nodes = xrealloc(NULL, sizeof(node_t *));
+    nodes[0] = root;
+    node_count = 1;
+    for (int i = 0; i < node_count; i++)
+    {
+        node_t *n = nodes[i];
+        n->id = i;
+        nodes = xrealloc(nodes, sizeof(node_t *) * (node_count + n->kid_count + 1));
+        for (int k = 0; k < n->kid_count; k++)
+            nodes[node_count++] = n->kids[k];
+        if (n->param)
+            nodes[node_count++] = n->param;
+    }
+}
+
+static int cmp_bucket_size(const void *a, const void *b, void *sizes)
+{
+    uint32_t x = ((uint32_t *)sizes)[*(const uint32_t *)a], y = ((uint32_t *)sizes)[*(const uint32_t *)b];
+    return x > y ? -1 : x < y;
+}
+
+/*
+ * Hash-and-displace: the edges fall into n buckets by the high half of their
+ * hash. Largest bucket first, each gets the first displacement that sends all
+ * its edges to free slots; a bucket of one takes any free slot directly
+ * (stored as -slot - 1). Fills slots (edge index per slot) and disp.
+ */
+static void build_hash(const edge_t *edges, uint32_t n, uint32_t *slots, int32_t *disp)
+{
+    uint32_t *sizes = xrealloc(NULL, sizeof(uint32_t) * n), *first = xrealloc(NULL, sizeof(uint32_t) * (n + 1));
+    uint32_t *fill = xrealloc(NULL, sizeof(uint32_t) * n), *members = xrealloc(NULL, sizeof(uint32_t) * n);
+    uint32_t *order = xrealloc(NULL, sizeof(uint32_t) * n), *taken = xrealloc(NULL, sizeof(uint32_t) * n);
+    memset(sizes, 0, sizeof(uint32_t) * n);
+    for (uint32_t i = 0; i < n; i++)
+        sizes[route_gen_range(edges[i].hash >> 32, n)]++;
+    first[0] = 0;
+    for (uint32_t b = 0; b < n; b++)
+        first[b + 1] = first[b] + sizes[b];
+    for (uint32_t b = 0; b < n; b++)
+        fill[b] = first[b];
+    for (uint32_t i = 0; i < n; i++)
+        members[fill[route_gen_range(edges[i].hash >> 32, n)]++] = i;
+    for (uint32_t b = 0; b < n; b++)
+    {
+        order[b] = b;
+        slots[b] = UINT32_MAX;
+        disp[b] = 0;
+    }
+    qsort_r(order, n, sizeof(uint32_t), cmp_bucket_size, sizes);
+
+    uint32_t free_slot = 0;
+    for (uint32_t o = 0; o < n && sizes[order[o]]; o++)
+    {
+        uint32_t b = order[o], size = sizes[b];
+        if (size == 1)
+        {
+            while (slots[free_slot] != UINT32_MAX)
+                free_slot++;
+            slots[free_slot] = members[first[b]];
+            disp[b] = -(int32_t)free_slot - 1;
+            continue;
+        }
+        for (int32_t d = 1;; d++)
+        {
+            if (d == INT32_MAX)
+            {
+                fputs("route_gen: no perfect hash found\n", stderr);
+                exit(1);
+            }
+            uint32_t k = 0;
+            for (; k < size; k++)
+            {
+                uint32_t slot = route_gen_range(route_gen_mix(edges[members[first[b] + k]].hash + (uint64_t)d), n);
+                uint32_t j = 0;
+                while (j < k && taken[j] != slot)
+                    j++;
+                if (slots[slot] != UINT32_MAX || j < k)
+                    break;
+                taken[k] = slot;
+            }
+            if (k < size)
+                continue;
+            for (k = 0; k < size; k++)
+                slots[taken[k]] = members[first[b] + k];
+            disp[b] = d;
+            break;
+        }
+    }
+    free(sizes);
+    free(first);
+    free(fill);
+    free(members);
+    free(order);
+    free(taken);
+}
+
+static void literal(const char *s, size_t len)
+{
+    putchar('"');
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\' || c == '?' || !isprint(c))
+            printf("\\%03o", c);
+        else
+            putchar(c);
+    }
+    putchar('"');
+}
+
+int main(int argc, char **argv)
+{
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "-p") == 0)
+    {
+        prefix = argv[arg + 1];
+        arg += 2;
+    }
+    if (arg + 1 != argc)
+    {
+        fprintf(stderr, "usage: %s [-p prefix] routes.txt > routes_gen.h\n", argv[0]);
+        return 2;
+    }
+    FILE *in = fopen(argv[arg], "r");
+    if (!in)
+    {
+        perror(argv[arg]);
+        return 1;
+    }
+
+    node_t *root = new_node("", 0);
+    char line[1024];
+    for (int line_no = 1; fgets(line, sizeof(line), in); line_no++)
+    {
+        route_t route;
+        char extra;
+        int fields = sscanf(line, "%15s %511s %127s %c", route.method, route.pattern, route.handler, &extra);
+        if (fields <= 0 || route.method[0] == '#')
+            continue;
+        const char *error = fields == 3 ? NULL : "expected METHOD /pattern handler";
+        if (!error)
+        {
+            routes = xrealloc(routes, sizeof(route_t) * (route_count + 1));
+            routes[route_count] = route;
+            error = insert(root, route_count);
+            route_count++;
+        }
+        if (error)
+        {
+            fprintf(stderr, "%s:%d: %s\n", argv[arg], line_no, error);
+            return 1;
+        }
+    }
+    fclose(in);
+    number_nodes(root);
+
+    // Static edges, keyed by (parent id, segment)
+    uint32_t edge_count = 0;
+    edge_t *edges = NULL;
+    for (int i = 0; i < node_count; i++)
+        for (int k = 0; k < nodes[i]->kid_count; k++)
+        {
+            node_t *kid = nodes[i]->kids[k];
+            edges = xrealloc(edges, sizeof(edge_t) * (edge_count + 1));
+            edges[edge_count++] = (edge_t){nodes[i], kid, route_gen_hash(i, kid->seg, kid->seg_len)};
+        }
+    uint32_t *slots = xrealloc(NULL, sizeof(uint32_t) * edge_count);
+    int32_t *disp = xrealloc(NULL, sizeof(int32_t) * edge_count);
+    build_hash(edges, edge_count, slots, disp);
+    uint32_t *lone_slot = xrealloc(NULL, sizeof(uint32_t) * node_count); // the slot of a node's only edge
+    for (uint32_t s = 0; s < edge_count; s++)
+        lone_slot[edges[slots[s]].parent->id] = s;
+
+    // Every node's segment (or param name) in strings, in node order
+    uint32_t *offset = xrealloc(NULL, sizeof(uint32_t) * node_count), strings_len = 0;
+    for (int i = 0; i < node_count; i++)
+    {
+        offset[i] = strings_len;
+        strings_len += nodes[i]->seg_len;
+    }
+
+    char upper[64];
+    size_t upper_len = 0;
+    for (const char *c = prefix; *c && upper_len < sizeof(upper) - 1; c++)
+        upper[upper_len++] = toupper((unsigned char)*c);
+    upper[upper_len] = 0;
+
+    printf("// Generated by route_gen.c from %s; do not edit.\n", argv[arg]);
+    printf("// %d routes, %d trie nodes, %u static edges.\n\n", route_count, node_count, edge_count);
+    printf("#include \"route_gen.h\"\n\n");
+    printf("#define %sCOUNT %d\n\n", upper, route_count);
+
+    printf("static const route_gen_entry_t %stable[] = {\n", prefix);
+    for (int i = 0; i < route_count; i++)
+    {
+        printf("    {\"%s\", %zu, ", routes[i].method, strlen(routes[i].method));
+        literal(routes[i].pattern, strlen(routes[i].pattern));
+        printf(", \"%s\"},\n", routes[i].handler);
+    }
+    printf("};\n\n");
+
+    printf("static const request_handler_t %shandlers[] = {\n", prefix);
+    for (int i = 0; i < route_count; i++)
+        printf("    %s,\n", routes[i].handler);
+    printf("};\n\n");
+
+    printf("static const char %sstrings[] =\n", prefix);
+    for (int i = 0; i < node_count; i++)
+        if (nodes[i]->seg_len)
+        {
+            printf("    ");
+            literal(nodes[i]->seg, nodes[i]->seg_len);
+            printf("\n");
+        }
+    // Padding: no 16-byte load of a segment can reach past the array, even as
+    // far as a compiler that does not know seg_len == len can tell
+    printf("    \"\\0\\0\\0\\0\\0\\0\\0\\0\\0\\0\\0\\0\\0\\0\\0\";\n\n");
+
+    printf("static const uint32_t %sroute_ids[] = {\n", prefix);
+    for (int i = 0; i < node_count; i++)
+        for (int r = 0; r < nodes[i]->route_count; r++)
+            printf("    %d,\n", nodes[i]->routes[r]);
+    printf("    0,\n};\n\n");
+
+    printf("static const route_gen_node_t %snodes[] = {\n", prefix);
+    uint32_t route_at = 0;
+    for (int i = 0; i < node_count; i++)
+    {
+        node_t *n = nodes[i];
+        printf("    {%d, %u, %d, %u, %zu, %u, %d},\n", n->kid_count, n->kid_count == 1 ? lone_slot[i] : 0,
+               n->param ? n->param->id : -1,
+               n->param ? offset[n->param->id] : 0, n->param ? n->param->seg_len : 0, route_at, n->route_count);
+        route_at += n->route_count;
+    }
+    printf("};\n\n");
+
+    printf("static const route_gen_edge_t %sedges[] = {\n", prefix);
+    for (uint32_t s = 0; s < edge_count; s++)
+    {
+        const edge_t *e = &edges[slots[s]];
+        printf("    {%d, %d, %u, %zu},\n", e->parent->id, e->child->id, offset[e->child->id], e->child->seg_len);
+    }
+    printf("    {0, 0, 0, 0},\n};\n\n");
+
+    printf("static const int32_t %sdisp[] = {\n", prefix);
+    for (uint32_t b = 0; b < edge_count; b++)
+        printf("    %d,\n", disp[b]);
+    printf("    0,\n};\n\n");
+
+    printf("static const route_gen_router_t %srouter = {\n", prefix);
+    printf("    %snodes, %sedges, %sdisp, %u, %sroute_ids, %stable, %sstrings,\n};\n\n", prefix, prefix, prefix,
+           edge_count, prefix, prefix, prefix);
+
+    printf("/**\n * Finds the route for a request and fills in its params.\n * @param req The request.\n");
+    printf(" * @return Index into %stable, -1 if no route has the path, -2 if none has it\n", prefix);
+    printf(" *         with this method.\n */\n");
+    printf("static inline int %slookup(request_view_t *req)\n{\n", prefix);
+    printf("    return route_gen_lookup(&%srouter, req);\n}\n\n", prefix);
+
+    printf("/* A request_handler_t: like router_dispatch, over the generated table. */\n");
+    printf("static inline void %sdispatch(void *data, request_view_t *req, response_writer_t *res)\n{\n", prefix);
+    printf("    int route = %slookup(req);\n", prefix);
+    printf("    if (route >= 0)\n        %shandlers[route](data, req, res);\n", prefix);
+    printf("    else if (route == -2)\n");
+    printf("        response_send(res, \"405 Method Not Allowed\", \"text/plain\", \"Method Not Allowed\", 18);\n");
+    printf("    else\n        response_send(res, \"404 Not Found\", \"text/plain\", \"Not Found\", 9);\n");
+    printf("}\n");
+    return 0;
+}
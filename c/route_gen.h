@@ -0,0 +1,214 @@
+// route_gen.h — Lookup side of the routers route_gen.c generates
+// Header-only: included by the generated header (after router.h)
+//
+// A generated router is a set of static const tables: the trie's nodes, and
+// its static edges (parent, segment) -> child placed by a minimal perfect
+// hash built at generation time. A lookup walks the path a segment at a time:
+// it hashes (node, segment), reads the one edge the hash points at (a node
+// with a single edge points at it directly, skipping the hash) and confirms
+// it with a single compare (overlapping word loads, 16-byte SSE2 loads for
+// long segments). There are no child lists to scan or pointers to chase, and
+// the cost per segment does not depend on how many routes there are. A
+// ":name" segment is the node's param child, tried when the static edge is
+// missing or dead-ends, as in router_lookup(). Lookups never allocate.
+
+#ifndef ROUTE_GEN_H
+#define ROUTE_GEN_H
+
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+typedef struct
+{
+    const char *method;
+    uint32_t method_len;
+    const char *pattern;
+    const char *handler;
+} route_gen_entry_t;
+
+typedef struct
+{
+    uint32_t parent;
+    uint32_t child;
+    uint32_t seg; // offset of the segment in strings
+    uint32_t seg_len;
+} route_gen_edge_t;
+
+typedef struct
+{
+    uint32_t kids;           // static edges out of the node
+    uint32_t edge;           // the slot of the only one, when kids == 1
+    int32_t param;           // the ":name" child, or -1
+    uint32_t param_name;     // offset in strings
+    uint32_t param_name_len;
+    uint32_t routes;         // first of its entries in route_ids
+    uint32_t route_count;
+} route_gen_node_t;
+
+typedef struct
+{
+    const route_gen_node_t *nodes; // node 0 is the root
+    const route_gen_edge_t *edges;
+    const int32_t *disp; // per bucket: a displacement, or -slot - 1
+    uint32_t edge_count;
+    const uint32_t *route_ids;
+    const route_gen_entry_t *table;
+    const char *strings;
+} route_gen_router_t;
+
+static inline uint64_t route_gen_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Hash of the edge key (parent node, segment bytes). */
+static inline uint64_t route_gen_hash(uint32_t parent, const char *p, size_t len)
+{
+    uint64_t h = (parent + 1) * 0x9e3779b97f4a7c15ull ^ len, w = 0;
+    const char *end = p + len;
+    for (; end - p > 8; p += 8)
+    {
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 29;
+    }
+    // The last 1..8 bytes, as fixed-size loads (a memcpy of variable length is a call)
+    if (len >= 8)
+        memcpy(&w, end - 8, 8);
+    else if (len >= 4)
+    {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4), memcpy(&hi, end - 4, 4);
+        w = (uint64_t)hi << 32 | lo;
+    }
+    else if (len)
+        w = (uint64_t)(uint8_t)p[0] << 16 | (uint64_t)(uint8_t)p[len / 2] << 8 | (uint8_t)end[-1];
+    return route_gen_mix(h ^ w);
+}
+
+/* h mapped onto [0, n) without a division. */
+static inline uint32_t route_gen_range(uint64_t h, uint32_t n)
+{
+    return (uint32_t)(((h & 0xffffffffull) * n) >> 32);
+}
+
+/* The only slot an edge with hash h can be in. */
+static inline uint32_t route_gen_slot(const int32_t *disp, uint32_t n, uint64_t h)
+{
+    int32_t d = disp[route_gen_range(h >> 32, n)];
+    return d < 0 ? (uint32_t)(-d - 1) : route_gen_range(route_gen_mix(h + (uint64_t)d), n);
+}
+
+/* a[0..len) == b[0..len), reading neither outside its range. */
+static inline int route_gen_eq(const char *a, const char *b, size_t len)
+{
+    uint64_t w, x, y, z;
+#ifdef __SSE2__
+    if (len >= 16)
+    {
+        for (size_t i = 0; i + 16 < len; i += 16)
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)),
+                                                 _mm_loadu_si128((const __m128i *)(b + i)))) != 0xffff)
+                return 0;
+        // The last 16 bytes, overlapping the block before
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + len - 16)),
+                                                _mm_loadu_si128((const __m128i *)(b + len - 16)))) == 0xffff;
+    }
+#else
+    if (len > 16)
+        return memcmp(a, b, len) == 0;
+#endif
+    // First and last word, overlapping unless len is the word size
+    if (len >= 8)
+    {
+        memcpy(&w, a, 8), memcpy(&x, b, 8), memcpy(&y, a + len - 8, 8), memcpy(&z, b + len - 8, 8);
+        return w == x && y == z;
+    }
+    if (len >= 4)
+    {
+        uint32_t w4, x4, y4, z4;
+        memcpy(&w4, a, 4), memcpy(&x4, b, 4), memcpy(&y4, a + len - 4, 4), memcpy(&z4, b + len - 4, 4);
+        return w4 == x4 && y4 == z4;
+    }
+    return len == 0 || (a[0] == b[0] && a[len / 2] == b[len / 2] && a[len - 1] == b[len - 1]);
+}
+
+/* The route for the rest of the path [p, end) below node, as route_gen_lookup returns it. */
+static int route_gen_match(const route_gen_router_t *r, uint32_t node, const char *p, const char *end,
+                           request_view_t *req)
+{
+    const route_gen_node_t *n = &r->nodes[node];
+    if (p == end)
+    {
+        if (!n->route_count)
+            return -1;
+        http_slice_t method = req->http->method;
+        for (uint32_t i = 0; i < n->route_count; i++)
+        {
+            uint32_t id = r->route_ids[n->routes + i];
+            if (r->table[id].method_len == method.len && memcmp(r->table[id].method, method.ptr, method.len) == 0)
+                return (int)id;
+        }
+        return -2;
+    }
+    p++; // the '/'
+    const char *e = memchr(p, '/', end - p);
+    if (!e)
+        e = end;
+    size_t len = e - p;
+    if (n->kids)
+    {
+        // A lone edge needs no hash: its compare is the whole test
+        const route_gen_edge_t *edge =
+            &r->edges[n->kids == 1 ? n->edge : route_gen_slot(r->disp, r->edge_count, route_gen_hash(node, p, len))];
+        if (edge->parent == node && edge->seg_len == len && route_gen_eq(r->strings + edge->seg, p, len))
+        {
+            int found = route_gen_match(r, edge->child, e, end, req);
+            if (found != -1)
+                return found;
+        }
+    }
+    if (n->param >= 0 && len)
+    {
+        route_param_t *param = &req->params[req->param_count++];
+        param->name.ptr = r->strings + n->param_name;
+        param->name.len = n->param_name_len;
+        param->value.ptr = p;
+        param->value.len = len;
+        int found = route_gen_match(r, (uint32_t)n->param, e, end, req);
+        if (found != -1)
+            return found;
+        req->param_count--;
+    }
+    return -1;
+}
+
+/**
+ * Finds the route for a request and fills in its params.
+ * @param r The generated router.
+ * @param req The request.
+ * @return Index into the router's table, -1 if no route has the path, -2 if
+ *         none has it with this method.
+ */
+static inline int route_gen_lookup(const route_gen_router_t *r, request_view_t *req)
+{
+    req->param_count = 0;
+    const char *p = req->path.ptr;
+    size_t len = router_trim(p, req->path.len);
+    if (len == 0 || *p != '/')
+        return -1;
+    int found = route_gen_match(r, 0, p, p + (len == 1 ? 0 : len), req);
+    if (found < 0)
+        req->param_count = 0;
+    return found;
+}
+
+#endif
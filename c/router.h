@@ -0,0 +1,481 @@
+// router.h — Request handlers and a radix-trie router for them
+// Header-only, shared by the servers in this directory: #include "router.h"
+// (after http_parser.h)
+//
+// A server hands each parsed request to one request_handler_t: a view of the
+// request (http_parser.h slices, the path split from its query, the route
+// params) and a writer over the connection's output buffer, or over the
+// worker's arena (arena.h), where the response can grow. router_dispatch
+// is such a handler: it looks the path up in a radix trie built at startup and
+// calls the handler registered for the method.
+//
+// The trie is the C port of compile_time_builded_route_manager/ (radix_trie.v,
+// patricia_trie.v, trie_node.v) without their per-request cost: there is no
+// split into a new array of segments and no map per node. Static edges are
+// labelled with byte strings that share no prefix with their siblings, so a
+// lookup compares each byte of the path about once; a ":name" segment is a
+// separate child that takes the bytes up to the next '/' as a param. As in the
+// V tries, static segments win over params (the lookup backtracks to the param
+// when the static branch dead-ends), and each node keeps its handlers as a
+// list of methods (MethodNode). A trailing slash is ignored. Lookups never
+// allocate; params are slices of the request.
+
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ROUTER_MAX_PARAMS 8
+#define ROUTER_METHOD_MAX 8
+
+typedef struct
+{
+    http_slice_t name;
+    http_slice_t value;
+} route_param_t;
+
+typedef struct
+{
+    const http_request_t *http; // method, headers, body
+    http_slice_t path;          // without the query
+    http_slice_t query;         // after '?', empty if none
+    route_param_t params[ROUTER_MAX_PARAMS];
+    int param_count;
+} request_view_t;
+
+typedef struct
+{
+    char *buf;
+    size_t cap;
+    size_t len;
+    arena_t *arena; // if set, buf is the arena's latest allocation and grows
+    int close;      // response_send() says Connection: close
+} response_writer_t;
+
+/*
+ * Answers one request by writing a complete response (head and body) with
+ * response_send() or response_write(). Runs on the worker thread that parsed
+ * the request; req and its slices are valid only during the call.
+ */
+typedef void (*request_handler_t)(void *data, request_view_t *req, response_writer_t *res);
+
+/**
+ * Wraps a parsed request; the path is split at '?' and there are no params yet.
+ * @param req The view to fill.
+ * @param http The parsed request.
+ */
+static inline void request_view_init(request_view_t *req, const http_request_t *http)
+{
+    req->http = http;
+    req->path = http->path;
+    req->query.ptr = NULL;
+    req->query.len = 0;
+    const char *query = memchr(http->path.ptr, '?', http->path.len);
+    if (query)
+    {
+        req->path.len = query - http->path.ptr;
+        req->query.ptr = query + 1;
+        req->query.len = http->path.len - req->path.len - 1;
+    }
+    req->param_count = 0;
+}
+
+/**
+ * Looks up a route param by name.
+ * @param req The request.
+ * @param name The name, without ':'.
+ * @return Its value, or an empty slice (NULL ptr) if the route has none.
+ */
+static inline http_slice_t request_param(const request_view_t *req, const char *name)
+{
+    size_t len = strlen(name);
+    for (int i = 0; i < req->param_count; i++)
+        if (req->params[i].name.len == len && memcmp(req->params[i].name.ptr, name, len) == 0)
+            return req->params[i].value;
+    return (http_slice_t){NULL, 0};
+}
+
+static inline void response_writer_init(response_writer_t *res, char *buf, size_t cap)
+{
+    res->buf = buf;
+    res->cap = cap;
+    res->len = 0;
+    res->arena = NULL;
+    res->close = 0;
+}
+
+/**
+ * Starts a response in a worker's arena: it grows as the handler writes (in
+ * place while nothing else is allocated after it) instead of failing.
+ * @param res The writer.
+ * @param arena The worker's arena.
+ * @param cap Bytes to start with.
+ * @return 0, or -1 if out of memory.
+ */
+static inline int response_writer_init_arena(response_writer_t *res, arena_t *arena, size_t cap)
+{
+    char *buf = arena_alloc(arena, cap);
+    if (!buf)
+        return -1;
+    response_writer_init(res, buf, cap);
+    res->arena = arena;
+    return 0;
+}
+
+/* Makes room for len more bytes, growing an arena buffer; -1 if there is none. */
+static inline int response_reserve(response_writer_t *res, size_t len)
+{
+    if (len <= res->cap - res->len)
+        return 0;
+    if (!res->arena)
+        return -1;
+    size_t cap = res->cap * 2 > res->len + len ? res->cap * 2 : res->len + len;
+    char *buf = arena_grow(res->arena, res->buf, res->len, cap);
+    if (!buf)
+        return -1;
+    res->buf = buf;
+    res->cap = cap;
+    return 0;
+}
+
+/**
+ * Appends raw bytes to the response.
+ * @param res The writer.
+ * @param data The bytes.
+ * @param len Their length.
+ * @return 0, or -1 if they do not fit or the arena is out of memory (nothing
+ *         is written).
+ */
+static inline int response_write(response_writer_t *res, const void *data, size_t len)
+{
+    if (response_reserve(res, len) < 0)
+        return -1;
+    memcpy(res->buf + res->len, data, len);
+    res->len += len;
+    return 0;
+}
+
+/**
+ * Writes a complete response, keep-alive unless res->close is set.
+ * @param res The writer.
+ * @param status Status line after "HTTP/1.1 ", e.g. "200 OK".
+ * @param content_type Content-Type value.
+ * @param body The body, copied.
+ * @param len Body length.
+ * @return 0, or -1 if it does not fit (a 500 is written instead).
+ */
+static inline int response_send(response_writer_t *res, const char *status, const char *content_type,
+                                const void *body, size_t len)
+{
+    char head[256];
+    int head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.1 %s\r\n"
+                            "Content-Type: %s\r\n"
+                            "Content-Length: %zu\r\n"
+                            "Connection: %s\r\n"
+                            "\r\n",
+                            status, content_type, len, res->close ? "close" : "keep-alive");
+    if (head_len < 0 || (size_t)head_len >= sizeof(head) || response_reserve(res, head_len + len) < 0)
+    {
+        static const char error[] = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n";
+        response_write(res, error, sizeof(error) - 1);
+        return -1;
+    }
+    memcpy(res->buf + res->len, head, head_len);
+    memcpy(res->buf + res->len + head_len, body, len);
+    res->len += head_len + len;
+    return 0;
+}
+
+/* ================= Router ================= */
+
+typedef struct router_route
+{
+    char method[ROUTER_METHOD_MAX];
+    size_t method_len;
+    request_handler_t handler;
+    void *data;
+    struct router_route *next;
+} router_route_t;
+
+typedef struct router_node
+{
+    char *label; // bytes a static edge matches
+    size_t label_len;
+    char *param_name; // for a ":name" node
+    size_t param_name_len;
+    struct router_node **children; // static edges, in insertion order
+    unsigned char *first;          // first byte of each child's label
+    size_t child_count;
+    struct router_node *param; // the ":name" child, if any
+    router_route_t *routes;    // methods served here
+} router_node_t;
+
+typedef struct
+{
+    router_node_t root;
+    size_t node_count;
+    size_t route_count;
+} router_t;
+
+static inline void router_init(router_t *r)
+{
+    memset(r, 0, sizeof(*r));
+    r->node_count = 1;
+}
+
+static inline void router_node_free(router_node_t *n)
+{
+    for (size_t i = 0; i < n->child_count; i++)
+    {
+        router_node_free(n->children[i]);
+        free(n->children[i]);
+    }
+    if (n->param)
+    {
+        router_node_free(n->param);
+        free(n->param);
+    }
+    while (n->routes)
+    {
+        router_route_t *next = n->routes->next;
+        free(n->routes);
+        n->routes = next;
+    }
+    free(n->label);
+    free(n->param_name);
+    free(n->children);
+    free(n->first);
+}
+
+static inline void router_free(router_t *r)
+{
+    router_node_free(&r->root);
+    router_init(r);
+}
+
+/* A path with its trailing slash dropped (but "/" stays "/"). */
+static inline size_t router_trim(const char *path, size_t len)
+{
+    return len > 1 && path[len - 1] == '/' ? len - 1 : len;
+}
+
+static inline router_node_t *router_new_node(router_t *r, const char *label, size_t len)
+{
+    router_node_t *n = calloc(1, sizeof(*n));
+    if (!n || !(n->label = malloc(len ? len : 1)))
+    {
+        free(n);
+        return NULL;
+    }
+    memcpy(n->label, label, len);
+    n->label_len = len;
+    r->node_count++;
+    return n;
+}
+
+static inline int router_add_child(router_node_t *n, router_node_t *child)
+{
+    router_node_t **children = realloc(n->children, (n->child_count + 1) * sizeof(*children));
+    if (!children)
+        return -1;
+    n->children = children;
+    unsigned char *first = realloc(n->first, n->child_count + 1);
+    if (!first)
+        return -1;
+    n->first = first;
+    n->children[n->child_count] = child;
+    n->first[n->child_count] = (unsigned char)child->label[0];
+    n->child_count++;
+    return 0;
+}
+
+/* Walks (and grows) the static edges below n that spell s; returns the node at its end. */
+static inline router_node_t *router_insert_static(router_t *r, router_node_t *n, const char *s, size_t len)
+{
+    while (len > 0)
+    {
+        const unsigned char *slot = n->child_count ? memchr(n->first, (unsigned char)s[0], n->child_count) : NULL;
+        if (!slot)
+        {
+            router_node_t *child = router_new_node(r, s, len);
+            if (!child || router_add_child(n, child) < 0)
+                return NULL;
+            return child;
+        }
+        router_node_t *child = n->children[slot - n->first];
+        size_t common = 1;
+        while (common < len && common < child->label_len && s[common] == child->label[common])
+            common++;
+        if (common < child->label_len)
+        {
+            // Split the edge: the shared prefix becomes a node above the rest
+            router_node_t *mid = router_new_node(r, child->label, common);
+            if (!mid)
+                return NULL;
+            memmove(child->label, child->label + common, child->label_len - common);
+            child->label_len -= common;
+            if (router_add_child(mid, child) < 0)
+                return NULL;
+            n->children[slot - n->first] = mid;
+            child = mid;
+        }
+        n = child;
+        s += common;
+        len -= common;
+    }
+    return n;
+}
+
+/**
+ * Registers a handler. Call before serving: lookups take no lock.
+ * @param r The router.
+ * @param method e.g. "GET".
+ * @param pattern Path starting with '/'; a segment ":name" matches any one
+ *        segment and is passed to the handler as param name.
+ * @param handler The handler.
+ * @param data Passed to the handler.
+ * @return 0, or -1 on a bad or duplicate pattern, a param named differently
+ *         from one registered at the same place, or if out of memory.
+ */
+static inline int router_add(router_t *r, const char *method, const char *pattern, request_handler_t handler,
+                             void *data)
+{
+    size_t method_len = strlen(method);
+    const char *p = pattern, *end = pattern + router_trim(pattern, strlen(pattern));
+    if (method_len == 0 || method_len > ROUTER_METHOD_MAX || p == end || *p != '/')
+        return -1;
+
+    router_node_t *n = &r->root;
+    int params = 0;
+    while (p < end)
+    {
+        if (*p == ':' && p[-1] == '/')
+        {
+            const char *name = p + 1, *name_end = memchr(name, '/', end - name);
+            if (!name_end)
+                name_end = end;
+            size_t name_len = name_end - name;
+            if (name_len == 0 || ++params > ROUTER_MAX_PARAMS)
+                return -1;
+            if (!n->param)
+            {
+                if (!(n->param = router_new_node(r, "", 0)) || !(n->param->param_name = malloc(name_len)))
+                    return -1;
+                memcpy(n->param->param_name, name, name_len);
+                n->param->param_name_len = name_len;
+            }
+            else if (n->param->param_name_len != name_len || memcmp(n->param->param_name, name, name_len) != 0)
+                return -1;
+            n = n->param;
+            p = name_end;
+            continue;
+        }
+        // Static bytes up to the next ":name" segment
+        const char *q = p + 1;
+        while (q < end && !(*q == ':' && q[-1] == '/'))
+            q++;
+        if (!(n = router_insert_static(r, n, p, q - p)))
+            return -1;
+        p = q;
+    }
+
+    for (router_route_t *route = n->routes; route; route = route->next)
+        if (route->method_len == method_len && memcmp(route->method, method, method_len) == 0)
+            return -1;
+    router_route_t *route = malloc(sizeof(*route));
+    if (!route)
+        return -1;
+    memcpy(route->method, method, method_len);
+    route->method_len = method_len;
+    route->handler = handler;
+    route->data = data;
+    route->next = n->routes;
+    n->routes = route;
+    r->route_count++;
+    return 0;
+}
+
+static inline const router_node_t *router_match(const router_node_t *n, const char *p, const char *end,
+                                                request_view_t *req)
+{
+    if (p == end)
+        return n->routes ? n : NULL;
+    const unsigned char *slot = n->child_count ? memchr(n->first, (unsigned char)*p, n->child_count) : NULL;
+    if (slot)
+    {
+        const router_node_t *child = n->children[slot - n->first];
+        if ((size_t)(end - p) >= child->label_len && memcmp(p, child->label, child->label_len) == 0)
+        {
+            const router_node_t *found = router_match(child, p + child->label_len, end, req);
+            if (found)
+                return found;
+        }
+    }
+    if (n->param && *p != '/' && req->param_count < ROUTER_MAX_PARAMS)
+    {
+        const char *value_end = memchr(p, '/', end - p);
+        if (!value_end)
+            value_end = end;
+        route_param_t *param = &req->params[req->param_count++];
+        param->name.ptr = n->param->param_name;
+        param->name.len = n->param->param_name_len;
+        param->value.ptr = p;
+        param->value.len = value_end - p;
+        const router_node_t *found = router_match(n->param, value_end, end, req);
+        if (found)
+            return found;
+        req->param_count--;
+    }
+    return NULL;
+}
+
+/**
+ * Finds the route for a request and fills in its params.
+ * @param r The router.
+ * @param req The request; its params are set on a match.
+ * @param path_found Set to whether any method is served at the path (to tell
+ *        404 from 405); may be NULL.
+ * @return The route, or NULL.
+ */
+static inline const router_route_t *router_lookup(const router_t *r, request_view_t *req, int *path_found)
+{
+    req->param_count = 0;
+    const char *path = req->path.ptr;
+    const router_node_t *n = router_match(&r->root, path, path + router_trim(path, req->path.len), req);
+    if (path_found)
+        *path_found = n != NULL;
+    if (!n)
+        return NULL;
+    http_slice_t method = req->http->method;
+    for (const router_route_t *route = n->routes; route; route = route->next)
+        if (route->method_len == method.len && memcmp(route->method, method.ptr, method.len) == 0)
+            return route;
+    req->param_count = 0;
+    return NULL;
+}
+
+/**
+ * A request_handler_t over a router: calls the route's handler, or answers
+ * 404 (no such path) or 405 (path served, not with this method).
+ * @param data The router_t.
+ * @param req The request.
+ * @param res The writer.
+ */
+static inline void router_dispatch(void *data, request_view_t *req, response_writer_t *res)
+{
+    int path_found;
+    const router_route_t *route = router_lookup(data, req, &path_found);
+    if (route)
+        route->handler(route->data, req, res);
+    else if (path_found)
+        response_send(res, "405 Method Not Allowed", "text/plain", "Method Not Allowed", 18);
+    else
+        response_send(res, "404 Not Found", "text/plain", "Not Found", 9);
+}
+
+#endif
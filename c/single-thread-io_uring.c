@@ -10,20 +10,26 @@
 #include <netinet/tcp.h>
 #include <liburing.h>
 #include <sys/mman.h>
+#include "conn_slab.h"
+#include "http_parser.h"
+#include "router.h"
+#include "flat_router.h"
 
 #define max_connection_size 1024
 #define max_thread_pool_size 16 // Not used in single-thread io_uring version, but kept for consistency
 #define BUFFER_GROUP 0
 #define max_buffers max_connection_size
 #define buffer_size 4096
+#define max_conns 16384                   // clients beyond this many are closed
+#define out_buffer_size (2 * buffer_size) // responses to one read, sent at once
+#define handler_response_min 1024         // room a handler is always given
 
-// user_data: high 16 bits = op, low 48 bits = fd
+// user_data: high 16 bits = op, low 48 bits = connection handle (conn_slab.h)
 #define OP_ACCEPT 1
 #define OP_READ 2
 #define OP_WRITE 3
-#define PACK(op, fd) ((((uint64_t)(op)) << 48) | (uint32_t)(fd))
+#define PACK(op, handle) ((((uint64_t)(op)) << 48) | (handle))
 #define UNPACK_OP(x) ((int)((x) >> 48))
-#define UNPACK_FD(x) ((int)((uint32_t)(x)))
 
 static const char response[] =
     "HTTP/1.1 200 OK\r\n"
@@ -33,6 +39,8 @@ static const char response[] =
     "\r\n"
     "OK";
 
+static const char bad_request[] = "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
 static char request_buffers[max_buffers][buffer_size];
 static struct io_uring_buf_ring *buf_ring;
 
@@ -41,9 +49,45 @@ typedef struct
     int port;
     int socket_fd;
     pthread_t threads[max_thread_pool_size]; // Unused in single-thread io_uring version
-    void *(*request_handler)(void *);        // Unused in this minimal version
+    request_handler_t request_handler;       // answers every request; NULL: "OK"
+    void *handler_data;
 } Server;
 
+// Per-connection state, a slot in the conns slab: completions find it by
+// handle, so one arriving after its connection closed (and the fd or slot went
+// to another client) is dropped rather than applied to the new connection.
+// The requests of one read are answered into out and sent with one send; the
+// next read is armed once it is out. A request split across reads waits in
+// partial for the rest, as do requests left over when out fills up. A read is
+// only armed once partial is down to an incomplete request shorter than
+// buffer_size, so it always fits another.
+typedef struct
+{
+    conn_slot_t slot;
+    int fd;
+    int close_after_write;
+    http_parser_t parser;
+    uint32_t partial_len;
+    uint32_t out_len;
+    uint32_t out_sent;
+} conn_t;
+
+_Static_assert(sizeof(conn_t) <= 64, "conn_t fits a cache line");
+
+// The buffers, in the slab's cold array: conn_t stays within a cache line
+typedef struct
+{
+    char partial[2 * buffer_size];
+    char out[out_buffer_size];
+} conn_bufs_t;
+
+static conn_slab_t conns;
+
+static inline conn_bufs_t *conn_bufs(const conn_t *c)
+{
+    return conn_slab_cold(&conns, c->slot.index);
+}
+
 static void prepare_accept(struct io_uring *ring, int server_socket)
 {
     struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
@@ -53,24 +97,24 @@ static void prepare_accept(struct io_uring *ring, int server_socket)
     io_uring_sqe_set_data64(sqe, PACK(OP_ACCEPT, 0));
 }
 
-static void prepare_read(struct io_uring *ring, int client_socket)
+static void prepare_read(struct io_uring *ring, conn_t *c)
 {
     struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
     if (!sqe)
         return;
-    io_uring_prep_recv(sqe, client_socket, NULL, buffer_size, 0);
+    io_uring_prep_recv(sqe, c->fd, NULL, buffer_size, 0);
     sqe->flags |= IOSQE_BUFFER_SELECT;
     sqe->buf_group = BUFFER_GROUP;
-    io_uring_sqe_set_data64(sqe, PACK(OP_READ, client_socket));
+    io_uring_sqe_set_data64(sqe, PACK(OP_READ, conn_slab_handle(&c->slot)));
 }
 
-static void prepare_write(struct io_uring *ring, int client_socket)
+static void prepare_write(struct io_uring *ring, conn_t *c)
 {
     struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
     if (!sqe)
         return;
-    io_uring_prep_send(sqe, client_socket, response, sizeof(response) - 1, 0);
-    io_uring_sqe_set_data64(sqe, PACK(OP_WRITE, client_socket));
+    io_uring_prep_send(sqe, c->fd, conn_bufs(c)->out + c->out_sent, c->out_len - c->out_sent, 0);
+    io_uring_sqe_set_data64(sqe, PACK(OP_WRITE, conn_slab_handle(&c->slot)));
 }
 
 static void close_socket(int fd)
@@ -78,6 +122,113 @@ static void close_socket(int fd)
     close(fd);
 }
 
+/* Closes the connection and frees its slot; its handles go stale. */
+static void close_conn(conn_t *c)
+{
+    close_socket(c->fd);
+    conn_slab_free(&conns, c);
+}
+
+/**
+ * Answers the complete requests at the start of buf into the connection's
+ * out, until it has less than handler_response_min bytes of room.
+ * @param server The server.
+ * @param c The connection.
+ * @param buf The received bytes.
+ * @param len Number of bytes in buf.
+ * @return Bytes consumed; all of them once the connection is to be closed.
+ */
+static size_t answer_requests(const Server *server, conn_t *c, const char *buf, size_t len)
+{
+    char *out = conn_bufs(c)->out;
+    size_t offset = 0;
+    while (offset < len && out_buffer_size - c->out_len >= handler_response_min)
+    {
+        http_request_t request;
+        int consumed = http_parse_request(&c->parser, buf + offset, len - offset, &request);
+        if (consumed == HTTP_PARSE_INCOMPLETE)
+            break;
+        if (consumed == HTTP_PARSE_ERROR)
+        {
+            memcpy(out + c->out_len, bad_request, sizeof(bad_request) - 1);
+            c->out_len += sizeof(bad_request) - 1;
+            c->close_after_write = 1;
+            return len;
+        }
+
+        response_writer_t res;
+        response_writer_init(&res, out + c->out_len, out_buffer_size - c->out_len);
+        if (server->request_handler)
+        {
+            request_view_t view;
+            request_view_init(&view, &request);
+            server->request_handler(server->handler_data, &view, &res);
+        }
+        if (res.len == 0)
+            response_write(&res, response, sizeof(response) - 1);
+        c->out_len += res.len;
+        http_parser_reset(&c->parser);
+        if (!request.keep_alive)
+        {
+            c->close_after_write = 1;
+            return len;
+        }
+        offset += consumed;
+    }
+    return offset;
+}
+
+/**
+ * Answers what partial holds and keeps the rest at its front. An incomplete
+ * request of buffer_size bytes or more is rejected.
+ * @param server The server.
+ * @param c The connection.
+ */
+static void answer_partial(const Server *server, conn_t *c)
+{
+    conn_bufs_t *b = conn_bufs(c);
+    size_t used = answer_requests(server, c, b->partial, c->partial_len);
+    memmove(b->partial, b->partial + used, c->partial_len - used);
+    c->partial_len -= used;
+    if (c->partial_len >= buffer_size && !c->out_len)
+    {
+        memcpy(b->out, bad_request, sizeof(bad_request) - 1);
+        c->out_len = sizeof(bad_request) - 1;
+        c->close_after_write = 1;
+    }
+}
+
+/**
+ * Takes the bytes of one read: answers the requests they complete and keeps
+ * the unanswered tail in partial.
+ * @param server The server.
+ * @param c The connection.
+ * @param data The provided buffer the read landed in.
+ * @param len Bytes read.
+ */
+static void conn_input(const Server *server, conn_t *c, const char *data, size_t len)
+{
+    conn_bufs_t *b = conn_bufs(c);
+    if (c->partial_len == 0)
+    {
+        // Common case: parse in place, copy only what is left over
+        size_t used = answer_requests(server, c, data, len);
+        memcpy(b->partial, data + used, len - used);
+        c->partial_len = len - used;
+        return;
+    }
+    if (len > sizeof(b->partial) - c->partial_len)
+    {
+        memcpy(b->out + c->out_len, bad_request, sizeof(bad_request) - 1);
+        c->out_len += sizeof(bad_request) - 1;
+        c->close_after_write = 1;
+        return;
+    }
+    memcpy(b->partial + c->partial_len, data, len);
+    c->partial_len += len;
+    answer_partial(server, c);
+}
+
 static int create_server_socket(int port)
 {
     int server_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
@@ -109,6 +260,12 @@ static void server_run(Server *server)
 {
     printf("listening on http://localhost:%d/\n", server->port);
 
+    if (conn_slab_init(&conns, max_conns, sizeof(conn_t), sizeof(conn_bufs_t)) < 0)
+    {
+        perror("conn_slab_init");
+        exit(1);
+    }
+
     server->socket_fd = create_server_socket(server->port);
     if (server->socket_fd < 0)
     {
@@ -179,47 +336,73 @@ static void server_run(Server *server)
             count++;
             uint64_t data = io_uring_cqe_get_data64(cqe);
             int op = UNPACK_OP(data);
-            int fd = UNPACK_FD(data);
+            conn_t *c = op == OP_ACCEPT ? NULL : conn_slab_get(&conns, data);
             int res = cqe->res;
 
             switch (op)
             {
             case OP_ACCEPT:
-                if (res >= 0)
+                if (res >= 0 && !(c = conn_slab_alloc(&conns)))
+                    close_socket(res);
+                else if (res >= 0)
                 {
-                    int client_socket = res;
-                    prepare_read(&ring, client_socket);
+                    c->fd = res;
+                    http_parser_reset(&c->parser);
+                    c->partial_len = c->out_len = c->out_sent = 0;
+                    c->close_after_write = 0;
+                    prepare_read(&ring, c);
                 }
                 if (!(cqe->flags & IORING_CQE_F_MORE))
                     prepare_accept(&ring, server->socket_fd);
                 break;
 
             case OP_READ:
-                if (res > 0)
-                {
-                    prepare_write(&ring, fd);
-                }
-                else
-                {
-                    close_socket(fd);
-                }
                 if (cqe->flags & IORING_CQE_F_BUFFER)
                 {
+                    // The buffer goes back even when the connection is gone
                     uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                    if (c && res > 0)
+                        conn_input(server, c, request_buffers[bid], res);
                     io_uring_buf_ring_add(buf_ring, request_buffers[bid], buffer_size, bid, buf_ring_mask, 0);
                     io_uring_buf_ring_advance(buf_ring, 1);
                 }
+                if (!c)
+                    break; // stale: the slot was freed since the read was armed
+                if (res <= 0)
+                    close_conn(c);
+                else if (c->out_len)
+                    prepare_write(&ring, c);
+                else
+                    prepare_read(&ring, c);
                 break;
 
             case OP_WRITE:
-                if (res >= 0)
+                if (!c)
+                    break;
+                if (res <= 0)
                 {
-                    prepare_read(&ring, fd);
+                    close_conn(c);
+                    break;
                 }
-                else
+                c->out_sent += res;
+                if (c->out_sent < c->out_len)
+                {
+                    prepare_write(&ring, c); // short send: the rest
+                    break;
+                }
+                c->out_len = c->out_sent = 0;
+                if (c->close_after_write)
                 {
-                    close_socket(fd);
+                    close_conn(c);
+                    break;
                 }
+                // Requests left over from a full out
+                if (c->partial_len)
+                    answer_partial(server, c);
+                if (c->out_len)
+                    prepare_write(&ring, c);
+                else
+                    prepare_read(&ring, c);
                 break;
             }
         }
@@ -234,9 +417,9 @@ static void server_run(Server *server)
     {
         uint64_t data = io_uring_cqe_get_data64(cqe);
         int op = UNPACK_OP(data);
-        int fd = UNPACK_FD(data);
-        if (op == OP_READ || op == OP_WRITE)
-            close_socket(fd);
+        conn_t *c = op == OP_ACCEPT ? NULL : conn_slab_get(&conns, data);
+        if (c)
+            close_conn(c);
         if (op == OP_READ && (cqe->flags & IORING_CQE_F_BUFFER))
         {
             uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
@@ -250,15 +433,51 @@ static void server_run(Server *server)
     munmap(buf_ring, buf_ring_size);
     io_uring_queue_exit(&ring);
     close_socket(server->socket_fd);
+    conn_slab_destroy(&conns);
     puts("Server stopped.");
 }
 
+static void ok_handler(void *data, request_view_t *req, response_writer_t *res)
+{
+    (void)data;
+    (void)req;
+    response_write(res, response, sizeof(response) - 1);
+}
+
+static void user_handler(void *data, request_view_t *req, response_writer_t *res)
+{
+    (void)data;
+    http_slice_t id = request_param(req, "id");
+    char body[128];
+    int len = snprintf(body, sizeof(body), "user %.*s", (int)id.len, id.ptr);
+    response_send(res, "200 OK", "text/plain", body, len < (int)sizeof(body) ? len : (int)sizeof(body) - 1);
+}
+
 int main(void)
 {
+    // GET / answers "OK" as before; other paths are 404 (405 for another method)
+    router_t router;
+    router_init(&router);
+    if (router_add(&router, "GET", "/", ok_handler, NULL) < 0 ||
+        router_add(&router, "GET", "/user/:id", user_handler, NULL) < 0)
+    {
+        fputs("router_add failed\n", stderr);
+        return 1;
+    }
+    // Served from the flattened copy (flat_router.h)
+    static flat_router_t flat_router;
+    if (flat_router_build(&flat_router, &router) < 0)
+    {
+        fputs("flat_router_build failed\n", stderr);
+        return 1;
+    }
+    router_free(&router);
+
     Server server = {
         .port = 8080,
         .socket_fd = -1,
-        .request_handler = NULL // Not used in this io_uring version
+        .request_handler = flat_router_dispatch,
+        .handler_data = &flat_router,
     };
     server_run(&server);
     return 0;
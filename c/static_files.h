@@ -0,0 +1,495 @@
+// static_files.h — Static file responses backed by a per-worker open-file cache
+// Header-only, shared by the servers in this directory: #include "static_files.h"
+//
+// A static_cache_t maps request paths (relative to a root directory) to an open
+// file descriptor plus the stat results and validators a response head needs,
+// so a hot file costs no open()/fstat() per request. Entries are kept in LRU
+// order and revalidated with one fstatat() at most every STATIC_REVALIDATE_SEC
+// seconds, which picks up files replaced on disk. A cache is not thread-safe:
+// give each worker its own.
+//
+// static_respond() renders the response head (200, 206, 304, 404, 405, 416 or
+// 503) and returns the byte range of the file to send after it. Sending is
+// left to the engine (sendfile, splice, ...). The file stays open until the
+// engine calls static_file_put(), even if the entry is evicted meanwhile.
+
+#ifndef STATIC_FILES_H
+#define STATIC_FILES_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/openat2.h>
+#include "http_parser.h"
+
+#ifndef STATIC_CACHE_ENTRIES
+#define STATIC_CACHE_ENTRIES 1024 /* open files kept per worker */
+#endif
+#define STATIC_CACHE_BUCKETS 2048 /* power of two, >= 2 * STATIC_CACHE_ENTRIES */
+#define STATIC_PATH_MAX 256
+#define STATIC_HEAD_MAX 512 /* room for the longest head static_respond renders */
+#define STATIC_REVALIDATE_SEC 1
+
+typedef struct static_file
+{
+    struct static_file *hash_next; // bucket chain; free list when unused
+    struct static_file *lru_prev;
+    struct static_file *lru_next;
+    uint32_t hash;
+    unsigned refs; // one for the cache while cached, one per response in flight
+    int fd;
+    off_t size;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    time_t checked; // last revalidation, CLOCK_MONOTONIC_COARSE seconds
+    const char *content_type;
+    size_t etag_len;
+    char etag[48];
+    char last_modified[32];
+    size_t path_len;
+    char path[STATIC_PATH_MAX];
+} static_file_t;
+
+typedef struct
+{
+    int root_fd;
+    unsigned used; // entries of files[] handed out so far
+    static_file_t *free_list;
+    static_file_t *lru_head; // most recently used
+    static_file_t *lru_tail;
+    static_file_t *buckets[STATIC_CACHE_BUCKETS];
+    static_file_t files[STATIC_CACHE_ENTRIES];
+} static_cache_t;
+
+/**
+ * Prepares an empty cache serving files below root.
+ * @param cache The cache (large: allocate it, one per worker).
+ * @param root The directory to serve.
+ * @return 0 on success, -1 if root cannot be opened (every lookup then fails).
+ */
+static inline int static_cache_init(static_cache_t *cache, const char *root)
+{
+    memset(cache->buckets, 0, sizeof(cache->buckets));
+    cache->used = 0;
+    cache->free_list = NULL;
+    cache->lru_head = NULL;
+    cache->lru_tail = NULL;
+    cache->root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    return cache->root_fd < 0 ? -1 : 0;
+}
+
+static inline uint32_t static_hash(const char *path, size_t len)
+{
+    uint32_t h = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)path[i]) * 16777619u;
+    return h;
+}
+
+static inline const char *static_content_type(const char *path, size_t len)
+{
+    static const struct
+    {
+        const char *ext;
+        const char *type;
+    } types[] = {
+        {".html", "text/html; charset=utf-8"},
+        {".css", "text/css; charset=utf-8"},
+        {".js", "text/javascript; charset=utf-8"},
+        {".json", "application/json"},
+        {".txt", "text/plain; charset=utf-8"},
+        {".svg", "image/svg+xml"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"},
+        {".gif", "image/gif"},
+        {".webp", "image/webp"},
+        {".ico", "image/x-icon"},
+        {".woff2", "font/woff2"},
+        {".wasm", "application/wasm"},
+        {".pdf", "application/pdf"},
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+    {
+        size_t n = strlen(types[i].ext);
+        if (len > n && memcmp(path + len - n, types[i].ext, n) == 0)
+            return types[i].type;
+    }
+    return "application/octet-stream";
+}
+
+/**
+ * Checks that a request path stays below the root: relative, no NUL and no
+ * ".." component. Symlinks are contained by RESOLVE_BENEATH on open.
+ */
+static inline int static_path_ok(const char *path, size_t len)
+{
+    if (len == 0 || len >= STATIC_PATH_MAX || path[0] == '/' || memchr(path, '\0', len))
+        return 0;
+    for (size_t i = 0; i < len;)
+    {
+        size_t j = i;
+        while (j < len && path[j] != '/')
+            j++;
+        if (j - i == 2 && path[i] == '.' && path[i + 1] == '.')
+            return 0;
+        i = j + 1;
+    }
+    return 1;
+}
+
+static inline int static_open(int root_fd, const char *path)
+{
+#ifdef SYS_openat2
+    struct open_how how = {
+        .flags = O_RDONLY | O_CLOEXEC,
+        .resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS};
+    int fd = (int)syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+    if (fd >= 0 || errno != ENOSYS)
+        return fd;
+#endif
+    return openat(root_fd, path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+}
+
+static inline void static_lru_unlink(static_cache_t *cache, static_file_t *f)
+{
+    if (f->lru_prev)
+        f->lru_prev->lru_next = f->lru_next;
+    else
+        cache->lru_head = f->lru_next;
+    if (f->lru_next)
+        f->lru_next->lru_prev = f->lru_prev;
+    else
+        cache->lru_tail = f->lru_prev;
+}
+
+static inline void static_lru_push(static_cache_t *cache, static_file_t *f)
+{
+    f->lru_prev = NULL;
+    f->lru_next = cache->lru_head;
+    if (cache->lru_head)
+        cache->lru_head->lru_prev = f;
+    else
+        cache->lru_tail = f;
+    cache->lru_head = f;
+}
+
+/**
+ * Drops a reference taken by static_cache_get(). The descriptor is closed
+ * once the entry is neither cached nor being sent.
+ * @param cache The cache the file came from.
+ * @param f The file.
+ */
+static inline void static_file_put(static_cache_t *cache, static_file_t *f)
+{
+    if (--f->refs)
+        return;
+    close(f->fd);
+    f->hash_next = cache->free_list;
+    cache->free_list = f;
+}
+
+static inline void static_evict(static_cache_t *cache, static_file_t *f)
+{
+    static_file_t **p = &cache->buckets[f->hash & (STATIC_CACHE_BUCKETS - 1)];
+    while (*p != f)
+        p = &(*p)->hash_next;
+    *p = f->hash_next;
+    static_lru_unlink(cache, f);
+    static_file_put(cache, f);
+}
+
+static inline int static_stat_matches(const static_file_t *f, const struct stat *st)
+{
+    return st->st_dev == f->dev && st->st_ino == f->ino && st->st_size == f->size &&
+           st->st_mtim.tv_sec == f->mtime.tv_sec && st->st_mtim.tv_nsec == f->mtime.tv_nsec;
+}
+
+/**
+ * Finds or opens a file below the cache root and takes a reference to it.
+ * @param cache The worker's cache.
+ * @param path Path relative to the root (not NUL-terminated).
+ * @param len Length of the path.
+ * @return The file, or NULL with errno set (ENOENT for anything not servable,
+ *         EMFILE when every entry is being sent).
+ */
+static inline static_file_t *static_cache_get(static_cache_t *cache, const char *path, size_t len)
+{
+    if (cache->root_fd < 0 || !static_path_ok(path, len))
+    {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    uint32_t hash = static_hash(path, len);
+
+    for (static_file_t *f = cache->buckets[hash & (STATIC_CACHE_BUCKETS - 1)]; f; f = f->hash_next)
+    {
+        if (f->hash != hash || f->path_len != len || memcmp(f->path, path, len) != 0)
+            continue;
+        if (now.tv_sec - f->checked >= STATIC_REVALIDATE_SEC)
+        {
+            struct stat st;
+            if (fstatat(cache->root_fd, f->path, &st, AT_SYMLINK_NOFOLLOW) < 0 || !static_stat_matches(f, &st))
+            {
+                static_evict(cache, f); // changed on disk: reopen below
+                break;
+            }
+            f->checked = now.tv_sec;
+        }
+        static_lru_unlink(cache, f);
+        static_lru_push(cache, f);
+        f->refs++;
+        return f;
+    }
+
+    // Miss: take a free entry, evicting from the cold end if needed
+    while (!cache->free_list && cache->used == STATIC_CACHE_ENTRIES && cache->lru_tail)
+        static_evict(cache, cache->lru_tail);
+    static_file_t *f;
+    if (cache->free_list)
+    {
+        f = cache->free_list;
+        cache->free_list = f->hash_next;
+    }
+    else if (cache->used < STATIC_CACHE_ENTRIES)
+        f = &cache->files[cache->used++];
+    else
+    {
+        errno = EMFILE;
+        return NULL;
+    }
+
+    memcpy(f->path, path, len);
+    f->path[len] = '\0';
+    struct stat st;
+    int fd = static_open(cache->root_fd, f->path);
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        int err = errno;
+        if (fd >= 0)
+            close(fd);
+        f->hash_next = cache->free_list;
+        cache->free_list = f;
+        errno = (fd < 0 && (err == EMFILE || err == ENFILE)) ? EMFILE : ENOENT;
+        return NULL;
+    }
+
+    f->fd = fd;
+    f->hash = hash;
+    f->path_len = len;
+    f->size = st.st_size;
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    f->mtime = st.st_mtim;
+    f->checked = now.tv_sec;
+    f->content_type = static_content_type(path, len);
+    f->etag_len = (size_t)snprintf(f->etag, sizeof(f->etag), "\"%llx-%llx\"",
+                                   (unsigned long long)st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec,
+                                   (unsigned long long)st.st_size);
+    struct tm tm;
+    gmtime_r(&st.st_mtim.tv_sec, &tm);
+    strftime(f->last_modified, sizeof(f->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+    f->refs = 2; // the cache's and the caller's
+    static_file_t **bucket = &cache->buckets[hash & (STATIC_CACHE_BUCKETS - 1)];
+    f->hash_next = *bucket;
+    *bucket = f;
+    static_lru_push(cache, f);
+    return f;
+}
+
+/**
+ * Checks an If-None-Match value against the file's ETag, using the weak
+ * comparison RFC 9110 13.1.2 requires: a W/ prefix is ignored.
+ */
+static inline int static_etag_match(http_slice_t value, const static_file_t *f)
+{
+    const char *p = value.ptr, *end = value.ptr + value.len;
+    while (p < end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+            p++;
+        if (p < end && *p == '*')
+            return 1;
+        if (end - p >= 2 && p[0] == 'W' && p[1] == '/')
+            p += 2;
+        const char *tag = p;
+        if (p < end && *p == '"')
+        {
+            p++;
+            while (p < end && *p != '"')
+                p++;
+            if (p < end)
+                p++;
+        }
+        if ((size_t)(p - tag) == f->etag_len && memcmp(tag, f->etag, f->etag_len) == 0)
+            return 1;
+        while (p < end && *p != ',')
+            p++;
+    }
+    return 0;
+}
+
+static inline int static_parse_uint(const char **p, const char *end, unsigned long long *out)
+{
+    if (*p == end || **p < '0' || **p > '9')
+        return -1;
+    unsigned long long v = 0;
+    while (*p < end && **p >= '0' && **p <= '9')
+    {
+        if (v > (~0ull - 9) / 10)
+            return -1;
+        v = v * 10 + (unsigned long long)(**p - '0');
+        (*p)++;
+    }
+    *out = v;
+    return 0;
+}
+
+/**
+ * Parses a single-range Range header ("bytes=a-b", "bytes=a-", "bytes=-n").
+ * Anything else (other units, several ranges, bad syntax) is ignored and the
+ * whole file is sent, which RFC 9110 14.2 allows.
+ * @param value The header value.
+ * @param size The file size.
+ * @param off Set to the first byte of the range.
+ * @param len Set to the length of the range.
+ * @return 1 for a satisfiable range, 0 to ignore the header, -1 for 416.
+ */
+static inline int static_parse_range(http_slice_t value, off_t size, off_t *off, size_t *len)
+{
+    const char *p = value.ptr, *end = value.ptr + value.len;
+    if (value.len < 7 || memcmp(p, "bytes=", 6) != 0 || memchr(p, ',', value.len))
+        return 0;
+    p += 6;
+
+    unsigned long long first, last = (unsigned long long)size - 1;
+    if (*p == '-')
+    {
+        p++;
+        unsigned long long suffix;
+        if (static_parse_uint(&p, end, &suffix) < 0 || p != end)
+            return 0;
+        if (suffix == 0 || size == 0)
+            return -1;
+        first = suffix >= (unsigned long long)size ? 0 : (unsigned long long)size - suffix;
+    }
+    else
+    {
+        if (static_parse_uint(&p, end, &first) < 0 || p == end || *p++ != '-')
+            return 0;
+        if (p != end)
+        {
+            if (static_parse_uint(&p, end, &last) < 0 || p != end || last < first)
+                return 0;
+            if (last >= (unsigned long long)size)
+                last = (unsigned long long)size - 1;
+        }
+        if (first >= (unsigned long long)size)
+            return -1;
+    }
+    *off = (off_t)first;
+    *len = (size_t)(last - first + 1);
+    return 1;
+}
+
+/**
+ * Renders the response to a static file request and tells the caller what to
+ * send after the head. HEAD requests, 304s and errors have no body.
+ * @param cache The worker's cache.
+ * @param req The parsed request.
+ * @param path Path relative to the cache root, without the query string.
+ * @param path_len Length of the path.
+ * @param head Buffer for the response head, at least STATIC_HEAD_MAX bytes.
+ * @param file Set to the file whose bytes follow the head (a reference the
+ *             caller drops with static_file_put()), or NULL.
+ * @param off Set to the first file byte to send.
+ * @param len Set to the number of file bytes to send.
+ * @return Length of the head.
+ */
+static inline size_t static_respond(static_cache_t *cache, const http_request_t *req, const char *path, size_t path_len,
+                                    char *head, static_file_t **file, off_t *off, size_t *len)
+{
+    const char *connection = req->keep_alive ? "" : "Connection: close\r\n";
+    *file = NULL;
+    *off = 0;
+    *len = 0;
+
+    int head_only = http_slice_ieq(req->method, "head", 4);
+    if (!head_only && !http_slice_ieq(req->method, "get", 3))
+        return (size_t)snprintf(head, STATIC_HEAD_MAX,
+                                "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Length: 0\r\n%s\r\n",
+                                connection);
+
+    static_file_t *f = static_cache_get(cache, path, path_len);
+    if (!f)
+        return (size_t)snprintf(head, STATIC_HEAD_MAX, "HTTP/1.1 %s\r\nContent-Length: 0\r\n%s\r\n",
+                                errno == EMFILE ? "503 Service Unavailable" : "404 Not Found", connection);
+
+    const http_header_t *h = http_find_header(req, "if-none-match", 13);
+    if (h && static_etag_match(h->value, f))
+    {
+        size_t n = (size_t)snprintf(head, STATIC_HEAD_MAX, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n%s\r\n",
+                                    f->etag, connection);
+        static_file_put(cache, f);
+        return n;
+    }
+
+    off_t start = 0;
+    size_t count = (size_t)f->size;
+    int partial = 0;
+    h = http_find_header(req, "range", 5);
+    if (h)
+    {
+        // If-Range with another validator: the client's copy is stale, send it all
+        const http_header_t *if_range = http_find_header(req, "if-range", 8);
+        if (!if_range || (if_range->value.len == f->etag_len && memcmp(if_range->value.ptr, f->etag, f->etag_len) == 0))
+        {
+            partial = static_parse_range(h->value, f->size, &start, &count);
+            if (partial < 0)
+            {
+                size_t n = (size_t)snprintf(head, STATIC_HEAD_MAX,
+                                            "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%lld\r\n"
+                                            "Content-Length: 0\r\n%s\r\n",
+                                            (long long)f->size, connection);
+                static_file_put(cache, f);
+                return n;
+            }
+        }
+    }
+
+    size_t n;
+    if (partial)
+        n = (size_t)snprintf(head, STATIC_HEAD_MAX,
+                             "HTTP/1.1 206 Partial Content\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                             "Content-Range: bytes %lld-%lld/%lld\r\nETag: %s\r\nLast-Modified: %s\r\n%s\r\n",
+                             f->content_type, count, (long long)start, (long long)start + (long long)count - 1,
+                             (long long)f->size, f->etag, f->last_modified, connection);
+    else
+        n = (size_t)snprintf(head, STATIC_HEAD_MAX,
+                             "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\nAccept-Ranges: bytes\r\n"
+                             "ETag: %s\r\nLast-Modified: %s\r\n%s\r\n",
+                             f->content_type, count, f->etag, f->last_modified, connection);
+
+    if (head_only || count == 0)
+        static_file_put(cache, f);
+    else
+    {
+        *file = f;
+        *off = start;
+        *len = count;
+    }
+    return n;
+}
+
+#endif
@@ -0,0 +1,230 @@
+// timer_wheel.h — Hierarchical timing wheel for per-connection timeouts
+// Header-only, shared by the servers in this directory: #include "timer_wheel.h"
+//
+// Timers are named by a small integer (the connection's index) and live in an
+// array owned by the wheel, so connection structs do not grow. Arm, cancel and
+// expire are O(1): four levels of 256/64/64/64 slots holding doubly linked
+// lists, where timers in an upper level cascade down as time reaches their
+// slot (Varghese & Lauck, as in the classic Linux timer wheel). Re-arming to a
+// later deadline only stores the deadline; the timer is moved when its old slot
+// comes due, so a busy connection pushes its idle timeout back for the cost of
+// a store. Time is counted in caller-defined ticks. One wheel per worker: not
+// thread-safe.
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define TW_L0_BITS 8
+#define TW_LN_BITS 6
+#define TW_L0_SIZE (1u << TW_L0_BITS)
+#define TW_LN_SIZE (1u << TW_LN_BITS)
+#define TW_SLOTS (TW_L0_SIZE + 3 * TW_LN_SIZE)
+#define TW_HEADS (TW_SLOTS + 1) /* slots + the list being drained */
+#define TW_MAX_DELTA ((1u << (TW_L0_BITS + 3 * TW_LN_BITS)) - 1) /* longest timeout, in ticks */
+#define TW_NONE UINT32_MAX
+
+typedef struct
+{
+    uint32_t prev; // TW_NONE when not armed
+    uint32_t next;
+    uint32_t expires; // deadline
+    uint32_t slotted; // deadline the node's current slot was chosen for (<= expires)
+} tw_node_t;
+
+typedef void (*timer_wheel_cb)(void *arg, uint32_t id);
+
+typedef struct
+{
+    uint32_t now;      // next tick to process
+    uint32_t capacity; // timer ids are 0 .. capacity - 1
+    uint32_t count;    // armed timers
+    tw_node_t *nodes;  // capacity timers, then TW_HEADS list heads
+} timer_wheel_t;
+
+/**
+ * Allocates a wheel for timer ids 0 .. capacity - 1, none armed.
+ * @param tw The wheel.
+ * @param capacity Number of timer ids.
+ * @param now The current tick.
+ * @return 0 on success, -1 if out of memory.
+ */
+static inline int timer_wheel_init(timer_wheel_t *tw, uint32_t capacity, uint32_t now)
+{
+    tw->nodes = malloc((size_t)(capacity + TW_HEADS) * sizeof(tw_node_t));
+    if (!tw->nodes)
+        return -1;
+    tw->now = now;
+    tw->capacity = capacity;
+    tw->count = 0;
+    for (uint32_t i = 0; i < capacity; i++)
+        tw->nodes[i].prev = TW_NONE;
+    for (uint32_t i = capacity; i < capacity + TW_HEADS; i++)
+        tw->nodes[i].prev = tw->nodes[i].next = i;
+    return 0;
+}
+
+static inline void timer_wheel_destroy(timer_wheel_t *tw)
+{
+    free(tw->nodes);
+    tw->nodes = NULL;
+}
+
+static inline void tw_unlink(timer_wheel_t *tw, uint32_t id)
+{
+    tw_node_t *n = &tw->nodes[id];
+    tw->nodes[n->prev].next = n->next;
+    tw->nodes[n->next].prev = n->prev;
+    n->prev = TW_NONE;
+}
+
+/* Links a timer into the slot for its deadline. */
+static inline void tw_insert(timer_wheel_t *tw, uint32_t id)
+{
+    tw_node_t *n = &tw->nodes[id];
+    uint32_t expires = n->expires;
+    uint32_t delta = expires - tw->now;
+    uint32_t slot;
+    if ((int32_t)delta < 0)
+    {
+        expires = tw->now; // overdue: run on the next tick
+        slot = expires & (TW_L0_SIZE - 1);
+    }
+    else if (delta < TW_L0_SIZE)
+        slot = expires & (TW_L0_SIZE - 1);
+    else if (delta < 1u << (TW_L0_BITS + TW_LN_BITS))
+        slot = TW_L0_SIZE + ((expires >> TW_L0_BITS) & (TW_LN_SIZE - 1));
+    else if (delta < 1u << (TW_L0_BITS + 2 * TW_LN_BITS))
+        slot = TW_L0_SIZE + TW_LN_SIZE + ((expires >> (TW_L0_BITS + TW_LN_BITS)) & (TW_LN_SIZE - 1));
+    else
+    {
+        if (delta > TW_MAX_DELTA)
+            n->expires = expires = tw->now + TW_MAX_DELTA;
+        slot = TW_L0_SIZE + 2 * TW_LN_SIZE + ((expires >> (TW_L0_BITS + 2 * TW_LN_BITS)) & (TW_LN_SIZE - 1));
+    }
+    n->slotted = n->expires;
+
+    uint32_t head = tw->capacity + slot;
+    n->next = head;
+    n->prev = tw->nodes[head].prev;
+    tw->nodes[n->prev].next = id;
+    tw->nodes[head].prev = id;
+}
+
+/**
+ * Arms (or re-arms) a timer to fire after timeout ticks.
+ * @param tw The wheel.
+ * @param id The timer.
+ * @param timeout Ticks from now; at most TW_MAX_DELTA.
+ */
+static inline void timer_wheel_arm(timer_wheel_t *tw, uint32_t id, uint32_t timeout)
+{
+    tw_node_t *n = &tw->nodes[id];
+    uint32_t expires = tw->now + timeout;
+    if (n->prev != TW_NONE)
+    {
+        if ((int32_t)(expires - n->slotted) >= 0)
+        {
+            n->expires = expires; // later: move it when the old slot comes due
+            return;
+        }
+        tw_unlink(tw, id);
+        tw->count--;
+    }
+    n->expires = expires;
+    tw_insert(tw, id);
+    tw->count++;
+}
+
+/**
+ * Disarms a timer; no-op if it is not armed.
+ * @param tw The wheel.
+ * @param id The timer.
+ */
+static inline void timer_wheel_cancel(timer_wheel_t *tw, uint32_t id)
+{
+    if (tw->nodes[id].prev == TW_NONE)
+        return;
+    tw_unlink(tw, id);
+    tw->count--;
+}
+
+/*
+ * Moves a slot's list to the drain head and returns it. Timers re-slotted
+ * while draining may land in the same slot again, so it must be empty first.
+ */
+static inline uint32_t tw_take(timer_wheel_t *tw, uint32_t slot)
+{
+    uint32_t head = tw->capacity + slot, drain = tw->capacity + TW_SLOTS;
+    tw_node_t *h = &tw->nodes[head], *d = &tw->nodes[drain];
+    if (h->next == head)
+    {
+        d->next = d->prev = drain;
+        return drain;
+    }
+    d->next = h->next;
+    d->prev = h->prev;
+    tw->nodes[d->next].prev = drain;
+    tw->nodes[d->prev].next = drain;
+    h->next = h->prev = head;
+    return drain;
+}
+
+/* Re-slots every timer of an upper-level slot; returns the slot index. */
+static inline uint32_t tw_cascade(timer_wheel_t *tw, uint32_t level, uint32_t index)
+{
+    uint32_t head = tw_take(tw, TW_L0_SIZE + (level - 1) * TW_LN_SIZE + index);
+    while (tw->nodes[head].next != head)
+    {
+        uint32_t id = tw->nodes[head].next;
+        tw_unlink(tw, id);
+        tw_insert(tw, id);
+    }
+    return index;
+}
+
+/**
+ * Runs every tick up to and including now, calling expired(arg, id) for each
+ * timer that comes due; the timer is disarmed before the call, which may arm
+ * or cancel any timer.
+ * @param tw The wheel.
+ * @param now The current tick.
+ * @param expired Callback for due timers.
+ * @param arg Passed to the callback.
+ */
+static inline void timer_wheel_advance(timer_wheel_t *tw, uint32_t now, timer_wheel_cb expired, void *arg)
+{
+    if (!tw->count)
+    {
+        tw->now = now + 1; // nothing to cascade or run
+        return;
+    }
+    while ((int32_t)(now - tw->now) >= 0)
+    {
+        uint32_t tick = tw->now;
+        uint32_t index = tick & (TW_L0_SIZE - 1);
+        if (!index &&
+            !tw_cascade(tw, 1, (tick >> TW_L0_BITS) & (TW_LN_SIZE - 1)) &&
+            !tw_cascade(tw, 2, (tick >> (TW_L0_BITS + TW_LN_BITS)) & (TW_LN_SIZE - 1)))
+            tw_cascade(tw, 3, (tick >> (TW_L0_BITS + 2 * TW_LN_BITS)) & (TW_LN_SIZE - 1));
+        tw->now = tick + 1;
+
+        uint32_t head = tw_take(tw, index);
+        while (tw->nodes[head].next != head)
+        {
+            uint32_t id = tw->nodes[head].next;
+            tw_unlink(tw, id);
+            if ((int32_t)(tw->nodes[id].expires - tick) > 0)
+            {
+                tw_insert(tw, id); // re-armed later since it was slotted
+                continue;
+            }
+            tw->count--;
+            expired(arg, id);
+        }
+    }
+}
+
+#endif
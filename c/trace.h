@@ -0,0 +1,277 @@
+// trace.h — USDT probes on the request path and an optional per-worker trace ring
+// Header-only, shared by the servers in this directory: #include "trace.h"
+//
+// Four points of a request's life are traced: accept, read complete (bytes
+// received), dispatch (a request parsed and handed to its handler) and write
+// complete (bytes sent). Each is a static probe of provider "server" when
+// <sys/sdt.h> is installed (systemtap-sdt-dev): a nop until a tracer attaches,
+//   bpftrace -e 'usdt:./io_uring:server:dispatch { @[str(arg1, arg2)] = count(); }'
+// Arguments: accept (id, fd), read (id, bytes), dispatch (id, path, path_len),
+// write (id, bytes). id names the connection: its fd in epoll_simple.c, its
+// slab handle in io_uring.c (stays unique while the slot is reused).
+//
+// Build with -DTRACE_RING=<records> (a power of two) to also keep the last
+// records of every worker in memory, without a tracer: each event is 32 bytes
+// (timestamp, id, event, argument) written by the worker that owns the ring,
+// which only then publishes its head. kill -USR1 <pid> makes a dumper thread
+// copy every ring (dropping the records overwritten while it copied) into
+// trace-<pid>-<n>.bin; trace_report.c turns that into per-phase latencies and
+// the slowest requests. Each record reads the clock, so the ring is off by
+// default.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef TRACE_USDT
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define TRACE_USDT 1
+#endif
+#endif
+#endif
+#ifndef TRACE_USDT
+#define TRACE_USDT 0
+#endif
+
+#if TRACE_USDT
+#include <sys/sdt.h>
+#define TRACE_PROBE2(name, a, b) STAP_PROBE2(server, name, a, b)
+#define TRACE_PROBE3(name, a, b, c) STAP_PROBE3(server, name, a, b, c)
+#else
+#define TRACE_PROBE2(name, a, b) ((void)0)
+#define TRACE_PROBE3(name, a, b, c) ((void)0)
+#endif
+
+#ifndef TRACE_RING
+#define TRACE_RING 0 /* records per worker; 0: no ring */
+#endif
+#define TRACE_MAX_WORKERS 256
+#define TRACE_MAGIC "HTTRACE1"
+
+enum
+{
+    TRACE_ACCEPT,   // arg: fd
+    TRACE_READ,     // arg: bytes
+    TRACE_DISPATCH, // arg: the path's first 8 bytes
+    TRACE_WRITE,    // arg: bytes
+};
+
+typedef struct
+{
+    uint64_t ns; // CLOCK_MONOTONIC
+    uint64_t id;
+    uint64_t arg;
+    uint32_t event;
+    uint32_t worker; // filled in by the dump
+} trace_record_t;
+
+/*
+ * A dump: this header, then per ring a trace_dump_ring_t followed by its
+ * records, oldest first.
+ */
+typedef struct
+{
+    char magic[8];
+    uint32_t rings;
+    uint32_t record_size;
+} trace_dump_header_t;
+
+typedef struct
+{
+    char label[16];
+    uint64_t count;
+    uint64_t lost; // recorded before the oldest record kept
+} trace_dump_ring_t;
+
+#if TRACE_RING
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+_Static_assert((TRACE_RING & (TRACE_RING - 1)) == 0, "TRACE_RING is a power of two");
+
+typedef struct
+{
+    _Alignas(64) uint64_t head; // records ever written; only the owner writes it
+    char label[16];
+    trace_record_t records[TRACE_RING];
+} trace_ring_t;
+
+static trace_ring_t *trace_rings[TRACE_MAX_WORKERS];
+static int trace_ring_count;
+static __thread trace_ring_t *trace_local; // the calling worker's ring
+
+/**
+ * Gives the calling thread a ring of its own; events it traces before this
+ * (or after a failure) are only probes.
+ * @param label The ring's name in dumps (CPU number, "acceptor"...).
+ * @return 0 on success, -1 on failure.
+ */
+static inline int trace_register(const char *label)
+{
+    trace_ring_t *r = aligned_alloc(_Alignof(trace_ring_t), sizeof(trace_ring_t));
+    if (!r)
+        return -1;
+    memset(r, 0, sizeof(*r));
+    snprintf(r->label, sizeof(r->label), "%s", label);
+    int i = __atomic_fetch_add(&trace_ring_count, 1, __ATOMIC_RELAXED);
+    if (i >= TRACE_MAX_WORKERS)
+    {
+        free(r);
+        return -1;
+    }
+    __atomic_store_n(&trace_rings[i], r, __ATOMIC_RELEASE);
+    trace_local = r;
+    return 0;
+}
+
+static inline void trace_push(uint32_t event, uint64_t id, uint64_t arg)
+{
+    trace_ring_t *r = trace_local;
+    if (!r)
+        return;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t head = r->head;
+    trace_record_t *rec = &r->records[head & (TRACE_RING - 1)];
+    rec->ns = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    rec->id = id;
+    rec->arg = arg;
+    rec->event = event;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Writes one ring's records that were not overwritten while they were copied. */
+static void trace_dump_ring(FILE *out, trace_ring_t *r, uint32_t worker, trace_record_t *copy)
+{
+    uint64_t end = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    uint64_t start = end > TRACE_RING ? end - TRACE_RING : 0;
+    for (uint64_t i = start; i < end; i++)
+        copy[i - start] = r->records[i & (TRACE_RING - 1)];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    // Slots the worker reached meanwhile (including the one it may be
+    // writing now) can hold newer or torn records
+    uint64_t reached = __atomic_load_n(&r->head, __ATOMIC_RELAXED) + 1;
+    uint64_t skip = reached > TRACE_RING && reached - TRACE_RING > start ? reached - TRACE_RING - start : 0;
+    if (skip > end - start)
+        skip = end - start;
+    trace_dump_ring_t hdr = {.count = end - start - skip, .lost = start + skip};
+    memcpy(hdr.label, r->label, sizeof(hdr.label));
+    fwrite(&hdr, sizeof(hdr), 1, out);
+    for (uint64_t i = skip; i < end - start; i++)
+        copy[i].worker = worker;
+    fwrite(copy + skip, sizeof(trace_record_t), end - start - skip, out);
+}
+
+static void *trace_dumper(void *arg)
+{
+    sigset_t *set = arg;
+    trace_record_t *copy = malloc(sizeof(trace_record_t) * TRACE_RING);
+    for (int seq = 0; copy; seq++)
+    {
+        int sig;
+        if (sigwait(set, &sig) != 0)
+            continue;
+        char path[64];
+        snprintf(path, sizeof(path), "trace-%d-%d.bin", (int)getpid(), seq);
+        FILE *out = fopen(path, "wb");
+        if (!out)
+        {
+            perror(path);
+            continue;
+        }
+        int n = __atomic_load_n(&trace_ring_count, __ATOMIC_RELAXED);
+        if (n > TRACE_MAX_WORKERS)
+            n = TRACE_MAX_WORKERS;
+        trace_ring_t *rings[TRACE_MAX_WORKERS];
+        uint32_t count = 0;
+        for (int i = 0; i < n; i++)
+            if ((rings[count] = __atomic_load_n(&trace_rings[i], __ATOMIC_ACQUIRE)))
+                count++;
+        trace_dump_header_t hdr = {.rings = count, .record_size = sizeof(trace_record_t)};
+        memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+        fwrite(&hdr, sizeof(hdr), 1, out);
+        for (uint32_t i = 0; i < count; i++)
+            trace_dump_ring(out, rings[i], i, copy);
+        fclose(out);
+        fprintf(stderr, "trace: %u rings dumped to %s\n", count, path);
+    }
+    return NULL;
+}
+
+/**
+ * Starts the thread that dumps the rings on SIGUSR1. Call it before starting
+ * the workers: they inherit the signal blocked, so only the dumper gets it.
+ * @return 0 on success, -1 on failure (reported on stderr).
+ */
+static inline int trace_start(void)
+{
+    static sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_t tid;
+    if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0 || pthread_create(&tid, NULL, trace_dumper, &set) != 0)
+    {
+        perror("trace");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+#else
+
+static inline int trace_register(const char *label)
+{
+    (void)label;
+    return 0;
+}
+static inline void trace_push(uint32_t event, uint64_t id, uint64_t arg)
+{
+    (void)event;
+    (void)id;
+    (void)arg;
+}
+static inline int trace_start(void) { return 0; }
+
+#endif
+
+/* ===== Events: probe, then ring ===== */
+
+static inline void trace_accept(uint64_t id, int fd)
+{
+    TRACE_PROBE2(accept, id, fd);
+    trace_push(TRACE_ACCEPT, id, (uint64_t)fd);
+}
+
+static inline void trace_read(uint64_t id, size_t bytes)
+{
+    TRACE_PROBE2(read, id, bytes);
+    trace_push(TRACE_READ, id, bytes);
+}
+
+static inline void trace_dispatch(uint64_t id, const char *path, size_t path_len)
+{
+    TRACE_PROBE3(dispatch, id, path, path_len);
+    if (TRACE_RING)
+    {
+        uint64_t prefix = 0;
+        memcpy(&prefix, path, path_len < sizeof(prefix) ? path_len : sizeof(prefix));
+        trace_push(TRACE_DISPATCH, id, prefix);
+    }
+}
+
+static inline void trace_write(uint64_t id, size_t bytes)
+{
+    TRACE_PROBE2(write, id, bytes);
+    trace_push(TRACE_WRITE, id, bytes);
+}
+
+#endif
@@ -0,0 +1,278 @@
+// trace_report.c — Per-phase request latencies from trace ring dumps (trace.h)
+// gcc -O2 -o trace_report trace_report.c
+// Run with: ./trace_report trace-<pid>-<n>.bin...
+//
+// Merges the records of every ring in the dumps by time and follows each
+// connection through them:
+//   accept -> read      accepted until its first bytes arrive
+//   read -> dispatch    bytes in until a request in them is parsed and handed
+//                       to its handler (per request, from the read before it)
+//   dispatch -> write   handler and send: from the first request dispatched
+//                       since the connection's previous write to the next
+//                       write completion
+//   read -> write       the same burst, from the read its first request came in
+// and prints their percentiles and the slowest bursts, so a p99 spike can be
+// put on a phase. A connection whose accept fell out of its ring is picked up
+// at its first read. Lost records (older than a ring holds) are reported.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "histogram.h"
+#include "trace.h"
+
+#define SLOWEST 10
+
+enum
+{
+    PHASE_CONNECT,
+    PHASE_PARSE,
+    PHASE_SEND,
+    PHASE_TOTAL,
+    PHASE_COUNT
+};
+
+static const char *const phase_names[PHASE_COUNT] = {"accept -> read", "read -> dispatch", "dispatch -> write",
+                                                     "read -> write"};
+
+typedef struct
+{
+    uint64_t id;
+    uint8_t used;
+    uint8_t accepted; // waiting for the first read
+    uint32_t pending; // requests dispatched since the last write
+    uint64_t accept_ns, read_ns;
+    uint64_t burst_read_ns, burst_dispatch_ns, burst_path;
+} conn_state_t;
+
+typedef struct
+{
+    uint64_t total_ns, send_ns, parse_ns, at_ns, id, path;
+    uint32_t worker, requests;
+} burst_t;
+
+static conn_state_t *conns;
+static size_t conn_cap, conn_count;
+static histogram_t phases[PHASE_COUNT];
+static burst_t slowest[SLOWEST];
+static int slowest_count;
+static char (*labels)[16]; // per ring, over all the dumps
+static uint32_t ring_count;
+
+static uint64_t hash_id(uint64_t id)
+{
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdull;
+    return id ^ id >> 33;
+}
+
+static conn_state_t *conn_find(uint64_t id)
+{
+    if ((conn_count + 1) * 2 > conn_cap)
+    {
+        conn_state_t *old = conns;
+        size_t old_cap = conn_cap;
+        conn_cap = conn_cap ? conn_cap * 2 : 4096;
+        conns = calloc(conn_cap, sizeof(conn_state_t));
+        if (!conns)
+        {
+            perror("calloc");
+            exit(1);
+        }
+        for (size_t i = 0; i < old_cap; i++)
+            if (old[i].used)
+            {
+                size_t j = hash_id(old[i].id) & (conn_cap - 1);
+                while (conns[j].used)
+                    j = (j + 1) & (conn_cap - 1);
+                conns[j] = old[i];
+            }
+        free(old);
+    }
+    size_t j = hash_id(id) & (conn_cap - 1);
+    while (conns[j].used && conns[j].id != id)
+        j = (j + 1) & (conn_cap - 1);
+    if (!conns[j].used)
+    {
+        memset(&conns[j], 0, sizeof(conns[j]));
+        conns[j].used = 1;
+        conns[j].id = id;
+        conn_count++;
+    }
+    return &conns[j];
+}
+
+static void keep_if_slow(const burst_t *b)
+{
+    if (slowest_count == SLOWEST && slowest[SLOWEST - 1].total_ns >= b->total_ns)
+        return;
+    int i = slowest_count < SLOWEST ? slowest_count++ : SLOWEST - 1;
+    for (; i > 0 && slowest[i - 1].total_ns < b->total_ns; i--)
+        slowest[i] = slowest[i - 1];
+    slowest[i] = *b;
+}
+
+static void replay(const trace_record_t *r)
+{
+    conn_state_t *c = conn_find(r->id);
+    switch (r->event)
+    {
+    case TRACE_ACCEPT: // an fd may be reused: a new connection
+        memset(c, 0, sizeof(*c));
+        c->used = 1;
+        c->id = r->id;
+        c->accepted = 1;
+        c->accept_ns = r->ns;
+        break;
+    case TRACE_READ:
+        if (c->accepted)
+        {
+            histogram_record(&phases[PHASE_CONNECT], r->ns - c->accept_ns);
+            c->accepted = 0;
+        }
+        c->read_ns = r->ns;
+        break;
+    case TRACE_DISPATCH:
+        if (!c->read_ns)
+            break; // its read fell out of the ring
+        histogram_record(&phases[PHASE_PARSE], r->ns - c->read_ns);
+        if (!c->pending++)
+        {
+            c->burst_read_ns = c->read_ns;
+            c->burst_dispatch_ns = r->ns;
+            c->burst_path = r->arg;
+        }
+        break;
+    case TRACE_WRITE:
+        if (!c->pending)
+            break;
+        {
+            burst_t b = {
+                .total_ns = r->ns - c->burst_read_ns,
+                .send_ns = r->ns - c->burst_dispatch_ns,
+                .parse_ns = c->burst_dispatch_ns - c->burst_read_ns,
+                .at_ns = c->burst_read_ns,
+                .id = r->id,
+                .path = c->burst_path,
+                .worker = r->worker,
+                .requests = c->pending,
+            };
+            histogram_record(&phases[PHASE_SEND], b.send_ns);
+            histogram_record(&phases[PHASE_TOTAL], b.total_ns);
+            keep_if_slow(&b);
+        }
+        c->pending = 0;
+        break;
+    }
+}
+
+static int by_time(const void *a, const void *b)
+{
+    uint64_t x = ((const trace_record_t *)a)->ns, y = ((const trace_record_t *)b)->ns;
+    return (x > y) - (x < y);
+}
+
+/* Appends a dump's records to *records; returns -1 if it is not a dump. */
+static int load(const char *path, trace_record_t **records, size_t *count, size_t *cap)
+{
+    FILE *in = fopen(path, "rb");
+    if (!in)
+    {
+        perror(path);
+        return -1;
+    }
+    trace_dump_header_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0 ||
+        hdr.record_size != sizeof(trace_record_t))
+    {
+        fprintf(stderr, "%s: not a trace dump of this version\n", path);
+        fclose(in);
+        return -1;
+    }
+    uint64_t kept = 0, lost = 0;
+    for (uint32_t i = 0; i < hdr.rings; i++)
+    {
+        trace_dump_ring_t ring;
+        if (fread(&ring, sizeof(ring), 1, in) != 1)
+            break;
+        if (*count + ring.count > *cap)
+        {
+            *cap = (*count + ring.count) * 2;
+            *records = realloc(*records, *cap * sizeof(trace_record_t));
+            if (!*records)
+            {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        size_t n = fread(*records + *count, sizeof(trace_record_t), ring.count, in);
+        for (size_t r = 0; r < n; r++)
+            (*records)[*count + r].worker = ring_count;
+        labels = realloc(labels, (ring_count + 1) * sizeof(*labels));
+        if (!labels)
+        {
+            perror("realloc");
+            exit(1);
+        }
+        memcpy(labels[ring_count], ring.label, sizeof(*labels));
+        labels[ring_count++][sizeof(*labels) - 1] = 0;
+        *count += n;
+        kept += n;
+        lost += ring.lost;
+    }
+    fclose(in);
+    printf("%s: %u rings, %llu records, %llu lost before the oldest\n", path, hdr.rings, (unsigned long long)kept,
+           (unsigned long long)lost);
+    return 0;
+}
+
+static void print_path(uint64_t prefix)
+{
+    char path[sizeof(prefix) + 1] = {0};
+    memcpy(path, &prefix, sizeof(prefix));
+    for (size_t i = 0; i < sizeof(prefix); i++)
+        if (path[i] && (path[i] < 0x20 || path[i] > 0x7e))
+            path[i] = '?';
+    printf("%-9s", path);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s trace-<pid>-<n>.bin...\n", argv[0]);
+        return 1;
+    }
+    trace_record_t *records = NULL;
+    size_t count = 0, cap = 0;
+    for (int i = 1; i < argc; i++)
+        if (load(argv[i], &records, &count, &cap) < 0)
+            return 1;
+    if (!count)
+        return 0;
+    qsort(records, count, sizeof(trace_record_t), by_time);
+    for (size_t i = 0; i < count; i++)
+        replay(&records[i]);
+
+    printf("span %.6f s, %zu connections\n\n", (records[count - 1].ns - records[0].ns) / 1e9, conn_count);
+    printf("%-18s %10s %10s %10s %10s %10s   (us)\n", "phase", "count", "p50", "p99", "p99.9", "max");
+    for (int p = 0; p < PHASE_COUNT; p++)
+        printf("%-18s %10llu %10.1f %10.1f %10.1f %10.1f\n", phase_names[p], (unsigned long long)phases[p].count,
+               histogram_percentile(&phases[p], 50) / 1e3, histogram_percentile(&phases[p], 99) / 1e3,
+               histogram_percentile(&phases[p], 99.9) / 1e3, phases[p].max / 1e3);
+
+    printf("\nslowest bursts (read -> write):\n%12s %8s %18s %-9s %9s %10s %10s %10s\n", "at (s)", "worker", "id",
+           "path", "requests", "read->disp", "disp->write", "total (us)");
+    for (int i = 0; i < slowest_count; i++)
+    {
+        const burst_t *b = &slowest[i];
+        printf("%12.6f %8s %#18llx ", (b->at_ns - records[0].ns) / 1e9, labels[b->worker], (unsigned long long)b->id);
+        print_path(b->path);
+        printf(" %9u %10.1f %10.1f %10.1f\n", b->requests, b->parse_ns / 1e3, b->send_ns / 1e3, b->total_ns / 1e3);
+    }
+    free(records);
+    free(conns);
+    free(labels);
+    return 0;
+}
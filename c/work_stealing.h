@@ -0,0 +1,440 @@
+// work_stealing.h — Work-stealing executor for thread-pool servers: fds in, handler calls out
+// Header-only, shared by the servers in this directory: #include "work_stealing.h"
+//
+// Every worker owns a Chase–Lev deque (Lê et al., "Correct and Efficient
+// Work-Stealing for Weak Memory Models", PPoPP 2013) and an inbox. The
+// acceptor hands each fd to the least-loaded worker's inbox (mpmc_queue.h);
+// the worker moves a batch from its inbox to the bottom of its deque and runs
+// them from there. A worker with nothing left steals from the top of the other
+// deques and inboxes before sleeping on its own futex, so a worker stuck in a
+// slow handler does not hold up the fds queued behind it while other cores
+// idle. No lock is shared between the acceptor and the workers. With an idle
+// timeout set, workers that sleep that long exit from the last one down, to a
+// minimum; the acceptor reclaims their slots on its next submit.
+
+#ifndef WORK_STEALING_H
+#define WORK_STEALING_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+#include "mpmc_queue.h"
+
+#define WS_MAX_WORKERS 64
+#define WS_DEQUE_SIZE 256 /* power of two; never fills: only inbox batches go in */
+#define WS_INBOX_SIZE 256 /* power of two */
+#define WS_BATCH 16       /* fds moved from the inbox to the deque at once */
+
+typedef void (*ws_run_fn)(void *state, int fd);
+typedef void *(*ws_init_fn)(int index);
+typedef void (*ws_fini_fn)(void *state);
+
+/* Chase–Lev deque of fds: the owner pushes at the bottom; it and the thieves take from the top */
+typedef struct
+{
+    _Alignas(MPMC_CACHE_LINE) atomic_llong top;
+    _Alignas(MPMC_CACHE_LINE) atomic_llong bottom;
+    _Alignas(MPMC_CACHE_LINE) atomic_int cells[WS_DEQUE_SIZE];
+} ws_deque_t;
+
+typedef struct ws_executor ws_executor_t;
+
+typedef struct
+{
+    ws_deque_t deque;
+    mpmc_queue_t inbox;                        // fds handed over by the acceptor
+    _Alignas(MPMC_CACHE_LINE) atomic_int busy; // running a handler
+    atomic_int sleeping;                       // in (or entering) futex_wait
+    atomic_uint wake_seq;                      // futex word
+    atomic_int retiring;                       // idled out, checking its inbox one last time
+    atomic_int retired;                        // thread gone; the acceptor may reuse the slot
+    ws_executor_t *executor;
+    int index;
+    pthread_t tid;
+} ws_worker_t;
+
+struct ws_executor
+{
+    atomic_int count; // started workers, including retired ones not reclaimed yet
+    ws_run_fn run;
+    ws_init_fn init;
+    ws_fini_fn fini;
+    int min_workers;
+    unsigned idle_timeout_ms; // 0: workers never exit
+    ws_worker_t workers[WS_MAX_WORKERS];
+};
+
+/* ================= Deque ================= */
+
+/* Owner only; the deque must not be full. */
+static inline void ws_deque_push(ws_deque_t *d, int fd)
+{
+    long long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    atomic_store_explicit(&d->cells[b & (WS_DEQUE_SIZE - 1)], fd, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+}
+
+/* Owner or thief: oldest fd first. Returns 0, -1 when empty, -2 when it lost a race (retry). */
+static inline int ws_deque_steal(ws_deque_t *d, int *fd)
+{
+    long long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b)
+        return -1;
+    *fd = atomic_load_explicit(&d->cells[t & (WS_DEQUE_SIZE - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+        return -2;
+    return 0;
+}
+
+static inline long long ws_deque_size(ws_deque_t *d)
+{
+    long long n = atomic_load_explicit(&d->bottom, memory_order_relaxed) -
+                  atomic_load_explicit(&d->top, memory_order_relaxed);
+    return n > 0 ? n : 0;
+}
+
+/**
+ * Fds submitted but not yet picked up by a worker; approximate.
+ * @param ex The executor.
+ */
+static inline long long ws_executor_pending(ws_executor_t *ex)
+{
+    int count = atomic_load_explicit(&ex->count, memory_order_relaxed);
+    long long n = 0;
+    for (int i = 0; i < count; i++)
+        n += (long long)mpmc_queue_size(&ex->workers[i].inbox) + ws_deque_size(&ex->workers[i].deque);
+    return n;
+}
+
+/* ================= Workers ================= */
+
+/* Tasks a worker holds: queued in its inbox and deque, plus the one it runs. */
+static inline long long ws_worker_load(ws_worker_t *w)
+{
+    return (long long)mpmc_queue_size(&w->inbox) + ws_deque_size(&w->deque) +
+           atomic_load_explicit(&w->busy, memory_order_relaxed);
+}
+
+static inline void ws_wake(ws_worker_t *w)
+{
+    // Release: a sleeper that reads the new key also sees what came before
+    atomic_fetch_add_explicit(&w->wake_seq, 1, memory_order_release);
+    syscall(SYS_futex, &w->wake_seq, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* Wakes one sleeping worker to steal what self left queued. */
+static inline void ws_wake_thief(ws_executor_t *ex, ws_worker_t *self)
+{
+    // Pairs with the fence in ws_sleep: it sees us asleep or we see its backlog
+    atomic_thread_fence(memory_order_seq_cst);
+    int count = atomic_load_explicit(&ex->count, memory_order_acquire);
+    for (int k = 1; k < count; k++)
+    {
+        ws_worker_t *w = &ex->workers[(self->index + k) % count];
+        if (atomic_load_explicit(&w->sleeping, memory_order_relaxed))
+        {
+            ws_wake(w);
+            return;
+        }
+    }
+}
+
+/* Takes an fd from another worker's deque, or from its inbox. */
+static inline int ws_steal(ws_executor_t *ex, ws_worker_t *self, int *fd)
+{
+    int count = atomic_load_explicit(&ex->count, memory_order_acquire);
+    for (int k = 1; k < count; k++)
+    {
+        ws_worker_t *victim = &ex->workers[(self->index + k) % count];
+        int r;
+        while ((r = ws_deque_steal(&victim->deque, fd)) == -2)
+            mpmc_cpu_relax();
+        if (r == 0 || mpmc_queue_try_pop(&victim->inbox, fd) == 0)
+        {
+            if (ws_worker_load(victim) > 1)
+                ws_wake_thief(ex, self); // more to take: pass it on
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* Whether an idle worker may exit: above the minimum, with every worker after it gone. */
+static inline int ws_may_retire(ws_executor_t *ex, ws_worker_t *w)
+{
+    int count = atomic_load_explicit(&ex->count, memory_order_acquire);
+    if (w->index < ex->min_workers)
+        return 0;
+    for (int i = w->index + 1; i < count; i++)
+        if (!atomic_load_explicit(&ex->workers[i].retired, memory_order_acquire))
+            return 0;
+    return 1;
+}
+
+/*
+ * Blocks until the acceptor hands this worker something, a worker with a
+ * backlog wakes it, or timeout_ns passes (negative: no limit). With timeout_ns
+ * 0 the worker has idled out and sleeps until woken, unless its turn to exit
+ * has come.
+ */
+static inline void ws_sleep(ws_executor_t *ex, ws_worker_t *w, long long timeout_ns)
+{
+    struct timespec timeout = {timeout_ns / 1000000000, timeout_ns % 1000000000};
+    unsigned key = atomic_load_explicit(&w->wake_seq, memory_order_relaxed);
+    atomic_store_explicit(&w->sleeping, 1, memory_order_relaxed);
+    // Pairs with the fences in ws_executor_submit and ws_wake_thief: they see
+    // us asleep or we see what they queued
+    atomic_thread_fence(memory_order_seq_cst);
+    // The worker after this one wakes it after it is marked retired; checking
+    // for that after reading the key (the fence makes it acquire) means the
+    // wake-up cannot be lost
+    if (!ws_executor_pending(ex) && !(timeout_ns == 0 && ws_may_retire(ex, w)))
+        syscall(SYS_futex, &w->wake_seq, FUTEX_WAIT_PRIVATE, key, timeout_ns > 0 ? &timeout : NULL, NULL, 0);
+    atomic_store_explicit(&w->sleeping, 0, memory_order_relaxed);
+}
+
+/*
+ * Decides whether an idle worker exits: if ws_may_retire, and only if nothing
+ * reached its inbox meanwhile. Returns 0 if it does.
+ */
+static inline int ws_retire(ws_executor_t *ex, ws_worker_t *w)
+{
+    if (!ws_may_retire(ex, w))
+        return -1;
+    atomic_store_explicit(&w->retiring, 1, memory_order_relaxed);
+    // Pairs with the fence in ws_executor_submit: it sees us retiring (and
+    // takes its fd back) or we see its fd
+    atomic_thread_fence(memory_order_seq_cst);
+    if (mpmc_queue_size(&w->inbox) || ws_deque_size(&w->deque))
+    {
+        atomic_store_explicit(&w->retiring, 0, memory_order_relaxed);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Next fd for a worker: its deque, then a batch from its inbox, then stealing.
+ * Returns 0, or -1 when the worker idled out and must exit.
+ */
+static inline int ws_next(ws_executor_t *ex, ws_worker_t *w, int *out)
+{
+    int fd;
+    long long idle_until = 0; // ns; set when it first finds nothing to do
+    while (1)
+    {
+        // Oldest first, like the thieves: requests are independent, so the
+        // cache-warm newest one is not worth a longer tail
+        int r;
+        while ((r = ws_deque_steal(&w->deque, &fd)) == -2)
+            mpmc_cpu_relax();
+        if (r == 0)
+            break;
+        if (mpmc_queue_try_pop(&w->inbox, &fd) == 0)
+        {
+            // Queue the rest where idle workers can steal it
+            int more, moved = 0;
+            for (int i = 1; i < WS_BATCH && mpmc_queue_try_pop(&w->inbox, &more) == 0; i++, moved++)
+                ws_deque_push(&w->deque, more);
+            if (moved)
+                ws_wake_thief(ex, w);
+            break;
+        }
+        if (ws_steal(ex, w, &fd) == 0)
+            break;
+        long long left = -1;
+        if (ex->idle_timeout_ms)
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long long now_ns = now.tv_sec * 1000000000LL + now.tv_nsec;
+            if (!idle_until)
+                idle_until = now_ns + ex->idle_timeout_ms * 1000000LL;
+            left = idle_until > now_ns ? idle_until - now_ns : 0;
+            if (!left && ws_retire(ex, w) == 0)
+                return -1;
+        }
+        ws_sleep(ex, w, left);
+    }
+    *out = fd;
+    return 0;
+}
+
+static void *ws_worker_main(void *arg)
+{
+    ws_worker_t *w = arg;
+    ws_executor_t *ex = w->executor;
+    void *state = ex->init ? ex->init(w->index) : NULL;
+    int fd;
+    while (ws_next(ex, w, &fd) == 0)
+    {
+        atomic_store_explicit(&w->busy, 1, memory_order_relaxed);
+        ex->run(state, fd);
+        atomic_store_explicit(&w->busy, 0, memory_order_relaxed);
+    }
+    if (ex->fini)
+        ex->fini(state);
+    int index = w->index;
+    pthread_detach(pthread_self());
+    // Last touch of w: the acceptor may start a new worker in this slot now
+    atomic_store_explicit(&w->retired, 1, memory_order_release);
+    // The next one down may have idled out already: let it check again, now
+    // that it can see this one retired
+    if (index)
+        ws_wake(&ex->workers[index - 1]);
+    return NULL;
+}
+
+/* ================= Executor ================= */
+
+/**
+ * Prepares an executor with no workers.
+ * @param ex The executor.
+ * @param run Called by a worker for every submitted fd; owns the fd.
+ * @param init Called once by each worker before its first fd; its result is
+ *             passed to run (per-worker state). May be NULL.
+ * @param fini Called with that state by a worker that exits. May be NULL.
+ * @return 0 on success, -1 if out of memory.
+ */
+static inline int ws_executor_init(ws_executor_t *ex, ws_run_fn run, ws_init_fn init, ws_fini_fn fini)
+{
+    atomic_init(&ex->count, 0);
+    ex->run = run;
+    ex->init = init;
+    ex->fini = fini;
+    ex->min_workers = 0;
+    ex->idle_timeout_ms = 0;
+    for (int i = 0; i < WS_MAX_WORKERS; i++)
+    {
+        ws_worker_t *w = &ex->workers[i];
+        atomic_init(&w->deque.top, 0);
+        atomic_init(&w->deque.bottom, 0);
+        atomic_init(&w->busy, 0);
+        atomic_init(&w->sleeping, 0);
+        atomic_init(&w->wake_seq, 0);
+        atomic_init(&w->retiring, 0);
+        atomic_init(&w->retired, 0);
+        w->executor = ex;
+        w->index = i;
+        if (mpmc_queue_init(&w->inbox, WS_INBOX_SIZE) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * Lets workers that sleep for idle_timeout_ms exit, last started first, as
+ * long as min_workers stay. Call before starting workers.
+ * @param ex The executor.
+ * @param min_workers Workers that never exit.
+ * @param idle_timeout_ms Sleep before exiting; 0 (the default) never exits.
+ */
+static inline void ws_executor_set_idle_timeout(ws_executor_t *ex, int min_workers, unsigned idle_timeout_ms)
+{
+    ex->min_workers = min_workers;
+    ex->idle_timeout_ms = idle_timeout_ms;
+}
+
+/**
+ * Workers running now.
+ * @param ex The executor.
+ */
+static inline int ws_executor_size(ws_executor_t *ex)
+{
+    int count = atomic_load_explicit(&ex->count, memory_order_acquire), n = 0;
+    for (int i = 0; i < count; i++)
+        n += !atomic_load_explicit(&ex->workers[i].retired, memory_order_acquire);
+    return n;
+}
+
+static inline int ws_executor_submit(ws_executor_t *ex, int fd);
+
+/* Acceptor only: resubmits what reached a retired worker's inbox too late; closes what does not fit. */
+static inline void ws_rehome(ws_executor_t *ex, ws_worker_t *w)
+{
+    int fd;
+    while (mpmc_queue_try_pop(&w->inbox, &fd) == 0)
+        if (ws_executor_submit(ex, fd) < 0)
+            close(fd);
+}
+
+/* Acceptor only: reclaims the slots of retired workers at the end of the array. */
+static inline void ws_reap(ws_executor_t *ex)
+{
+    int count = atomic_load_explicit(&ex->count, memory_order_relaxed);
+    while (count && atomic_load_explicit(&ex->workers[count - 1].retired, memory_order_acquire))
+    {
+        ws_worker_t *w = &ex->workers[--count];
+        atomic_store_explicit(&ex->count, count, memory_order_release);
+        atomic_store_explicit(&w->retiring, 0, memory_order_relaxed);
+        atomic_store_explicit(&w->retired, 0, memory_order_relaxed);
+        ws_rehome(ex, w);
+    }
+}
+
+/**
+ * Starts one more worker thread. Only the acceptor thread may call it.
+ * @param ex The executor.
+ * @return The worker's index, or -1 at WS_MAX_WORKERS or if the thread
+ *         cannot be created.
+ */
+static inline int ws_executor_add_worker(ws_executor_t *ex)
+{
+    ws_reap(ex);
+    int i = atomic_load_explicit(&ex->count, memory_order_relaxed);
+    if (i == WS_MAX_WORKERS || pthread_create(&ex->workers[i].tid, NULL, ws_worker_main, &ex->workers[i]) != 0)
+        return -1;
+    atomic_store_explicit(&ex->count, i + 1, memory_order_release);
+    return i;
+}
+
+/**
+ * Hands an fd to the least-loaded worker, waking it if it sleeps. Only the
+ * acceptor thread may call it.
+ * @param ex The executor.
+ * @param fd The fd; the executor's run function will own it.
+ * @return 0 on success, -1 if that worker's inbox is full (the caller keeps the fd).
+ */
+static inline int ws_executor_submit(ws_executor_t *ex, int fd)
+{
+    ws_reap(ex);
+    int count = atomic_load_explicit(&ex->count, memory_order_relaxed);
+    ws_worker_t *target = NULL;
+    long long best = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (atomic_load_explicit(&ex->workers[i].retiring, memory_order_relaxed))
+            continue;
+        long long load = ws_worker_load(&ex->workers[i]);
+        if (!target || load < best)
+        {
+            target = &ex->workers[i];
+            best = load;
+            if (!load)
+                break;
+        }
+    }
+    if (!target || mpmc_queue_push(&target->inbox, fd) < 0)
+        return -1;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&target->retiring, memory_order_relaxed))
+    {
+        // It may have missed the fd: wait for its decision
+        while (atomic_load_explicit(&target->retiring, memory_order_relaxed) &&
+               !atomic_load_explicit(&target->retired, memory_order_acquire))
+            sched_yield();
+        if (atomic_load_explicit(&target->retired, memory_order_acquire))
+            ws_rehome(ex, target);
+        return 0;
+    }
+    if (atomic_load_explicit(&target->sleeping, memory_order_relaxed))
+        ws_wake(target);
+    return 0;
+}
+
+#endif
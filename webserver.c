@@ -31,6 +31,9 @@ int main()
         exit(EXIT_FAILURE);
     }
 
+    int opt = 1;
+    setsockopt(server_socket_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
     // Set up server address struct
     server_address.sin_family = AF_INET;
     server_address.sin_port = htons(PORT);